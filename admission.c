@@ -0,0 +1,262 @@
+#include "smallsh.h"
+
+struct admission_limits admission = {0, -1, -1, -1, ADMIT_FIFO, -1, -1, -1, {0, 0}, NULL};
+
+/**
+ * This function should set the admission limits from the SMALLSH_ADMIT
+ * environment variable, a comma-separated list of jobs=N (running
+ * background jobs), cpu=P and memory=P (PSI "some avg10" percentages),
+ * load=L (1 minute load average) and order=fifo|priority. Limits that
+ * aren't given are off. The /proc files are opened once and re-read with
+ * pread().
+ */
+void set_admission(void){
+    char* spec = getenv("SMALLSH_ADMIT");
+    if(spec == NULL){
+        return;
+    }
+
+    char* copy = strdup(spec);
+    char* saveptr = NULL;
+    for(char* item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)){
+        char* value = strchr(item, '=');
+        if(value == NULL){
+            continue;
+        }
+        *value++ = '\0';
+        if(strcmp(item, "jobs") == 0){
+            admission.max_jobs = atoi(value);
+        }
+        else if(strcmp(item, "cpu") == 0){
+            admission.max_cpu = atof(value);
+        }
+        else if(strcmp(item, "memory") == 0){
+            admission.max_memory = atof(value);
+        }
+        else if(strcmp(item, "load") == 0){
+            admission.max_load = atof(value);
+        }
+        else if(strcmp(item, "order") == 0){
+            admission.order = strcmp(value, "priority") == 0 ? ADMIT_PRIORITY : ADMIT_FIFO;
+        }
+    }
+    free(copy);
+
+    if(admission.max_cpu >= 0){
+        admission.cpu_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+    }
+    if(admission.max_memory >= 0){
+        admission.memory_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    }
+    if(admission.max_load >= 0){
+        admission.load_fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    }
+}
+
+/**
+ * This function should read the "some avg10" percentage from a PSI file,
+ * or the 1 minute load average from /proc/loadavg. Returns -1 if it can't
+ * be read, which never holds a job.
+ * 
+ * Params:
+ *   fd - open PSI file or /proc/loadavg
+ *   key - "avg10=" for PSI, "" for the first field of /proc/loadavg
+ */
+double read_pressure(int fd, char* key){
+    char buffer[256];
+
+    if(fd == -1){
+        return -1;
+    }
+    ssize_t num_read = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if(num_read <= 0){
+        return -1;
+    }
+    buffer[num_read] = '\0';
+    char* value = strstr(buffer, key);
+    return value == NULL ? -1 : atof(value + strlen(key));
+}
+
+/**
+ * This function should decide if a new background job has to wait. The
+ * running limit is checked every time. Pressure and load only change
+ * slowly, so they are re-read at most every ADMIT_RECHECK_MS. They never
+ * hold a job when no background job of ours is running, so the queue always
+ * makes progress. Returns a short reason, or NULL to start the job now.
+ * 
+ * Params:
+ *   jobs - job table
+ */
+char* admission_hold(struct job_table* jobs){
+    struct timespec now;
+
+    if(admission.max_jobs > 0 && jobs->num_background_running >= admission.max_jobs){
+        return "running limit";
+    }
+    if(jobs->num_background_running == 0){
+        return NULL;
+    }
+    if(admission.cpu_fd == -1 && admission.memory_fd == -1 && admission.load_fd == -1){
+        return NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms = (now.tv_sec - admission.checked_at.tv_sec) * 1000 + (now.tv_nsec - admission.checked_at.tv_nsec) / 1000000;
+    if(admission.checked_at.tv_sec == 0 || elapsed_ms >= ADMIT_RECHECK_MS){
+        admission.checked_at = now;
+        admission.pressure_reason = NULL;
+        if(admission.cpu_fd != -1 && read_pressure(admission.cpu_fd, "avg10=") > admission.max_cpu){
+            admission.pressure_reason = "cpu pressure";
+        }
+        else if(admission.memory_fd != -1 && read_pressure(admission.memory_fd, "avg10=") > admission.max_memory){
+            admission.pressure_reason = "memory pressure";
+        }
+        else if(admission.load_fd != -1 && read_pressure(admission.load_fd, "") > admission.max_load){
+            admission.pressure_reason = "load";
+        }
+    }
+    return admission.pressure_reason;
+}
+
+/**
+ * This function should find a held job's priority. In priority order a job
+ * started with "nice [-n N]" waits behind plain jobs, like its nice value
+ * would make it; lower values are admitted first. In FIFO order every job
+ * has priority 0.
+ * 
+ * Params:
+ *   args - NULL-terminated command args
+ */
+int job_priority(char** args){
+    if(strncmp(args[0], "@cpus=", 6) == 0 && args[1] != NULL){ //Placement annotation
+        args++;
+    }
+    if(admission.order != ADMIT_PRIORITY || strcmp(args[0], "nice") != 0){
+        return 0;
+    }
+    if(args[1] != NULL && strcmp(args[1], "-n") == 0 && args[2] != NULL){
+        return atoi(args[2]);
+    }
+    if(args[1] != NULL && strncmp(args[1], "-n", 2) == 0){
+        return atoi(args[1] + 2);
+    }
+    return 10; //nice's default adjustment
+}
+
+/**
+ * This function should hold a background command in the admission queue.
+ * Its args are copied into one block, since the command struct is reused
+ * for the next line, and the current directory is kept open so relative
+ * paths and redirections resolve where it was typed. Pipeline syntax is checked now so errors show up at
+ * the prompt that caused them. Returns 0 if queued, 1 on a syntax error.
+ * 
+ * Params:
+ *   input - command struct that holds args, '&' already removed
+ *   jobs - job table
+ *   reason - why the job is held, for the message
+ */
+int queue_background(struct command* input, struct job_table* jobs, char* reason){
+    size_t length = 0;
+    char** stages[MAX_STAGES];
+
+    for(int i = 0; i < input->num_args; i++){
+        length += strlen(input->args[i]) + 1;
+    }
+    struct queued_job* queued = malloc(sizeof(struct queued_job) + (input->num_args + 1) * sizeof(char*) + length);
+    char* ptr = (char*)(queued->args + input->num_args + 1);
+    for(int i = 0; i < input->num_args; i++){
+        queued->args[i] = ptr;
+        ptr = stpcpy(ptr, input->args[i]) + 1;
+    }
+    queued->args[input->num_args] = NULL;
+    queued->num_args = input->num_args;
+
+    if(split_pipeline(input, stages) == -1){
+        free(queued);
+        return 1;
+    }
+
+    queued->id = ++jobs->last_queue_id;
+    queued->priority = job_priority(queued->args);
+    queued->timeout = jobs->next_timeout;
+    queued->grace = jobs->next_grace;
+    queued->cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    clock_gettime(CLOCK_MONOTONIC, &queued->queued_at);
+
+    //Sorted by priority, FIFO among equals
+    struct queued_job** link = &jobs->queue_head;
+    while(*link != NULL && (*link)->priority <= queued->priority){
+        link = &(*link)->next;
+    }
+    queued->next = *link;
+    *link = queued;
+    jobs->num_queued++;
+
+    printf("background job %d is queued (%s)\n", queued->id, reason);
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * This function should start held background jobs, in queue order, for as
+ * long as admission_hold() allows. Called by the reaper whenever a job
+ * finishes, and on a timer while jobs are waiting. A job's deadline starts
+ * when it is admitted, not while it waits. Each job is launched from the
+ * directory it was queued in, then the shell goes back to its own.
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void admit_jobs(struct job_table* jobs){
+    while(jobs->queue_head != NULL && admission_hold(jobs) == NULL){
+        struct queued_job* queued = jobs->queue_head;
+        struct command command = {0};
+
+        jobs->queue_head = queued->next;
+        jobs->num_queued--;
+        command.args = queued->args;
+        command.num_args = queued->num_args;
+
+        double next_timeout = jobs->next_timeout, next_grace = jobs->next_grace;
+        jobs->next_timeout = queued->timeout;
+        jobs->next_grace = queued->grace;
+        int saved_cwd = queued->cwd_fd != -1 ? open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+        if(saved_cwd != -1){
+            fchdir(queued->cwd_fd);
+        }
+        struct job* job = launch_background(&command, jobs);
+        if(saved_cwd != -1){
+            fchdir(saved_cwd);
+            close(saved_cwd);
+        }
+        jobs->next_timeout = next_timeout;
+        jobs->next_grace = next_grace;
+        if(job != NULL){
+            jobs->last_background_pid = job->pid;
+            printf("background process pid is %d (queued job %d)\n", job->pid, queued->id);
+            fflush(stdout);
+        }
+        if(queued->cwd_fd != -1){
+            close(queued->cwd_fd);
+        }
+        free(queued);
+    }
+}
+
+/**
+ * This function should drop every job still held, at exit
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void free_admission_queue(struct job_table* jobs){
+    while(jobs->queue_head != NULL){
+        struct queued_job* queued = jobs->queue_head;
+        jobs->queue_head = queued->next;
+        if(queued->cwd_fd != -1){
+            close(queued->cwd_fd);
+        }
+        free(queued);
+    }
+    jobs->num_queued = 0;
+}
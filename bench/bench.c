@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * End-to-end benchmark: drives a built smallsh binary through fixed workloads
+ * and prints per-command latency percentiles and throughput as JSON.
+ *
+ * Usage:
+ *   bench/bench [smallsh binary] [commands per workload]
+ *
+ * Each command is written to smallsh's stdin and timed until the next ": "
+ * prompt comes back, so latency covers reading, expansion, tokenizing,
+ * launching and reaping.
+ */
+
+//Struct to hold a running smallsh and the pipes to talk to it
+struct shell_process{
+    pid_t pid;
+    int input_fd; //Write commands here
+    int output_fd; //Prompts and output come back here
+};
+
+/**
+ * This function should start smallsh in dir with pipes on its stdin/stdout
+ * 
+ * Params:
+ *   binary - path to smallsh
+ *   dir - working directory for the shell
+ *   shell - struct to fill in
+ */
+void start_shell(char* binary, char* dir, struct shell_process* shell){
+    int to_shell[2], from_shell[2];
+    if(pipe(to_shell) == -1 || pipe(from_shell) == -1){
+        perror("pipe");
+        exit(1);
+    }
+
+    shell->pid = fork();
+    if(shell->pid == 0){
+        dup2(to_shell[0], 0);
+        dup2(from_shell[1], 1);
+        close(to_shell[1]);
+        close(from_shell[0]);
+        if(chdir(dir) == -1){
+            perror("chdir");
+            _exit(1);
+        }
+        execl(binary, binary, (char*)NULL);
+        perror(binary);
+        _exit(1);
+    }
+    close(to_shell[0]);
+    close(from_shell[1]);
+    shell->input_fd = to_shell[1];
+    shell->output_fd = from_shell[0];
+}
+
+/**
+ * This function should read the shell's output until it ends with the ": "
+ * prompt. Returns -1 if the shell went away.
+ * 
+ * Params:
+ *   shell - running shell
+ */
+int wait_for_prompt(struct shell_process* shell){
+    char buffer[4096];
+    char tail[2] = {0, 0};
+
+    while(1){
+        ssize_t num_read = read(shell->output_fd, buffer, sizeof(buffer));
+        if(num_read <= 0){
+            return -1;
+        }
+        if(num_read >= 2){
+            tail[0] = buffer[num_read - 2];
+            tail[1] = buffer[num_read - 1];
+        }
+        else{
+            tail[0] = tail[1];
+            tail[1] = buffer[0];
+        }
+        if(tail[0] == ':' && tail[1] == ' '){
+            return 0;
+        }
+    }
+}
+
+/**
+ * This function should compare two doubles for qsort()
+ * 
+ * Params:
+ *   a - first double
+ *   b - second double
+ */
+int compare_double(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * This function should run one workload in a fresh shell, timing each
+ * command until its prompt returns, and print the results as a JSON object
+ * 
+ * Params:
+ *   name - workload name for the JSON
+ *   line - command line to send, newline-terminated
+ *   runs - number of times to send it
+ *   binary - path to smallsh
+ *   dir - working directory for the shell
+ *   last - 1 if this is the last workload (no trailing comma)
+ */
+void run_workload(char* name, char* line, int runs, char* binary, char* dir, int last){
+    struct shell_process shell;
+    double* samples = malloc(runs * sizeof(double));
+    struct timespec start, end, first, done;
+    size_t length = strlen(line);
+
+    start_shell(binary, dir, &shell);
+    wait_for_prompt(&shell);
+
+    clock_gettime(CLOCK_MONOTONIC, &first);
+    for(int i = 0; i < runs; i++){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(write(shell.input_fd, line, length) != (ssize_t)length || wait_for_prompt(&shell) == -1){
+            fprintf(stderr, "bench: smallsh exited during %s\n", name);
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[i] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &done);
+
+    if(write(shell.input_fd, "exit\n", 5) != 5){
+        perror("write");
+    }
+    close(shell.input_fd);
+    close(shell.output_fd);
+    waitpid(shell.pid, NULL, 0);
+
+    double seconds = (done.tv_sec - first.tv_sec) + (done.tv_nsec - first.tv_nsec) / 1e9;
+    qsort(samples, runs, sizeof(double), compare_double);
+    printf("    {\"name\": \"%s\", \"commands\": %d, \"seconds\": %.4f, \"commands_per_sec\": %.1f, "
+        "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}%s\n", name, runs, seconds, runs / seconds,
+        samples[runs / 2], samples[(int)(runs * 0.99)], samples[runs - 1], last ? "" : ",");
+    fflush(stdout);
+    free(samples);
+}
+
+int main(int argc, char* argv[]){
+    char* binary = argc > 1 ? argv[1] : "./smallsh";
+    int runs = argc > 2 ? atoi(argv[2]) : 2000;
+    char dir[] = "/tmp/smallsh-bench-XXXXXX";
+    char binary_path[4096];
+    static char line[65536];
+
+    if(runs < 1 || realpath(binary, binary_path) == NULL || mkdtemp(dir) == NULL){
+        fprintf(stderr, "usage: bench [smallsh binary] [commands per workload]\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    //Input file for the redirection workload
+    snprintf(line, sizeof(line), "%s/in", dir);
+    FILE* in = fopen(line, "w");
+    for(int i = 0; i < 100; i++){
+        fprintf(in, "line %d of the redirection input\n", i);
+    }
+    fclose(in);
+
+    printf("{\n  \"binary\": \"%s\",\n  \"workloads\": [\n", binary_path);
+    //"command" keeps these on the spawn path they have always measured, true and cat are fast path built-ins now
+    run_workload("foreground_true", "command true\n", runs, binary_path, dir, 0);
+    run_workload("builtin_true", "true\n", runs, binary_path, dir, 0);
+    run_workload("background_true", "true &\n", runs, binary_path, dir, 0);
+    run_workload("redirection", "command cat < in > out\n", runs, binary_path, dir, 0);
+
+    //100 $$ per line
+    strcpy(line, "command true");
+    for(int i = 0; i < 100; i++){
+        strcat(line, " x$$");
+    }
+    strcat(line, "\n");
+    run_workload("pid_expansion", line, runs, binary_path, dir, 0);
+
+    //5000 args, past the old 512 arg limit
+    strcpy(line, "command true");
+    for(int i = 0; i < 4999; i++){
+        strcat(line, " a");
+    }
+    strcat(line, "\n");
+    run_workload("long_argv", line, runs, binary_path, dir, 1);
+    printf("  ]\n}\n");
+
+    snprintf(line, sizeof(line), "rm -rf %s", dir);
+    return system(line) != 0;
+}
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Copy throughput: times "cat big > out" and "cp big out" run in the shell
+# (copy_file_range/sendfile/splice) against the same lines forced through
+# fork/exec of the real tools with "command", and reports GB/s as JSON. Then
+# runs a script of small copies both ways and reports copies/sec, where the
+# fork/exec saved matters more than how the bytes move.
+#
+# Usage:
+#   bench/copy_throughput.sh [smallsh binary] [file size in MB] [runs] [directory] [small copies]
+#
+# The file is created in the directory (default: a temp dir under /tmp), so
+# point it at the filesystem you care about: reflink-capable ones (btrfs,
+# XFS) show copy_file_range() sharing extents instead of copying. Every run
+# removes its output first; the source stays in the page cache after the
+# first, untimed, copy.
+
+SMALLSH=${1:-./smallsh}
+SIZE_MB=${2:-2048}
+RUNS=${3:-3}
+SMALL=${5:-2000}
+DIR=$(mktemp -d "${4:-/tmp}/smallsh-copy-XXXXXX")
+trap 'rm -rf "$DIR"' EXIT
+
+head -c "${SIZE_MB}M" /dev/urandom > "$DIR/big"
+"$SMALLSH" -c "command cat $DIR/big > $DIR/out" > /dev/null
+
+SEPARATOR=""
+printf '{"bench":"copy_throughput","size_mb":%d,"runs":%d,"workloads":[' "$SIZE_MB" "$RUNS"
+for WORKLOAD in "in_process_cat:cat $DIR/big > $DIR/out" "fork_exec_cat:command cat $DIR/big > $DIR/out" \
+                "in_process_cp:cp $DIR/big $DIR/out" "fork_exec_cp:command cp $DIR/big $DIR/out"; do
+    NAME=${WORKLOAD%%:*}
+    LINE=${WORKLOAD#*:}
+    TOTAL=0
+    for RUN in $(seq "$RUNS"); do
+        rm -f "$DIR/out"
+        START=$(date +%s%N)
+        "$SMALLSH" -c "$LINE" > /dev/null
+        END=$(date +%s%N)
+        TOTAL=$((TOTAL + END - START))
+        if ! cmp -s "$DIR/big" "$DIR/out"; then
+            echo "copy_throughput: $NAME produced a different file" >&2
+            exit 1
+        fi
+    done
+    awk -v name="$NAME" -v mb="$SIZE_MB" -v runs="$RUNS" -v ns="$TOTAL" -v separator="$SEPARATOR" 'BEGIN{
+        printf "%s{\"name\":\"%s\",\"seconds\":%.3f,\"gb_per_sec\":%.2f}", separator, name, ns / runs / 1e9, mb / 1024 * runs / (ns / 1e9)
+    }'
+    SEPARATOR=","
+done
+
+head -c 4096 /dev/urandom > "$DIR/small"
+for WORKLOAD in "in_process_small_cat:cat small > out" "fork_exec_small_cat:command cat small > out" \
+                "in_process_small_cp:cp small out" "fork_exec_small_cp:command cp small out"; do
+    NAME=${WORKLOAD%%:*}
+    LINE=${WORKLOAD#*:}
+    awk -v lines="$SMALL" -v line="$LINE" -v dir="$DIR" 'BEGIN{
+        print "cd " dir;
+        for(i = 0; i < lines; i++) print line;
+    }' > "$DIR/script"
+    rm -f "$DIR/out"
+    START=$(date +%s%N)
+    "$SMALLSH" "$DIR/script" > /dev/null
+    END=$(date +%s%N)
+    awk -v name="$NAME" -v lines="$SMALL" -v ns=$((END - START)) 'BEGIN{
+        printf ",{\"name\":\"%s\",\"copies\":%d,\"seconds\":%.3f,\"copies_per_sec\":%.0f}", name, lines, ns / 1e9, lines / (ns / 1e9)
+    }'
+done
+printf ']}\n'
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Script mode throughput: runs a generated script through smallsh and reports
+# commands/sec.
+#
+# Usage:
+#   bench/script_throughput.sh [smallsh binary] [lines] [external every N lines]
+#
+# Lines are built-ins and comments so the number measures the shell itself.
+# Set the third argument to mix in a "command true" (an external run) every N
+# lines (0 = never).
+# With SMALLSH_SCRIPT_CACHE=1 in the environment, an untimed first run builds
+# the parsed-script cache and the timed run executes from it.
+
+SMALLSH=${1:-./smallsh}
+LINES=${2:-1000000}
+EXTERNAL_EVERY=${3:-0}
+SCRIPT=$(mktemp)
+CACHE_DIR=$(mktemp -d)
+trap 'rm -rf "$SCRIPT" "$CACHE_DIR"' EXIT
+export XDG_CACHE_HOME="$CACHE_DIR"
+
+awk -v lines="$LINES" -v every="$EXTERNAL_EVERY" 'BEGIN{
+    for(i = 1; i <= lines; i++){
+        if(every > 0 && i % every == 0) print "command true";
+        else if(i % 4 == 0) print "# comment line " i;
+        else print "cd .";
+    }
+}' > "$SCRIPT"
+
+if [ -n "$SMALLSH_SCRIPT_CACHE" ]; then
+    "$SMALLSH" "$SCRIPT" > /dev/null
+fi
+
+START=$(date +%s%N)
+"$SMALLSH" "$SCRIPT" > /dev/null
+END=$(date +%s%N)
+
+awk -v lines="$LINES" -v ns=$((END - START)) 'BEGIN{
+    printf "{\"bench\":\"script_throughput\",\"lines\":%d,\"seconds\":%.3f,\"commands_per_sec\":%.0f}\n", lines, ns / 1e9, lines / (ns / 1e9)
+}'
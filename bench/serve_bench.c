@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <signal.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Daemon benchmark: starts "smallsh --serve" and drives it from 1, 10 and
+ * 100 concurrent connections, printing commands/sec and per-command latency
+ * percentiles as JSON.
+ * 
+ * Usage:
+ *   bench/serve_bench [smallsh binary] [commands per workload]
+ * 
+ * Every connection sends one command, waits for its status frame and sends
+ * the next, so latency covers the round trip through the daemon's event
+ * loop, and with many clients, the queueing behind the others.
+ */
+
+//Struct for one benchmark connection
+struct connection{
+    int fd;
+    int remaining; //Commands still to send
+    struct timespec sent; //When the command in flight was sent
+    char buffer[65536]; //Frames not parsed yet
+    size_t used;
+};
+
+/**
+ * This function should compare two doubles for qsort()
+ * 
+ * Params:
+ *   a - first double
+ *   b - second double
+ */
+int compare_double(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * This function should connect to the daemon, retrying while it starts up.
+ * Returns the socket, or -1.
+ * 
+ * Params:
+ *   path - daemon's socket
+ */
+int connect_daemon(char* path){
+    struct sockaddr_un address = {0};
+
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    for(int attempt = 0; attempt < 200; attempt++){
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0){
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+/**
+ * This function should send a connection's next command
+ * 
+ * Params:
+ *   connection - connection to send on
+ *   line - command line, newline-terminated
+ *   length - bytes of line
+ */
+void send_command(struct connection* connection, char* line, size_t length){
+    clock_gettime(CLOCK_MONOTONIC, &connection->sent);
+    if(write(connection->fd, line, length) != (ssize_t)length){
+        fprintf(stderr, "serve_bench: daemon went away\n");
+        exit(1);
+    }
+    connection->remaining--;
+}
+
+/**
+ * This function should count the status frames in what a connection has
+ * received, skipping output frames. Returns -1 if the daemon closed it.
+ * 
+ * Params:
+ *   connection - readable connection
+ */
+int read_statuses(struct connection* connection){
+    int num_statuses = 0;
+    size_t start = 0;
+    char* end;
+
+    ssize_t num_read = read(connection->fd, connection->buffer + connection->used, sizeof(connection->buffer) - connection->used);
+    if(num_read <= 0){
+        return -1;
+    }
+    connection->used += num_read;
+
+    while((end = memchr(connection->buffer + start, '\n', connection->used - start)) != NULL){
+        size_t header = end - (connection->buffer + start) + 1;
+        size_t number = strtoul(connection->buffer + start + 2, NULL, 10);
+        if(connection->buffer[start] == 'o'){
+            if(connection->used - start < header + number){
+                break;
+            }
+            start += header + number;
+            continue;
+        }
+        num_statuses++;
+        start += header;
+    }
+    memmove(connection->buffer, connection->buffer + start, connection->used - start);
+    connection->used -= start;
+    return num_statuses;
+}
+
+/**
+ * This function should run one workload: clients connections each send
+ * their share of runs commands, one at a time, all driven from one epoll
+ * loop. Prints the results as a JSON object.
+ * 
+ * Params:
+ *   name - workload name for the JSON
+ *   line - command line to send, newline-terminated
+ *   runs - total commands across every connection
+ *   clients - concurrent connections
+ *   path - daemon's socket
+ *   last - 1 if this is the last workload (no trailing comma)
+ */
+void run_workload(char* name, char* line, int runs, int clients, char* path, int last){
+    struct connection* connections = calloc(clients, sizeof(struct connection));
+    double* samples = malloc(runs * sizeof(double));
+    int num_samples = 0;
+    size_t length = strlen(line);
+    struct timespec first, done, now;
+    struct epoll_event events[128];
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    for(int i = 0; i < clients; i++){
+        connections[i].fd = connect_daemon(path);
+        if(connections[i].fd == -1){
+            fprintf(stderr, "serve_bench: can't connect to %s\n", path);
+            exit(1);
+        }
+        connections[i].remaining = runs / clients + (i < runs % clients);
+        struct epoll_event event = {EPOLLIN, {.ptr = &connections[i]}};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connections[i].fd, &event);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &first);
+    int in_flight = 0;
+    for(int i = 0; i < clients; i++){
+        if(connections[i].remaining > 0){
+            send_command(&connections[i], line, length);
+            in_flight++;
+        }
+    }
+    while(in_flight > 0){
+        int num_events = epoll_wait(epoll_fd, events, 128, -1);
+        for(int i = 0; i < num_events; i++){
+            struct connection* connection = events[i].data.ptr;
+            int num_statuses = read_statuses(connection);
+            if(num_statuses == -1){
+                fprintf(stderr, "serve_bench: daemon closed a connection during %s\n", name);
+                exit(1);
+            }
+            if(num_statuses == 0){
+                continue;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            samples[num_samples++] = (now.tv_sec - connection->sent.tv_sec) * 1e6 + (now.tv_nsec - connection->sent.tv_nsec) / 1e3;
+            in_flight--;
+            if(connection->remaining > 0){
+                send_command(connection, line, length);
+                in_flight++;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &done);
+
+    for(int i = 0; i < clients; i++){
+        close(connections[i].fd);
+    }
+    close(epoll_fd);
+
+    double seconds = (done.tv_sec - first.tv_sec) + (done.tv_nsec - first.tv_nsec) / 1e9;
+    qsort(samples, num_samples, sizeof(double), compare_double);
+    printf("    {\"name\": \"%s\", \"clients\": %d, \"commands\": %d, \"seconds\": %.4f, \"commands_per_sec\": %.1f, "
+        "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}%s\n", name, clients, num_samples, seconds, num_samples / seconds,
+        samples[num_samples / 2], samples[(int)(num_samples * 0.99)], samples[num_samples - 1], last ? "" : ",");
+    fflush(stdout);
+    free(samples);
+    free(connections);
+}
+
+int main(int argc, char* argv[]){
+    char* binary = argc > 1 ? argv[1] : "./smallsh";
+    int runs = argc > 2 ? atoi(argv[2]) : 2000;
+    char dir[] = "/tmp/smallsh-serve-XXXXXX";
+    char binary_path[4096];
+    char path[4096];
+    int client_counts[] = {1, 10, 100};
+
+    if(runs < 100 || realpath(binary, binary_path) == NULL || mkdtemp(dir) == NULL){
+        fprintf(stderr, "usage: serve_bench [smallsh binary] [commands per workload, at least 100]\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    snprintf(path, sizeof(path), "%s/sock", dir);
+
+    pid_t daemon = fork();
+    if(daemon == 0){
+        if(chdir(dir) == -1){
+            perror("chdir");
+            _exit(1);
+        }
+        execl(binary_path, binary_path, "--serve", path, (char*)NULL);
+        perror(binary_path);
+        _exit(1);
+    }
+
+    printf("{\n  \"binary\": \"%s\",\n  \"workloads\": [\n", binary_path);
+    for(int i = 0; i < 3; i++){
+        char name[64];
+        snprintf(name, sizeof(name), "builtin_true_%d", client_counts[i]);
+        run_workload(name, "true\n", runs, client_counts[i], path, 0);
+        snprintf(name, sizeof(name), "external_true_%d", client_counts[i]);
+        run_workload(name, "command true\n", runs, client_counts[i], path, i == 2);
+    }
+    printf("  ]\n}\n");
+
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "../smallsh.h"
+#include <time.h>
+
+/*
+ * Spawn latency comparison between the fork(), posix_spawn() and zygote
+ * launch paths as the shell grows.
+ *
+ * To compile, from the repo root:
+ *   gcc --std=c99 -O2 smallsh.c builtins.c expand.c glob.c pathcache.c pipeline.c zygote.c jobs.c output.c admission.c placement.c trace.c script.c scriptcache.c history.c serve.c timeout.c substitute.c copy.c metrics.c parallel.c bench/spawn_latency.c -o spawn_latency
+ *
+ * Usage:
+ *   ./spawn_latency [runs] [shell sizes in MB...]
+ *
+ * For each size this process is padded with touched heap memory, since
+ * fork() gets slower the bigger the parent is. posix_spawn() and the zygote
+ * (started before any padding, like the shell does at startup) should not.
+ */
+
+/**
+ * This function should compare two doubles for qsort()
+ * 
+ * Params:
+ *   a - first double
+ *   b - second double
+ */
+int compare_double(const void* a, const void* b){
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * This function should run "true" in the foreground runs times with the
+ * given spawn mode and print mean/p50/p99 launch-to-reap latency
+ * 
+ * Params:
+ *   mode - SPAWN_POSIX, SPAWN_FORK or SPAWN_ZYGOTE
+ *   runs - number of commands to time
+ *   input - command struct to reuse
+ *   jobs - job table to reap through
+ */
+void time_mode(int mode, int runs, struct command* input, struct job_table* jobs){
+    static char* names[] = {"spawn", "fork", "zygote"};
+    struct sigaction unused = {0};
+    double* samples = malloc(runs * sizeof(double));
+    double total = 0;
+    struct timespec start, end;
+
+    spawn_mode = mode;
+    for(int i = 0; i < runs; i++){
+        char line[] = "true\n";
+        populate_command(input, line, 0, 0);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        foreground_command(input, jobs, unused, unused, unused);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        reset_command(input);
+        samples[i] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        total += samples[i];
+    }
+
+    qsort(samples, runs, sizeof(double), compare_double);
+    printf("  %-6s runs=%d mean=%.1fus p50=%.1fus p99=%.1fus\n", names[mode],
+        runs, total / runs, samples[runs / 2], samples[(int)(runs * 0.99)]);
+    fflush(stdout);
+    free(samples);
+}
+
+/**
+ * This function should return this process's resident set size in MB
+ */
+long resident_mb(void){
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(statm != NULL){
+        if(fscanf(statm, "%*d %ld", &pages) != 1){
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+int main(int argc, char* argv[]){
+    int runs = argc > 1 ? atoi(argv[1]) : 1000;
+    size_t default_sizes[] = {0, 256, 1024};
+    int num_sizes = argc > 2 ? argc - 2 : 3;
+    struct command* input = malloc(sizeof(struct command));
+    init_command(input);
+    struct job_table jobs;
+    char* pad = NULL;
+    size_t pad_mb = 0;
+
+    init_job_table(&jobs);
+    int have_zygote = start_zygote() == 0; //Before padding, like the shell at startup
+
+    for(int i = 0; i < num_sizes; i++){
+        //Grow the "shell" so fork() has page tables to copy
+        size_t size = argc > 2 ? strtoul(argv[i + 2], NULL, 10) : default_sizes[i];
+        if(size > pad_mb){
+            pad = realloc(pad, size << 20);
+            memset(pad + (pad_mb << 20), 1, (size - pad_mb) << 20);
+            pad_mb = size;
+        }
+
+        printf("shell padding: %zu MB, rss: %ld MB\n", pad_mb, resident_mb());
+        time_mode(SPAWN_FORK, runs, input, &jobs);
+        time_mode(SPAWN_POSIX, runs, input, &jobs);
+        if(have_zygote){
+            time_mode(SPAWN_ZYGOTE, runs, input, &jobs);
+        }
+    }
+
+    stop_zygote();
+    free_job_table(&jobs);
+    free(pad);
+    free_command(input);
+    free(input);
+    return 0;
+}
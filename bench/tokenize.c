@@ -0,0 +1,123 @@
+#include "../smallsh.h"
+#include <time.h>
+
+/*
+ * Tokenizer throughput for populate_command()/reset_command().
+ *
+ * To compile, from the repo root:
+ *   gcc --std=c99 -O2 smallsh.c builtins.c expand.c glob.c pathcache.c pipeline.c zygote.c jobs.c output.c admission.c placement.c trace.c script.c scriptcache.c history.c serve.c timeout.c substitute.c copy.c metrics.c parallel.c bench/tokenize.c -o tokenize
+ *
+ * Usage:
+ *   ./tokenize [corpus file] [passes]
+ *
+ * With no corpus file a fixed synthetic corpus of 100000 command lines is
+ * generated, shaped like the generated scripts smallsh runs (short commands,
+ * file arguments, redirection and the odd background job).
+ */
+
+#define SYNTHETIC_LINES 100000
+
+/**
+ * This function should build the synthetic corpus as one newline-separated
+ * buffer and return it, setting num_lines
+ * 
+ * Params:
+ *   num_lines - pointer to int to hold the number of lines (by reference)
+ */
+char* synthetic_corpus(int* num_lines){
+    char* words[] = {"ls", "cat", "grep", "-l", "-v", "pattern", "src/main.c", "build/out.o",
+        "/var/log/app.log", "README.md", "--color=never", "data/part-00017.csv", "wc", "sort"};
+    int num_words = sizeof(words) / sizeof(words[0]);
+    char* corpus = malloc(SYNTHETIC_LINES * 256);
+    char* ptr = corpus;
+    unsigned int seed = 12345;
+
+    for(int i = 0; i < SYNTHETIC_LINES; i++){
+        seed = seed * 1103515245 + 12345;
+        int num_args = 1 + (seed >> 16) % 12;
+        for(int j = 0; j < num_args; j++){
+            seed = seed * 1103515245 + 12345;
+            ptr += sprintf(ptr, "%s%s", j == 0 ? "" : " ", words[(seed >> 16) % num_words]);
+        }
+        if(i % 7 == 0){
+            ptr += sprintf(ptr, " > out%d.txt", i % 100);
+        }
+        if(i % 13 == 0){
+            ptr += sprintf(ptr, " &");
+        }
+        *ptr++ = '\n';
+    }
+    *ptr = '\0';
+    *num_lines = SYNTHETIC_LINES;
+    return corpus;
+}
+
+/**
+ * This function should read a corpus file into one buffer and return it,
+ * setting num_lines
+ * 
+ * Params:
+ *   path - corpus file, one command per line
+ *   num_lines - pointer to int to hold the number of lines (by reference)
+ */
+char* file_corpus(char* path, int* num_lines){
+    FILE* file = fopen(path, "r");
+    if(file == NULL){
+        file_directory_error(path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* corpus = malloc(size + 1);
+    size = fread(corpus, 1, size, file);
+    corpus[size] = '\0';
+    fclose(file);
+
+    *num_lines = 0;
+    for(long i = 0; i < size; i++){
+        if(corpus[i] == '\n'){
+            (*num_lines)++;
+        }
+    }
+    return corpus;
+}
+
+int main(int argc, char* argv[]){
+    int num_lines = 0;
+    char* corpus = argc > 1 ? file_corpus(argv[1], &num_lines) : synthetic_corpus(&num_lines);
+    int passes = argc > 2 ? atoi(argv[2]) : 20;
+    struct command* input = malloc(sizeof(struct command));
+    init_command(input);
+    struct timespec start, end;
+    long total_args = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int pass = 0; pass < passes; pass++){
+        char* line = corpus;
+        char* next;
+        while((next = strchr(line, '\n')) != NULL){
+            size_t length = next - line + 1;
+            if(length + 1 > input->line_size){ //Stands in for getline()
+                input->line_size = length + 1;
+                input->command_line = realloc(input->command_line, input->line_size);
+            }
+            memcpy(input->command_line, line, length);
+            input->command_line[length] = '\0';
+            populate_command(input, input->command_line, 0, 0);
+            total_args += input->num_args;
+            reset_command(input);
+            line = next + 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("lines=%ld args=%ld seconds=%.3f lines/sec=%.0f\n", (long)num_lines * passes, total_args,
+        seconds, num_lines * passes / seconds);
+
+    free_command(input);
+    free(input);
+    free(corpus);
+    return 0;
+}
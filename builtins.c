@@ -0,0 +1,787 @@
+#include "smallsh.h"
+
+//Fast path built-ins: first and last char of the name (with its length, the BUILTIN_HASH key), name, function, accepts check
+#define FAST_BUILTINS(X) \
+    X('e', 'o', "echo", echo_builtin, NULL) \
+    X('t', 'e', "true", true_builtin, NULL) \
+    X('f', 'e', "false", false_builtin, NULL) \
+    X('t', 't', "test", test_builtin, NULL) \
+    X('p', 'f', "printf", printf_builtin, NULL) \
+    X('p', 'd', "pwd", pwd_builtin, NULL) \
+    X('c', 't', "cat", cat_builtin, cat_accepts) \
+    X('c', 'p', "cp", cp_builtin, cp_accepts)
+#define BUILTIN_SLOT(first, last, name) BUILTIN_HASH(first, last, sizeof(name) - 1)
+#define BUILTIN_ENTRY(first, last, name, run, accepts) [BUILTIN_SLOT(first, last, name)] = {name, run, accepts},
+#define BUILTIN_BIT_SUM(first, last, name, run, accepts) + (1u << BUILTIN_SLOT(first, last, name))
+#define BUILTIN_BIT_OR(first, last, name, run, accepts) | (1u << BUILTIN_SLOT(first, last, name))
+#define BUILTIN_KEY_CHECK(first, last, name, run, accepts) && (name)[0] == (first) && (name)[sizeof(name) - 2] == (last)
+
+//Two names in one slot would be a duplicate designated initializer, which -Wall doesn't catch.
+//The slot bits only add up to the same as they OR together if every slot is different
+_Static_assert((0 FAST_BUILTINS(BUILTIN_BIT_SUM)) == (0 FAST_BUILTINS(BUILTIN_BIT_OR)), "BUILTIN_HASH is no longer perfect, change it or BUILTIN_TABLE_SIZE");
+
+//Fast path built-ins, indexed by BUILTIN_HASH so a lookup is one probe and one strcmp()
+struct builtin builtin_table[BUILTIN_TABLE_SIZE] = {
+    FAST_BUILTINS(BUILTIN_ENTRY)
+};
+
+/**
+ * This function should check that every fast path built-in's hand-written
+ * first and last char match its name. The length comes from the name and
+ * the slots are checked at compile time, but a string's chars can't be, and
+ * a wrong key would quietly put a built-in where find_builtin() never
+ * looks. Returns 0 if the table is right, -1 after printing the problem.
+ */
+int check_builtin_table(void){
+    if(1 FAST_BUILTINS(BUILTIN_KEY_CHECK)){ //Folded to a constant by the compiler
+        return 0;
+    }
+    for(int i = 0; i < BUILTIN_TABLE_SIZE; i++){
+        if(builtin_table[i].name != NULL && find_builtin(builtin_table[i].name) != &builtin_table[i]){
+            fprintf(stderr, "smallsh: fast path built-in %s has the wrong key in FAST_BUILTINS\n", builtin_table[i].name);
+        }
+    }
+    return -1;
+}
+
+/**
+ * This function should find a fast path built-in by name. The table is a
+ * perfect hash on the first char, last char and length, so there is no
+ * probing. Returns NULL if the name isn't a fast path built-in.
+ * 
+ * Params:
+ *   name - command name (args[0])
+ */
+struct builtin* find_builtin(char* name){
+    size_t length = strnlen(name, BUILTIN_MAX_NAME + 1);
+
+    if(length == 0 || length > BUILTIN_MAX_NAME){
+        return NULL;
+    }
+    struct builtin* builtin = &builtin_table[BUILTIN_HASH(name[0], name[length - 1], length)];
+    if(builtin->name == NULL || strcmp(builtin->name, name) != 0){
+        return NULL;
+    }
+    return builtin;
+}
+
+/**
+ * This function should check if a command can run as a fast path built-in.
+ * Pipelines always run externally, since every stage needs its own process,
+ * and so do args the built-in's accepts() turns down.
+ * 
+ * Params:
+ *   input - command struct that holds args
+ */
+struct builtin* fast_builtin(struct command* input){
+    struct builtin* builtin = find_builtin(input->args[0]);
+
+    if(builtin == NULL){
+        return NULL;
+    }
+    for(int i = 1; i < input->num_args; i++){
+        if(strcmp(input->args[i], "|") == 0){
+            return NULL;
+        }
+    }
+    if(builtin->accepts != NULL && !builtin->accepts(input->args)){
+        return NULL;
+    }
+    return builtin;
+}
+
+/**
+ * This function should run a fast path built-in in the shell's process. '<'
+ * and '>' are honored by swapping the shell's stdin/stdout for the files and
+ * putting them back afterward. Returns the built-in's exit value, or 1 if a
+ * redirection couldn't be opened, the same as an external command.
+ * 
+ * Params:
+ *   builtin - built-in to run
+ *   args - NULL-terminated command args
+ */
+int run_builtin(struct builtin* builtin, char** args){
+    struct redirection redir;
+    int input_fd = -1;
+    int output_fd = -1;
+    int saved_input = -1;
+    int saved_output = -1;
+    int argc = 0;
+
+    METRIC_ADD(metrics.builtins, 1);
+    find_redirection(args, &redir);
+    if(open_redirection(&redir, &input_fd, &output_fd) == -1){
+        fflush(stdout);
+        return 1;
+    }
+    if(redir.redirected){ //Remove redirection symbols
+        remove_redirection(args);
+    }
+
+    fflush(stdout); //Anything already buffered belongs to the old stdout
+    if(input_fd != -1){
+        saved_input = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(input_fd, STDIN_FILENO);
+        close(input_fd);
+    }
+    if(output_fd != -1){
+        saved_output = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(output_fd, STDOUT_FILENO);
+        close(output_fd);
+    }
+
+    while(args[argc] != NULL){
+        argc++;
+    }
+    int status = builtin->run(argc, args);
+
+    fflush(stdout);
+    clearerr(stdout); //A failed write (full disk, closed pipe) shouldn't stick to the shell's stdout
+    if(saved_output != -1){
+        dup2(saved_output, STDOUT_FILENO);
+        close(saved_output);
+    }
+    if(saved_input != -1){
+        dup2(saved_input, STDIN_FILENO);
+        close(saved_input);
+    }
+    return status;
+}
+
+/**
+ * This function should print the char a backslash escape stands for and
+ * return a pointer past the escape. Handles the escapes of echo -e and
+ * printf, including octal (\0nnn for echo, \nnn for printf) and \xHH.
+ * 
+ * Params:
+ *   ptr - pointer to the char after the backslash
+ *   echo_style - 1 if octal escapes start with \0 like echo's
+ *   stop - pointer to int set to 1 on \c, which ends all output (by reference)
+ */
+char* print_escape(char* ptr, int echo_style, int* stop){
+    int value = 0;
+    int digits = 0;
+
+    switch(*ptr){
+        case 'a': putchar('\a'); return ptr + 1;
+        case 'b': putchar('\b'); return ptr + 1;
+        case 'e': putchar(27); return ptr + 1;
+        case 'f': putchar('\f'); return ptr + 1;
+        case 'n': putchar('\n'); return ptr + 1;
+        case 'r': putchar('\r'); return ptr + 1;
+        case 't': putchar('\t'); return ptr + 1;
+        case 'v': putchar('\v'); return ptr + 1;
+        case '\\': putchar('\\'); return ptr + 1;
+        case 'c': *stop = 1; return ptr + 1;
+        case '\0': putchar('\\'); return ptr; //Trailing backslash
+    }
+
+    if(*ptr == 'x' && isxdigit((unsigned char)ptr[1])){
+        ptr++;
+        while(digits < 2 && isxdigit((unsigned char)*ptr)){
+            value = value * 16 + (isdigit((unsigned char)*ptr) ? *ptr - '0' : tolower((unsigned char)*ptr) - 'a' + 10);
+            ptr++;
+            digits++;
+        }
+        putchar(value);
+        return ptr;
+    }
+    if(*ptr >= '0' && *ptr <= '7' && (!echo_style || *ptr == '0')){ //echo -e only takes \0nnn, like bash
+        if(echo_style){
+            ptr++;
+        }
+        while(digits < 3 && *ptr >= '0' && *ptr <= '7'){
+            value = value * 8 + (*ptr - '0');
+            ptr++;
+            digits++;
+        }
+        putchar(value & 0xff);
+        return ptr;
+    }
+
+    putchar('\\'); //Unknown escape, printed as is
+    putchar(*ptr);
+    return ptr + 1;
+}
+
+/**
+ * This function should handle the echo built-in like bash does. Leading
+ * -n, -e and -E options (or combinations like -ne) turn off the newline and
+ * turn backslash escapes on or off.
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated command args
+ */
+int echo_builtin(int argc, char** args){
+    int newline = 1;
+    int escapes = 0;
+    int stop = 0;
+    int i = 1;
+
+    //Options, only if every char is a valid option letter
+    for(; i < argc && args[i][0] == '-' && args[i][1] != '\0'; i++){
+        char* option = &args[i][1];
+        if(strspn(option, "neE") != strlen(option)){
+            break;
+        }
+        for(; *option != '\0'; option++){
+            if(*option == 'n'){
+                newline = 0;
+            }
+            else{
+                escapes = *option == 'e';
+            }
+        }
+    }
+
+    for(int first = i; i < argc && !stop; i++){
+        if(i > first){
+            putchar(' ');
+        }
+        if(!escapes){
+            fputs(args[i], stdout);
+            continue;
+        }
+        char* ptr = args[i];
+        while(*ptr != '\0' && !stop){
+            if(*ptr == '\\'){
+                ptr = print_escape(ptr + 1, 1, &stop);
+            }
+            else{
+                putchar(*ptr++);
+            }
+        }
+    }
+    if(newline && !stop){
+        putchar('\n');
+    }
+    return 0;
+}
+
+/**
+ * This function should handle the true built-in
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated command args
+ */
+int true_builtin(int argc, char** args){
+    return 0;
+}
+
+/**
+ * This function should handle the false built-in
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated command args
+ */
+int false_builtin(int argc, char** args){
+    return 1;
+}
+
+/**
+ * This function should handle the pwd built-in, printing the working
+ * directory
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated command args
+ */
+int pwd_builtin(int argc, char** args){
+    char cwd[PATH_MAX];
+
+    if(getcwd(cwd, sizeof(cwd)) == NULL){
+        printf("bash: pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    puts(cwd);
+    return 0;
+}
+
+/**
+ * This function should parse an integer operand for test. Prints bash's
+ * error and returns -1 if it isn't an integer.
+ * 
+ * Params:
+ *   arg - operand to parse
+ *   value - pointer to hold the value (by reference)
+ */
+int test_integer(char* arg, long long* value){
+    char* end;
+
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    while(isspace((unsigned char)*end)){
+        end++;
+    }
+    if(end == arg || *end != '\0' || errno == ERANGE){
+        printf("bash: test: %s: integer expression expected\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function should check if a test operator is a unary file or string
+ * operator
+ * 
+ * Params:
+ *   op - operator to check
+ */
+int test_is_unary(char* op){
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("bcdefghLnprsStuwxz", op[1]) != NULL;
+}
+
+/**
+ * This function should check if a test operator is a binary operator
+ * 
+ * Params:
+ *   op - operator to check
+ */
+int test_is_binary(char* op){
+    static char* binary_ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+
+    for(int i = 0; binary_ops[i] != NULL; i++){
+        if(strcmp(op, binary_ops[i]) == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function should evaluate a unary test. Returns 0 if true, 1 if false.
+ * 
+ * Params:
+ *   op - unary operator, like "-f"
+ *   arg - its operand
+ */
+int test_unary(char* op, char* arg){
+    struct stat info;
+
+    switch(op[1]){
+        case 'n': return arg[0] != '\0' ? 0 : 1;
+        case 'z': return arg[0] == '\0' ? 0 : 1;
+        case 'r': return access(arg, R_OK) == 0 ? 0 : 1;
+        case 'w': return access(arg, W_OK) == 0 ? 0 : 1;
+        case 'x': return access(arg, X_OK) == 0 ? 0 : 1;
+        case 't':{
+            long long fd;
+            char* end;
+            fd = strtoll(arg, &end, 10);
+            return end != arg && *end == '\0' && fd >= 0 && fd <= INT_MAX && isatty(fd) ? 0 : 1;
+        }
+        case 'h':
+        case 'L': return lstat(arg, &info) == 0 && S_ISLNK(info.st_mode) ? 0 : 1;
+    }
+
+    if(stat(arg, &info) == -1){
+        return 1;
+    }
+    switch(op[1]){
+        case 'e': return 0;
+        case 'f': return S_ISREG(info.st_mode) ? 0 : 1;
+        case 'd': return S_ISDIR(info.st_mode) ? 0 : 1;
+        case 'b': return S_ISBLK(info.st_mode) ? 0 : 1;
+        case 'c': return S_ISCHR(info.st_mode) ? 0 : 1;
+        case 'p': return S_ISFIFO(info.st_mode) ? 0 : 1;
+        case 'S': return S_ISSOCK(info.st_mode) ? 0 : 1;
+        case 's': return info.st_size > 0 ? 0 : 1;
+        case 'u': return info.st_mode & S_ISUID ? 0 : 1;
+        case 'g': return info.st_mode & S_ISGID ? 0 : 1;
+    }
+    return 1;
+}
+
+/**
+ * This function should evaluate a binary test. Returns 0 if true, 1 if
+ * false, 2 if an integer operand is invalid.
+ * 
+ * Params:
+ *   left - left operand
+ *   op - binary operator, like "-eq"
+ *   right - right operand
+ */
+int test_binary(char* left, char* op, char* right){
+    long long a, b;
+    struct stat left_info, right_info;
+
+    if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0){
+        return strcmp(left, right) == 0 ? 0 : 1;
+    }
+    if(strcmp(op, "!=") == 0){
+        return strcmp(left, right) != 0 ? 0 : 1;
+    }
+    if(strcmp(op, "<") == 0){
+        return strcmp(left, right) < 0 ? 0 : 1;
+    }
+    if(strcmp(op, ">") == 0){
+        return strcmp(left, right) > 0 ? 0 : 1;
+    }
+    if(strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0){
+        int left_ok = stat(left, &left_info) == 0;
+        int right_ok = stat(right, &right_info) == 0;
+        if(op[1] == 'e'){
+            return left_ok && right_ok && left_info.st_dev == right_info.st_dev && left_info.st_ino == right_info.st_ino ? 0 : 1;
+        }
+        if(op[1] == 'o'){ //-ot is -nt with the operands swapped
+            struct stat swap = left_info;
+            int swap_ok = left_ok;
+            left_info = right_info;
+            left_ok = right_ok;
+            right_info = swap;
+            right_ok = swap_ok;
+        }
+        if(!left_ok){
+            return 1;
+        }
+        if(!right_ok){
+            return 0;
+        }
+        if(left_info.st_mtim.tv_sec != right_info.st_mtim.tv_sec){
+            return left_info.st_mtim.tv_sec > right_info.st_mtim.tv_sec ? 0 : 1;
+        }
+        return left_info.st_mtim.tv_nsec > right_info.st_mtim.tv_nsec ? 0 : 1;
+    }
+
+    //Integer comparisons
+    if(test_integer(left, &a) == -1 || test_integer(right, &b) == -1){
+        return 2;
+    }
+    switch(op[1] << 8 | op[2]){
+        case 'e' << 8 | 'q': return a == b ? 0 : 1;
+        case 'n' << 8 | 'e': return a != b ? 0 : 1;
+        case 'l' << 8 | 't': return a < b ? 0 : 1;
+        case 'l' << 8 | 'e': return a <= b ? 0 : 1;
+        case 'g' << 8 | 't': return a > b ? 0 : 1;
+        case 'g' << 8 | 'e': return a >= b ? 0 : 1;
+    }
+    return 2;
+}
+
+/**
+ * This function should negate a test result, leaving errors (2) alone
+ * 
+ * Params:
+ *   result - 0 if true, 1 if false, 2 on error
+ */
+int test_negate(int result){
+    return result == 2 ? 2 : !result;
+}
+
+/**
+ * This function should evaluate a test expression. Up to four operands are
+ * decided by their count, the way POSIX specifies. Longer expressions are
+ * parsed with '!', '(', ')', -a and -o by test_or(). Returns 0 if true, 1 if
+ * false, 2 on a syntax error.
+ * 
+ * Params:
+ *   argc - number of operands
+ *   args - operands
+ */
+int test_expression(int argc, char** args){
+    switch(argc){
+        case 0:
+            return 1;
+        case 1:
+            return args[0][0] != '\0' ? 0 : 1;
+        case 2:
+            if(strcmp(args[0], "!") == 0){
+                return test_negate(test_expression(1, args + 1));
+            }
+            if(test_is_unary(args[0])){
+                return test_unary(args[0], args[1]);
+            }
+            printf("bash: test: %s: unary operator expected\n", args[0]);
+            return 2;
+        case 3:
+            if(test_is_binary(args[1])){
+                return test_binary(args[0], args[1], args[2]);
+            }
+            if(strcmp(args[1], "-a") == 0 || strcmp(args[1], "-o") == 0){
+                break; //Two one-operand tests joined by -a/-o
+            }
+            if(strcmp(args[0], "!") == 0){
+                return test_negate(test_expression(2, args + 1));
+            }
+            if(strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0){
+                return test_expression(1, args + 1);
+            }
+            printf("bash: test: %s: binary operator expected\n", args[1]);
+            return 2;
+        case 4:
+            if(strcmp(args[0], "!") == 0){
+                return test_negate(test_expression(3, args + 1));
+            }
+            if(strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0){
+                return test_expression(2, args + 1);
+            }
+            break;
+    }
+
+    int next = 0;
+    int result = test_or(argc, args, &next);
+    if(result != 2 && next < argc){
+        printf("bash: test: too many arguments\n");
+        return 2;
+    }
+    return result;
+}
+
+/**
+ * This function should parse and evaluate "expr -o expr ..." starting at
+ * args[*next]. -a binds tighter than -o.
+ * 
+ * Params:
+ *   argc - number of operands
+ *   args - operands
+ *   next - pointer to the index of the next operand (by reference)
+ */
+int test_or(int argc, char** args, int* next){
+    int result = test_and(argc, args, next);
+
+    while(result != 2 && *next < argc && strcmp(args[*next], "-o") == 0){
+        (*next)++;
+        int right = test_and(argc, args, next);
+        result = right == 2 ? 2 : (result == 0 || right == 0 ? 0 : 1);
+    }
+    return result;
+}
+
+/**
+ * This function should parse and evaluate "term -a term ..." starting at
+ * args[*next]
+ * 
+ * Params:
+ *   argc - number of operands
+ *   args - operands
+ *   next - pointer to the index of the next operand (by reference)
+ */
+int test_and(int argc, char** args, int* next){
+    int result = test_term(argc, args, next);
+
+    while(result != 2 && *next < argc && strcmp(args[*next], "-a") == 0){
+        (*next)++;
+        int right = test_term(argc, args, next);
+        result = right == 2 ? 2 : (result == 0 && right == 0 ? 0 : 1);
+    }
+    return result;
+}
+
+/**
+ * This function should parse and evaluate one term: "! term", "( expr )",
+ * a unary test, a binary test or a lone string
+ * 
+ * Params:
+ *   argc - number of operands
+ *   args - operands
+ *   next - pointer to the index of the next operand (by reference)
+ */
+int test_term(int argc, char** args, int* next){
+    int i = *next;
+
+    if(i >= argc){
+        printf("bash: test: argument expected\n");
+        return 2;
+    }
+    if(strcmp(args[i], "!") == 0){
+        (*next)++;
+        return test_negate(test_term(argc, args, next));
+    }
+    if(strcmp(args[i], "(") == 0){
+        (*next)++;
+        int result = test_or(argc, args, next);
+        if(result != 2 && (*next >= argc || strcmp(args[*next], ")") != 0)){
+            printf("bash: test: `)' expected\n");
+            return 2;
+        }
+        (*next)++;
+        return result;
+    }
+    if(i + 2 < argc && test_is_binary(args[i + 1])){
+        *next = i + 3;
+        return test_binary(args[i], args[i + 1], args[i + 2]);
+    }
+    if(i + 1 < argc && test_is_unary(args[i])){
+        *next = i + 2;
+        return test_unary(args[i], args[i + 1]);
+    }
+    *next = i + 1;
+    return args[i][0] != '\0' ? 0 : 1;
+}
+
+/**
+ * This function should handle the test built-in. Returns 0 if the
+ * expression is true, 1 if false, 2 on an error.
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated command args
+ */
+int test_builtin(int argc, char** args){
+    return test_expression(argc - 1, args + 1);
+}
+
+/**
+ * This function should parse a numeric printf argument like bash does:
+ * decimal, 0x hex, 0 octal, or 'c for a char's value. Prints bash's error
+ * and sets *failed if it isn't a number, but still returns the value parsed
+ * so far.
+ * 
+ * Params:
+ *   arg - argument to parse, NULL if the args ran out
+ *   failed - pointer to int set to 1 on an invalid number (by reference)
+ */
+long long printf_integer(char* arg, int* failed){
+    char* end;
+
+    if(arg == NULL){
+        return 0;
+    }
+    if(arg[0] == '\'' || arg[0] == '"'){
+        return (unsigned char)arg[1];
+    }
+    errno = 0;
+    long long value = strtoll(arg, &end, 0);
+    if(end == arg || *end != '\0' || errno == ERANGE){
+        printf("bash: printf: %s: invalid number\n", arg);
+        *failed = 1;
+    }
+    return value;
+}
+
+/**
+ * This function should handle the printf built-in like bash does. The format
+ * supports backslash escapes and %s, %b, %c, %d, %i, %u, %o, %x, %X, %e, %f,
+ * %g and %% with flags, width and precision (including '*'). The format is
+ * reused while there are args left. Returns 1 if an arg wasn't a valid
+ * number, 2 on a bad format.
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated command args
+ */
+int printf_builtin(int argc, char** args){
+    int next = 2;
+    int failed = 0;
+    int stop = 0;
+
+    if(argc < 2){
+        printf("bash: printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    do{
+        int first = next;
+        char* ptr = args[1];
+        while(*ptr != '\0' && !stop){
+            if(*ptr == '\\'){
+                ptr = print_escape(ptr + 1, 0, &stop);
+                continue;
+            }
+            if(*ptr != '%'){
+                putchar(*ptr++);
+                continue;
+            }
+            if(ptr[1] == '%'){
+                putchar('%');
+                ptr += 2;
+                continue;
+            }
+
+            //Copy "%[flags][width][.precision]" into spec, filling in any '*'
+            char spec[64];
+            size_t length = 0;
+            spec[length++] = *ptr++;
+            while(*ptr != '\0' && strchr("-+ #0", *ptr) != NULL && length < 8){
+                spec[length++] = *ptr++;
+            }
+            for(int part = 0; part < 2; part++){
+                if(part == 1){
+                    if(*ptr != '.'){
+                        break;
+                    }
+                    spec[length++] = *ptr++;
+                }
+                if(*ptr == '*'){
+                    long long value = printf_integer(next < argc ? args[next++] : NULL, &failed);
+                    length += snprintf(spec + length, 16, "%d", (int)value);
+                    ptr++;
+                }
+                else{
+                    for(int digits = 0; isdigit((unsigned char)*ptr) && digits < 9; digits++){
+                        spec[length++] = *ptr++;
+                    }
+                }
+            }
+            char conversion = *ptr;
+            if(conversion == '\0' || strchr("sbcdiuoxXeEfFgGaA", conversion) == NULL){
+                printf("bash: printf: `%c': invalid format character\n", conversion == '\0' ? '%' : conversion);
+                return 2;
+            }
+            ptr++;
+            char* arg = next < argc ? args[next++] : NULL;
+
+            switch(conversion){
+                case 's':
+                case 'c':
+                    spec[length++] = conversion;
+                    spec[length] = '\0';
+                    if(conversion == 's'){
+                        printf(spec, arg != NULL ? arg : "");
+                    }
+                    else if(arg != NULL && arg[0] != '\0'){
+                        printf(spec, arg[0]);
+                    }
+                    break;
+                case 'b':
+                    for(char* src = arg != NULL ? arg : ""; *src != '\0' && !stop;){
+                        if(*src == '\\'){
+                            src = print_escape(src + 1, 1, &stop);
+                        }
+                        else{
+                            putchar(*src++);
+                        }
+                    }
+                    break;
+                case 'd':
+                case 'i':
+                    strcpy(spec + length, "lld");
+                    printf(spec, printf_integer(arg, &failed));
+                    break;
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                    spec[length++] = 'l';
+                    spec[length++] = 'l';
+                    spec[length++] = conversion;
+                    spec[length] = '\0';
+                    printf(spec, (unsigned long long)printf_integer(arg, &failed));
+                    break;
+                default:{
+                    double value = 0;
+                    if(arg != NULL){
+                        char* end;
+                        value = strtod(arg, &end);
+                        if(end == arg || *end != '\0'){
+                            printf("bash: printf: %s: invalid number\n", arg);
+                            failed = 1;
+                        }
+                    }
+                    spec[length++] = conversion;
+                    spec[length] = '\0';
+                    printf(spec, value);
+                    break;
+                }
+            }
+        }
+        if(next == first){ //Format used no args, don't loop forever
+            break;
+        }
+    } while(next < argc && !stop);
+
+    return failed;
+}
@@ -0,0 +1,426 @@
+#include "smallsh.h"
+
+volatile sig_atomic_t copy_interrupted = 0; //Set by SIGINT while an in-process cat or cp runs
+
+/**
+ * This function should check if a cat can run in the shell. Only the plain
+ * form is taken: no options, and input from named files or a '<'
+ * redirection, never the terminal. Inputs that exist must be regular files
+ * or directories, so a fifo or a device that never ends still gets a real
+ * cat that SIGINT can stop. The daemon always runs the real cat: in process
+ * the whole output would land in its scratch memfd, and the copy would hold
+ * up every other client.
+ * 
+ * Params:
+ *   args - NULL-terminated command args, redirection still in them
+ */
+int cat_accepts(char** args){
+    struct stat info;
+    int num_inputs = 0;
+
+    if(server != NULL){
+        return 0;
+    }
+
+    for(int i = 1; args[i] != NULL; i++){
+        if(strcmp(args[i], ">") == 0 || strcmp(args[i], "<") == 0){
+            if(args[i + 1] == NULL){
+                return 0;
+            }
+            if(args[i][0] == '<' && (stat(args[i + 1], &info) == -1 || !S_ISREG(info.st_mode))){
+                return 0;
+            }
+            num_inputs += args[i][0] == '<';
+            i++;
+            continue;
+        }
+        if(args[i][0] == '-' || (stat(args[i], &info) == 0 && !S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode))){
+            return 0;
+        }
+        num_inputs++;
+    }
+    return num_inputs > 0;
+}
+
+/**
+ * This function should check if a cp can run in the shell: no options, at
+ * least a source and a target, and sources that are regular files,
+ * directories (which cp refuses without -r) or missing. Like cat, never in
+ * the daemon, where a big copy would hold up every other client.
+ * 
+ * Params:
+ *   args - NULL-terminated command args, redirection still in them
+ */
+int cp_accepts(char** args){
+    struct stat info;
+    int num_operands = 0;
+
+    if(server != NULL){
+        return 0;
+    }
+
+    for(int i = 1; args[i] != NULL; i++){
+        if(args[i][0] == '-' || strcmp(args[i], ">") == 0 || strcmp(args[i], "<") == 0){
+            return 0;
+        }
+        num_operands++;
+    }
+    for(int i = 1; i < num_operands; i++){ //Every operand but the target
+        if(stat(args[i], &info) == 0 && !S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode)){
+            return 0;
+        }
+    }
+    return num_operands >= 2;
+}
+
+/**
+ * This function should be called when a SIGINT is caught while cat or cp
+ * runs in the shell. The shell ignores SIGINT, so without this ^C couldn't
+ * stop a long copy; copy_fd() checks the flag between chunks instead.
+ * 
+ * Params:
+ *   signo - signal number
+ */
+void catch_copy_SIGINT(int signo){
+    copy_interrupted = 1;
+}
+
+/**
+ * This function should let SIGINT stop an in-process cat or cp, the way it
+ * would stop the real one. There is no SA_RESTART, so a read() or write()
+ * blocked on a slow device or a full pipe returns early too.
+ * 
+ * Params:
+ *   saved_action - set to the shell's SIGINT action (by reference)
+ */
+void begin_copy(struct sigaction* saved_action){
+    struct sigaction interrupt_action = {0};
+
+    interrupt_action.sa_handler = catch_copy_SIGINT;
+    sigfillset(&interrupt_action.sa_mask);
+    copy_interrupted = 0;
+    sigaction(SIGINT, &interrupt_action, saved_action);
+}
+
+/**
+ * This function should put the shell's SIGINT action back after cat or cp.
+ * Returns the built-in's exit value, or 130 (128 + SIGINT, what $? would be
+ * for the real one) if it was interrupted.
+ * 
+ * Params:
+ *   saved_action - action begin_copy() saved
+ *   status - built-in's exit value
+ */
+int end_copy(struct sigaction* saved_action, int status){
+    sigaction(SIGINT, saved_action, NULL);
+    return copy_interrupted ? 128 + SIGINT : status;
+}
+
+/**
+ * This function should tell if a copy failed because the kernel can't copy
+ * between these two files that way, rather than a real I/O error
+ * 
+ * Params:
+ *   error - errno from copy_file_range(), sendfile() or splice()
+ */
+int copy_unsupported(int error){
+    return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP || error == EBADF;
+}
+
+/**
+ * This function should write all of a buffer, across short writes. Returns
+ * -1 with errno set if a write fails.
+ * 
+ * Params:
+ *   fd - fd to write to
+ *   buffer - bytes to write
+ *   length - number of bytes
+ */
+int write_all(int fd, char* buffer, size_t length){
+    for(char* ptr = buffer; ptr < buffer + length;){
+        ssize_t num_written = write(fd, ptr, buffer + length - ptr);
+        if(num_written == -1 && (errno != EINTR || copy_interrupted)){
+            return -1;
+        }
+        ptr += num_written > 0 ? num_written : 0;
+    }
+    return 0;
+}
+
+/**
+ * This function should copy everything from in_fd to out_fd without the
+ * bytes passing through user space where the kernel allows it. It tries
+ * copy_file_range() first, which reflinks or does a server-side copy on
+ * filesystems that support it, then sendfile(), then splice() through a
+ * pipe, and finally read() and write(). Files the kernel reports as empty
+ * (procfs, sysfs) and outputs opened with O_APPEND, which none of the three
+ * accept, go straight to read(). Stops between chunks once SIGINT sets
+ * copy_interrupted. Returns -1 with errno set on an I/O error, or EINTR if
+ * it was interrupted.
+ * 
+ * Params:
+ *   in_fd - fd to read from
+ *   out_fd - fd to write to
+ *   write_failed - set to 1 if the error was on the writing side (by reference)
+ */
+int copy_fd(int in_fd, int out_fd, int* write_failed){
+    struct stat in_info, out_info;
+    ssize_t copied = -1;
+    int pipe_fds[2] = {-1, -1};
+    char buffer[65536];
+
+    *write_failed = 0;
+    if(fstat(in_fd, &in_info) == -1 || fstat(out_fd, &out_info) == -1){
+        return -1;
+    }
+    int method = S_ISREG(in_info.st_mode) && in_info.st_size > 0 && !(fcntl(out_fd, F_GETFL) & O_APPEND) ? COPY_RANGE : COPY_READ_WRITE;
+    if(method == COPY_RANGE && !S_ISREG(out_info.st_mode)){
+        method = COPY_SENDFILE;
+    }
+    if(method == COPY_READ_WRITE && (S_ISFIFO(in_info.st_mode) || S_ISFIFO(out_info.st_mode))){
+        method = COPY_SPLICE;
+    }
+
+    while(method != COPY_DONE){
+        if(copy_interrupted){
+            errno = EINTR;
+            break;
+        }
+        switch(method){
+            case COPY_RANGE: copied = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0); break;
+            case COPY_SENDFILE: copied = sendfile(out_fd, in_fd, NULL, COPY_CHUNK); break;
+            case COPY_SPLICE:
+                if(S_ISFIFO(in_info.st_mode) || S_ISFIFO(out_info.st_mode)){ //One side is a pipe already
+                    copied = splice(in_fd, NULL, out_fd, NULL, RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+                    break;
+                }
+                if(pipe_fds[0] == -1 && pipe2(pipe_fds, O_CLOEXEC) == -1){
+                    method = COPY_READ_WRITE;
+                    continue;
+                }
+                copied = splice(in_fd, NULL, pipe_fds[1], NULL, RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+                for(ssize_t left = copied; left > 0;){ //Drain the pipe into out_fd
+                    ssize_t moved = splice(pipe_fds[0], NULL, out_fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+                    if(moved == -1 && errno == EINTR && !copy_interrupted){
+                        continue;
+                    }
+                    if(moved == -1 && copy_unsupported(errno)){ //out_fd won't take splice(), write what the pipe holds
+                        method = COPY_READ_WRITE; //Rest of the input goes the same way
+                        moved = read(pipe_fds[0], buffer, left < (ssize_t)sizeof(buffer) ? left : (ssize_t)sizeof(buffer));
+                        if(moved > 0 && write_all(out_fd, buffer, moved) == -1){
+                            moved = -1;
+                        }
+                    }
+                    if(moved <= 0){
+                        close(pipe_fds[0]);
+                        close(pipe_fds[1]);
+                        *write_failed = 1;
+                        return -1; //Bytes are stuck in the pipe, no falling back from here
+                    }
+                    left -= moved;
+                }
+                break;
+            default:
+                copied = read(in_fd, buffer, sizeof(buffer));
+                if(copied > 0 && write_all(out_fd, buffer, copied) == -1){
+                    *write_failed = 1;
+                    return -1;
+                }
+        }
+
+        if(copied == 0){
+            method = COPY_DONE;
+        }
+        else if(copied == -1 && errno != EINTR){
+            if(method == COPY_READ_WRITE || !copy_unsupported(errno)){
+                *write_failed = errno == ENOSPC || errno == EDQUOT || errno == EFBIG || errno == EPIPE || errno == EROFS;
+                break;
+            }
+            method++; //Next way down, offsets are where the last one stopped
+        }
+    }
+
+    if(pipe_fds[0] != -1){
+        int error = errno;
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        errno = error;
+    }
+    return method == COPY_DONE ? 0 : -1;
+}
+
+/**
+ * This function should copy one input of cat to stdout, with the errors
+ * GNU cat gives. Returns 1 on an error, 0 otherwise.
+ * 
+ * Params:
+ *   fd - input
+ *   name - input's name for errors
+ *   out_info - stat of stdout, st_ino is 0 if it isn't a regular file
+ */
+int cat_fd(int fd, char* name, struct stat* out_info){
+    struct stat info;
+    int write_failed;
+
+    if(fstat(fd, &info) == -1){
+        fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    if(S_ISDIR(info.st_mode)){
+        fprintf(stderr, "cat: %s: Is a directory\n", name);
+        return 1;
+    }
+    if(info.st_dev == out_info->st_dev && info.st_ino == out_info->st_ino && lseek(fd, 0, SEEK_CUR) < info.st_size){
+        fprintf(stderr, "cat: %s: input file is output file\n", name);
+        return 1;
+    }
+    if(copy_fd(fd, STDOUT_FILENO, &write_failed) == -1){
+        if(copy_interrupted){ //The real cat would die quietly
+            return 1;
+        }
+        if(write_failed){
+            fprintf(stderr, "cat: write error: %s\n", strerror(errno));
+        }
+        else{
+            fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * This function should handle cat in the shell's process when
+ * cat_accepts() takes it: every file, or the '<' input, is copied to
+ * stdout with copy_fd(). Errors and the exit value match GNU cat, and
+ * SIGINT stops it with 130.
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated args, redirection already removed
+ */
+int cat_builtin(int argc, char** args){
+    struct stat out_info;
+    struct sigaction saved_action;
+    int status = 0;
+
+    if(fstat(STDOUT_FILENO, &out_info) == -1 || !S_ISREG(out_info.st_mode)){
+        out_info.st_ino = 0; //Only a regular file can be an input too
+    }
+    begin_copy(&saved_action);
+    if(argc == 1){ //Input is the '<' file
+        return end_copy(&saved_action, cat_fd(STDIN_FILENO, "-", &out_info));
+    }
+    for(int i = 1; i < argc && !copy_interrupted; i++){
+        int fd = open(args[i], O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            fprintf(stderr, "cat: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        status |= cat_fd(fd, args[i], &out_info);
+        close(fd);
+    }
+    return end_copy(&saved_action, status);
+}
+
+/**
+ * This function should copy one file for cp, with the errors GNU cp gives.
+ * A new target gets the source's permissions. Returns 1 on an error, 0
+ * otherwise.
+ * 
+ * Params:
+ *   source - file to copy
+ *   target - file to create or overwrite
+ */
+int cp_file(char* source, char* target){
+    struct stat source_info, target_info;
+    int write_failed;
+
+    if(stat(source, &source_info) == -1){
+        fprintf(stderr, "cp: cannot stat '%s': %s\n", source, strerror(errno));
+        return 1;
+    }
+    if(S_ISDIR(source_info.st_mode)){
+        fprintf(stderr, "cp: -r not specified; omitting directory '%s'\n", source);
+        return 1;
+    }
+    if(stat(target, &target_info) == 0){
+        if(target_info.st_dev == source_info.st_dev && target_info.st_ino == source_info.st_ino){
+            fprintf(stderr, "cp: '%s' and '%s' are the same file\n", source, target);
+            return 1;
+        }
+        if(S_ISDIR(target_info.st_mode)){
+            fprintf(stderr, "cp: cannot overwrite directory '%s' with non-directory\n", target);
+            return 1;
+        }
+    }
+
+    int in_fd = open(source, O_RDONLY | O_CLOEXEC);
+    if(in_fd == -1){
+        fprintf(stderr, "cp: cannot open '%s' for reading: %s\n", source, strerror(errno));
+        return 1;
+    }
+    int out_fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, source_info.st_mode & 07777);
+    if(out_fd == -1){
+        fprintf(stderr, "cp: cannot create regular file '%s': %s\n", target, strerror(errno));
+        close(in_fd);
+        return 1;
+    }
+
+    int status = 0;
+    if(copy_fd(in_fd, out_fd, &write_failed) == -1){
+        if(!copy_interrupted){ //The real cp would die quietly
+            fprintf(stderr, "cp: error %s '%s': %s\n", write_failed ? "writing" : "reading", write_failed ? target : source, strerror(errno));
+        }
+        status = 1;
+    }
+    close(in_fd);
+    if(close(out_fd) == -1 && status == 0){ //Delayed write errors, NFS reports them here
+        fprintf(stderr, "cp: failed to close '%s': %s\n", target, strerror(errno));
+        status = 1;
+    }
+    return status;
+}
+
+/**
+ * This function should handle cp in the shell's process when cp_accepts()
+ * takes it: "cp source target", or "cp source... directory". Errors and the
+ * exit value match GNU cp, and SIGINT stops it with 130.
+ * 
+ * Params:
+ *   argc - number of args
+ *   args - NULL-terminated args
+ */
+int cp_builtin(int argc, char** args){
+    struct stat info;
+    struct sigaction saved_action;
+    char path[PATH_MAX];
+    char* target = args[argc - 1];
+    int status = 0;
+
+    int into_directory = stat(target, &info) == 0 && S_ISDIR(info.st_mode);
+    if(argc > 3 && !into_directory){
+        if(access(target, F_OK) == -1){
+            fprintf(stderr, "cp: target '%s': %s\n", target, strerror(errno));
+        }
+        else{
+            fprintf(stderr, "cp: target '%s' is not a directory\n", target);
+        }
+        return 1;
+    }
+
+    begin_copy(&saved_action);
+    for(int i = 1; i < argc - 1 && !copy_interrupted; i++){
+        char* destination = target;
+        if(into_directory){
+            char* name = strrchr(args[i], '/');
+            name = name != NULL ? name + 1 : args[i];
+            size_t length = strlen(target);
+            snprintf(path, sizeof(path), "%s%s%s", target, length > 0 && target[length - 1] == '/' ? "" : "/", name);
+            destination = path;
+        }
+        status |= cp_file(args[i], destination);
+    }
+    return end_copy(&saved_action, status);
+}
@@ -5,16 +5,49 @@
  * call to prompt(), and free memory for the struct at the end.
  * 
  * Params:
- *   no command-line args expected or handled
+ *   no args - interactive shell
+ *   script - run the commands in a script file without prompting
+ *   -c commands - run the given commands without prompting
+ *   --serve socket - run as a daemon serving many sessions on a Unix socket
+ *   --connect socket - send stdin to a daemon and print what comes back
  */
 int main(int argc, char* argv[]){   
+    if(check_builtin_table() == -1){ //A wrong FAST_BUILTINS key is a build mistake, refuse to run
+        return 70;
+    }
+    if(argc > 2 && strcmp(argv[1], "--serve") == 0){ //smallsh --serve socket
+        return serve_main(argv[2]);
+    }
+    if(argc > 2 && strcmp(argv[1], "--connect") == 0){ //smallsh --connect socket, commands on stdin
+        return serve_connect(argv[2]);
+    }
+
     struct command* input = malloc(sizeof(struct command));
-    input->num_args = 0;
-    memset(input->command_line, '\0', 2048); //Sets command_line to '\0'
-    for(int i = 0; i < 512; i++){//Sets all args to NULL
-        input->args[i] = NULL;
+    struct script script;
+    struct script* source = NULL; //NULL for an interactive shell
+    int last_status = 0;
+
+    init_command(input); //Buffers grow with the longest line seen
+
+    if(argc > 2 && strcmp(argv[1], "-c") == 0){ //smallsh -c '...'
+        string_script(&script, argv[2]);
+        source = &script;
+    }
+    else if(argc > 1){ //smallsh script.sh
+        set_script_cache(); //Parsed-script cache if SMALLSH_SCRIPT_CACHE is set
+        if(open_script(&script, argv[1]) == -1){
+            free_command(input);
+            free(input);
+            return 127;
+        }
+        source = &script;
     }
 
-    prompt(input); //Main prompt function
+    last_status = prompt(input, source); //Main prompt function
+    if(source != NULL){
+        close_script(source);
+    }
+    free_command(input);
     free(input); //Frees memory used by command struct
-}
\ No newline at end of file
+    return last_status;
+}
@@ -0,0 +1,180 @@
+#include "smallsh.h"
+
+char shell_pid[16]; //getpid() as a string, $$ never changes so it's built once
+int shell_pid_length = 0;
+
+/**
+ * This function should cache the shell's pid as a string for $$
+ */
+void init_expansion(void){
+    shell_pid_length = snprintf(shell_pid, sizeof(shell_pid), "%d", getpid());
+}
+
+/**
+ * This function should make sure the expansion buffer has room for needed
+ * more bytes, doubling it when it doesn't. Tokens are tracked by offset while
+ * expanding, so moving the buffer is safe.
+ * 
+ * Params:
+ *   input - command struct that owns the buffer
+ *   used - bytes already written
+ *   needed - bytes about to be written
+ */
+void reserve_expansion(struct command* input, size_t used, size_t needed){
+    if(used + needed <= input->expansion_size){
+        return;
+    }
+    size_t size = input->expansion_size == 0 ? 4096 : input->expansion_size;
+    while(used + needed > size){
+        size *= 2;
+    }
+    input->expansion = realloc(input->expansion, size);
+    input->expansion_size = size;
+}
+
+/**
+ * This function should find the value of the variable a '$' starts and move
+ * ptr past its name. Supports $$, $?, $!, $NAME and ${NAME}. Unset
+ * variables expand to "". Returns NULL if the '$' doesn't start a variable,
+ * so it is kept literally.
+ * 
+ * Params:
+ *   ptr - pointer to the '$' (by reference)
+ *   last_status - value for $?
+ *   last_background - value for $!, 0 if no background job has run
+ *   number - scratch buffer of at least 16 bytes for $? and $!
+ *   length - pointer to hold the value's length (by reference)
+ */
+char* lookup_variable(char** ptr, int last_status, pid_t last_background, char* number, size_t* length){
+    char* name = *ptr + 1;
+    char* value = NULL;
+    char saved;
+
+    switch(*name){
+        case '$':{
+            *ptr = name + 1;
+            *length = shell_pid_length;
+            return shell_pid;
+        }
+        case '?':{
+            *ptr = name + 1;
+            *length = snprintf(number, 16, "%d", last_status);
+            return number;
+        }
+        case '!':{
+            *ptr = name + 1;
+            *length = last_background > 0 ? snprintf(number, 16, "%d", last_background) : 0;
+            number[*length] = '\0';
+            return number;
+        }
+    }
+
+    int braced = *name == '{';
+    if(braced){
+        name++;
+    }
+    if(!(isalpha((unsigned char)*name) || *name == '_')){ //Not a variable name
+        return NULL;
+    }
+    char* end = name + 1;
+    while(isalnum((unsigned char)*end) || *end == '_'){
+        end++;
+    }
+    if(braced && *end != '}'){ //Unterminated ${, keep it literally
+        return NULL;
+    }
+
+    saved = *end; //Terminate the name in place just long enough for getenv()
+    *end = '\0';
+    value = getenv(name);
+    *end = saved;
+
+    *ptr = braced ? end + 1 : end;
+    if(value == NULL){
+        value = "";
+    }
+    *length = strlen(value);
+    return value;
+}
+
+/**
+ * This function should expand variables and $(...) and split a line into
+ * args in one pass. Tokens are written NUL-separated into the command's
+ * expansion buffer, which is reused across commands and only grows.
+ * Expanded values are split on whitespace like unquoted shell words, and
+ * words that expand to nothing are dropped.
+ * 
+ * Params:
+ *   input - command struct to hold args
+ *   line - NUL-terminated line to expand
+ *   last_status - value for $?
+ *   last_background - value for $!, 0 if no background job has run
+ */
+void expand_command(struct command* input, char* line, int last_status, pid_t last_background){
+    size_t used = 0;
+    int in_token = 0;
+    int num_tokens = 0;
+    char number[16];
+    char* ptr = line;
+
+    reserve_expansion(input, 0, strlen(line) + 1);
+    while(*ptr != '\0'){
+        char* value = ptr;
+        size_t length = 1;
+
+        if(ptr[0] == '$' && ptr[1] == '('){
+            value = substitute_command(input, &ptr, last_status, last_background, &length);
+            if(value == NULL){ //Literal '$'
+                value = ptr;
+                length = 1;
+                ptr++;
+            }
+        }
+        else if(*ptr == '$'){
+            value = lookup_variable(&ptr, last_status, last_background, number, &length);
+            if(value == NULL){ //Literal '$'
+                value = ptr;
+                length = 1;
+                ptr++;
+            }
+        }
+        else{
+            ptr++;
+        }
+
+        reserve_expansion(input, used, 2 * length + 1); //Worst case every other char ends a word
+        for(size_t i = 0; i < length; i++){
+            char c = value[i];
+            if(c == ' ' || c == '\t' || c == '\n'){ //End of a word
+                if(in_token){
+                    input->expansion[used++] = '\0';
+                    num_tokens++;
+                    in_token = 0;
+                }
+            }
+            else if(c != '\0'){ //A NUL from a $(...) can't be part of an arg, bash drops them too
+                input->expansion[used++] = c;
+                in_token = 1;
+            }
+        }
+    }
+    if(in_token){
+        input->expansion[used++] = '\0';
+        num_tokens++;
+    }
+
+    //Buffer is final now, point args at each token
+    reserve_args(input, num_tokens);
+    char* token = input->expansion;
+    for(int i = 0; i < num_tokens; i++){
+        input->args[i] = token;
+        token += strlen(token) + 1;
+    }
+    input->num_args = num_tokens;
+    if(num_tokens == 0){ //Everything expanded to nothing
+        input->expansion[0] = '\0';
+        input->args[0] = input->expansion;
+        input->num_args = 1;
+    }
+    input->args[input->num_args] = NULL;
+}
@@ -0,0 +1,452 @@
+#include "smallsh.h"
+
+struct dir_listing glob_cache[GLOB_CACHE_SIZE]; //Recently read directories
+char* glob_dents = NULL; //getdents64() buffer, allocated on first use
+size_t* glob_offsets = NULL; //Offset of every match in the command's globbed buffer
+int glob_num_offsets = 0;
+int glob_offsets_capacity = 0;
+char* glob_sort_base = NULL; //Buffer the offsets point into, for compare_glob_match()
+
+/**
+ * This function should check if text has a glob character: '*', '?' or a
+ * '[' closed by a later ']'. A lone '[', as in "[ -f file ]", is literal.
+ * 
+ * Params:
+ *   text - text to check, not NUL-terminated
+ *   length - length of the text
+ */
+int has_glob(char* text, size_t length){
+    for(size_t i = 0; i < length; i++){
+        if(text[i] == '*' || text[i] == '?'){
+            return 1;
+        }
+        if(text[i] == '[' && i + 2 < length && memchr(text + i + 2, ']', length - i - 2) != NULL){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function should compile one path component of a glob into a
+ * bit-parallel NFA: bit i of masks[c] is set if token i accepts c, and bit i
+ * of stars is set if token i is a '*'. Runs of '*' collapse into one. A '['
+ * with no closing ']' is a literal. Returns -1 if the pattern has more
+ * tokens than fit in 64 bits.
+ * 
+ * Params:
+ *   pattern - component to compile, not NUL-terminated
+ *   length - length of the component
+ *   compiled - compiled pattern to fill
+ */
+int compile_glob(char* pattern, size_t length, struct glob_pattern* compiled){
+    memset(compiled, 0, sizeof(struct glob_pattern));
+    compiled->dot_ok = length > 0 && pattern[0] == '.';
+
+    for(size_t i = 0; i < length; i++){
+        unsigned char c = pattern[i];
+        if(compiled->num_tokens >= 63){
+            return -1;
+        }
+        uint64_t bit = 1ULL << compiled->num_tokens;
+
+        if(c == '*'){
+            if(compiled->num_tokens > 0 && (compiled->stars & (bit >> 1))){ //Already a '*'
+                continue;
+            }
+            compiled->stars |= bit;
+        }
+        else if(c == '?'){
+            for(int j = 1; j < 256; j++){
+                compiled->masks[j] |= bit;
+            }
+        }
+        else if(c == '['){
+            //Find the closing ']', which can't be the first member
+            size_t start = i + 1;
+            int negate = start < length && (pattern[start] == '!' || pattern[start] == '^');
+            size_t end = start + negate + 1;
+            while(end < length && pattern[end] != ']'){
+                end++;
+            }
+            if(end >= length){ //No ']', literal '['
+                compiled->masks['['] |= bit;
+                compiled->num_tokens++;
+                continue;
+            }
+            int members[256] = {0};
+            for(size_t j = start + negate; j < end; j++){
+                unsigned char first = pattern[j];
+                if(j + 2 < end && pattern[j + 1] == '-'){ //Range
+                    unsigned char last = pattern[j + 2];
+                    for(int k = first; k <= last; k++){
+                        members[k] = 1;
+                    }
+                    j += 2;
+                }
+                else{
+                    members[first] = 1;
+                }
+            }
+            for(int j = 1; j < 256; j++){
+                if(members[j] != negate){
+                    compiled->masks[j] |= bit;
+                }
+            }
+            i = end;
+        }
+        else{
+            compiled->masks[c] |= bit;
+        }
+        compiled->num_tokens++;
+    }
+    return 0;
+}
+
+/**
+ * This function should match a name against a compiled component. Every
+ * token position is tracked at once as a bit in one word, so each character
+ * costs a few shifts and masks and nothing ever backtracks. Names starting
+ * with '.' only match patterns that start with one, and "." and ".." never
+ * match. Returns 1 on a match.
+ * 
+ * Params:
+ *   compiled - compiled component
+ *   name - directory entry name
+ */
+int match_glob(struct glob_pattern* compiled, char* name){
+    uint64_t states = 1;
+
+    if(name[0] == '.' && (!compiled->dot_ok || name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))){
+        return 0;
+    }
+    states |= (states & compiled->stars) << 1; //A '*' can match nothing
+    for(unsigned char* ptr = (unsigned char*)name; *ptr != '\0'; ptr++){
+        states = ((states & compiled->masks[*ptr]) << 1) | (states & compiled->stars);
+        states |= (states & compiled->stars) << 1;
+        if(states == 0){
+            return 0;
+        }
+    }
+    return (states >> compiled->num_tokens) & 1;
+}
+
+/**
+ * This function should read a whole directory with getdents64() into a
+ * listing, one byte of d_type followed by the NUL-terminated name per
+ * entry. Returns -1 if it can't be opened.
+ * 
+ * Params:
+ *   path - directory to read
+ *   listing - listing to fill, its old names are freed
+ */
+int read_listing(char* path, struct dir_listing* listing){
+    struct stat info;
+    size_t capacity = 0;
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1){
+        return -1;
+    }
+    if(glob_dents == NULL){
+        glob_dents = malloc(GLOB_DENTS_BUFFER);
+    }
+    fstat(fd, &info);
+    free(listing->names);
+    listing->names = NULL;
+    listing->size = 0;
+    listing->num_names = 0;
+
+    while(1){
+        long num_read = syscall(SYS_getdents64, fd, glob_dents, GLOB_DENTS_BUFFER);
+        if(num_read <= 0){
+            break;
+        }
+        for(long offset = 0; offset < num_read;){
+            struct dirent64* entry = (struct dirent64*)(glob_dents + offset);
+            size_t length = strlen(entry->d_name) + 1;
+            offset += entry->d_reclen;
+            if(listing->size + length + 1 > capacity){
+                capacity = capacity == 0 ? 4096 : capacity * 2;
+                listing->names = realloc(listing->names, capacity);
+            }
+            listing->names[listing->size] = entry->d_type;
+            memcpy(listing->names + listing->size + 1, entry->d_name, length);
+            listing->size += length + 1;
+            listing->num_names++;
+        }
+    }
+    close(fd);
+
+    listing->dev = info.st_dev;
+    listing->ino = info.st_ino;
+    listing->mtime = info.st_mtim;
+    clock_gettime(CLOCK_MONOTONIC, &listing->loaded_at);
+    clock_gettime(CLOCK_REALTIME, &listing->loaded_wall);
+    return 0;
+}
+
+/**
+ * This function should return a directory's listing, from the cache if the
+ * directory's device, inode and mtime are unchanged and the listing is
+ * younger than GLOB_CACHE_TTL_MS. A listing read within GLOB_RACY_MS of the
+ * directory's mtime isn't trusted, since an entry added in the same clock
+ * tick wouldn't change the mtime. Otherwise the least recently read slot is
+ * refilled. Returns NULL if the directory can't be read.
+ * 
+ * Params:
+ *   path - directory, "." for the current one
+ */
+struct dir_listing* get_listing(char* path){
+    struct stat info;
+    struct timespec now;
+    struct dir_listing* oldest = &glob_cache[0];
+
+    if(stat(path, &info) == -1 || !S_ISDIR(info.st_mode)){
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for(int i = 0; i < GLOB_CACHE_SIZE; i++){
+        struct dir_listing* listing = &glob_cache[i];
+        if(listing->path != NULL && strcmp(listing->path, path) == 0){
+            long age_ms = (now.tv_sec - listing->loaded_at.tv_sec) * 1000 + (now.tv_nsec - listing->loaded_at.tv_nsec) / 1000000;
+            long settled_ms = (listing->loaded_wall.tv_sec - listing->mtime.tv_sec) * 1000 + (listing->loaded_wall.tv_nsec - listing->mtime.tv_nsec) / 1000000;
+            if(listing->dev == info.st_dev && listing->ino == info.st_ino && listing->mtime.tv_sec == info.st_mtim.tv_sec &&
+                listing->mtime.tv_nsec == info.st_mtim.tv_nsec && age_ms < GLOB_CACHE_TTL_MS && settled_ms >= GLOB_RACY_MS){
+                return listing;
+            }
+            oldest = listing; //Stale, reread into the same slot
+            break;
+        }
+        if(oldest->path == NULL){ //Free slot already found
+            continue;
+        }
+        if(listing->path == NULL || listing->loaded_at.tv_sec < oldest->loaded_at.tv_sec ||
+            (listing->loaded_at.tv_sec == oldest->loaded_at.tv_sec && listing->loaded_at.tv_nsec < oldest->loaded_at.tv_nsec)){
+            oldest = listing;
+        }
+    }
+
+    if(read_listing(path, oldest) == -1){
+        free(oldest->path);
+        oldest->path = NULL;
+        return NULL;
+    }
+    if(oldest->path == NULL || strcmp(oldest->path, path) != 0){
+        free(oldest->path);
+        oldest->path = strdup(path);
+    }
+    return oldest;
+}
+
+/**
+ * This function should append a match to the command's globbed buffer and
+ * record its offset
+ * 
+ * Params:
+ *   input - command that owns the globbed buffer
+ *   used - pointer to the bytes used in the buffer (by reference)
+ *   path - matched path
+ *   length - length of the path
+ */
+void add_glob_match(struct command* input, size_t* used, char* path, size_t length){
+    if(*used + length + 1 > input->globbed_size){
+        input->globbed_size = input->globbed_size == 0 ? 4096 : input->globbed_size;
+        while(*used + length + 1 > input->globbed_size){
+            input->globbed_size *= 2;
+        }
+        input->globbed = realloc(input->globbed, input->globbed_size);
+    }
+    if(glob_num_offsets == glob_offsets_capacity){
+        glob_offsets_capacity = glob_offsets_capacity == 0 ? 64 : glob_offsets_capacity * 2;
+        glob_offsets = realloc(glob_offsets, glob_offsets_capacity * sizeof(size_t));
+    }
+    memcpy(input->globbed + *used, path, length);
+    input->globbed[*used + length] = '\0';
+    glob_offsets[glob_num_offsets++] = *used;
+    *used += length + 1;
+}
+
+/**
+ * This function should match the rest of a pattern below a directory,
+ * one path component at a time. Components without glob characters are
+ * taken as they are; the others are matched against the directory's
+ * listing, recursing into matching subdirectories for the components left.
+ * 
+ * Params:
+ *   input - command that owns the globbed buffer
+ *   used - pointer to the bytes used in the buffer (by reference)
+ *   path - PATH_MAX buffer holding the directory matched so far, with a trailing '/' unless empty
+ *   path_length - length of path
+ *   pattern - rest of the pattern, no leading '/'
+ */
+void glob_walk(struct command* input, size_t* used, char* path, size_t path_length, char* pattern){
+    struct glob_pattern compiled;
+    struct stat info;
+    char* slash = strchr(pattern, '/');
+    size_t length = slash == NULL ? strlen(pattern) : (size_t)(slash - pattern);
+    char* rest = slash;
+
+    while(rest != NULL && *rest == '/'){ //Skip repeated slashes
+        rest++;
+    }
+    if(rest != NULL && *rest == '\0'){ //Trailing '/', only directories match
+        rest = NULL;
+    }
+
+    if(!has_glob(pattern, length)){
+        if(path_length + length + 2 > PATH_MAX){
+            return;
+        }
+        memcpy(path + path_length, pattern, length);
+        path[path_length + length] = '\0';
+        if(rest == NULL){ //Last component, keep it if it exists
+            if(slash == NULL && lstat(path, &info) == 0){
+                add_glob_match(input, used, path, path_length + length);
+            }
+            else if(slash != NULL && stat(path, &info) == 0 && S_ISDIR(info.st_mode)){
+                path[path_length + length] = '/';
+                add_glob_match(input, used, path, path_length + length + 1);
+            }
+            return;
+        }
+        path[path_length + length] = '/';
+        glob_walk(input, used, path, path_length + length + 1, rest);
+        return;
+    }
+
+    if(compile_glob(pattern, length, &compiled) == -1){
+        return;
+    }
+    if(path_length > 0){
+        path[path_length - 1] = '\0'; //Directory without its trailing '/'
+    }
+    struct dir_listing* listing = get_listing(path_length == 0 ? "." : (path_length == 1 ? "/" : path));
+    if(path_length > 0){
+        path[path_length - 1] = '/';
+    }
+    if(listing == NULL){
+        return;
+    }
+
+    //Collect matches first, recursing could refill this listing's slot
+    char* matches = NULL;
+    size_t matches_used = 0, matches_capacity = 0;
+    char* entry = listing->names;
+    for(int i = 0; i < listing->num_names; i++){
+        unsigned char type = entry[0];
+        char* name = entry + 1;
+        size_t name_length = strlen(name);
+        entry = name + name_length + 1;
+        if(!match_glob(&compiled, name) || path_length + name_length + 2 > PATH_MAX){
+            continue;
+        }
+        memcpy(path + path_length, name, name_length + 1);
+        if(rest == NULL && slash == NULL){
+            add_glob_match(input, used, path, path_length + name_length);
+            continue;
+        }
+        if(type != DT_DIR && (type != DT_LNK && type != DT_UNKNOWN)){
+            continue;
+        }
+        if(type != DT_DIR && (stat(path, &info) == -1 || !S_ISDIR(info.st_mode))){
+            continue;
+        }
+        if(rest == NULL){ //Pattern ended with '/'
+            path[path_length + name_length] = '/';
+            add_glob_match(input, used, path, path_length + name_length + 1);
+            continue;
+        }
+        cache_append(&matches, &matches_used, &matches_capacity, name, name_length + 1);
+    }
+
+    for(size_t offset = 0; offset < matches_used;){
+        char* name = matches + offset;
+        size_t name_length = strlen(name);
+        offset += name_length + 1;
+        memcpy(path + path_length, name, name_length);
+        path[path_length + name_length] = '/';
+        glob_walk(input, used, path, path_length + name_length + 1, rest);
+    }
+    free(matches);
+}
+
+/**
+ * This function should compare two matches by their bytes for qsort()
+ * 
+ * Params:
+ *   a - pointer to the first match's offset
+ *   b - pointer to the second match's offset
+ */
+int compare_glob_match(const void* a, const void* b){
+    return strcmp(glob_sort_base + *(const size_t*)a, glob_sort_base + *(const size_t*)b);
+}
+
+/**
+ * This function should replace every arg containing '*', '?' or '[...]' with
+ * the sorted paths it matches. Like sh, an arg that matches nothing is kept
+ * as it is. Matches are stored in the command's globbed buffer, which is
+ * reused across commands and only grows.
+ * 
+ * Params:
+ *   input - command struct holding args
+ */
+void expand_globs(struct command* input){
+    char path[PATH_MAX];
+    size_t used = 0;
+    int num_globs = 0;
+
+    for(int i = 0; i < input->num_args; i++){
+        if(has_glob(input->args[i], strlen(input->args[i]))){
+            num_globs++;
+        }
+    }
+    if(num_globs == 0){
+        return;
+    }
+
+    //Match every pattern, then grow args in place from the back
+    int* first = malloc(2 * input->num_args * sizeof(int));
+    int* count = first + input->num_args;
+    int total = 0;
+    glob_num_offsets = 0;
+    for(int i = 0; i < input->num_args; i++){
+        first[i] = glob_num_offsets;
+        count[i] = 0;
+        if(has_glob(input->args[i], strlen(input->args[i]))){
+            char* pattern = input->args[i];
+            size_t path_length = 0;
+            if(pattern[0] == '/'){ //Absolute
+                path[0] = '/';
+                path_length = 1;
+                while(*pattern == '/'){
+                    pattern++;
+                }
+            }
+            glob_walk(input, &used, path, path_length, pattern);
+            count[i] = glob_num_offsets - first[i];
+        }
+        total += count[i] > 0 ? count[i] : 1;
+    }
+    glob_sort_base = input->globbed;
+    for(int i = 0; i < input->num_args; i++){
+        if(count[i] > 1){
+            qsort(glob_offsets + first[i], count[i], sizeof(size_t), compare_glob_match);
+        }
+    }
+
+    reserve_args(input, total);
+    int position = total;
+    for(int i = input->num_args - 1; i >= 0; i--){
+        if(count[i] == 0){
+            input->args[--position] = input->args[i];
+            continue;
+        }
+        for(int j = count[i] - 1; j >= 0; j--){
+            input->args[--position] = input->globbed + glob_offsets[first[i] + j];
+        }
+    }
+    input->num_args = total;
+    input->args[total] = NULL;
+    free(first);
+}
@@ -0,0 +1,633 @@
+#include "smallsh.h"
+
+struct history_store history = {NULL, NULL, -1};
+
+/**
+ * This function should open the history file, SMALLSH_HISTORY or
+ * ~/.smallsh_history, for appending. An empty SMALLSH_HISTORY turns history
+ * off. Lines are only recorded when stdin is a terminal, or when the file
+ * was named explicitly; otherwise the file isn't created. If the compacted
+ * index has fallen far behind the file, it is rebuilt in the background
+ * right away so the first search doesn't have to index everything itself.
+ */
+void set_history(void){
+    char* path = getenv("SMALLSH_HISTORY");
+    char* home = getenv("HOME");
+
+    history.record = isatty(STDIN_FILENO) || path != NULL;
+    if(path == NULL && home != NULL){
+        history.path = malloc(strlen(home) + sizeof("/.smallsh_history"));
+        sprintf(history.path, "%s/.smallsh_history", home);
+    }
+    else if(path != NULL && path[0] != '\0'){
+        history.path = strdup(path);
+    }
+    else{
+        return;
+    }
+    history.index_path = malloc(strlen(history.path) + sizeof(".idx"));
+    sprintf(history.index_path, "%s.idx", history.path);
+
+    history.fd = open(history.path, O_RDWR | O_APPEND | O_CLOEXEC | (history.record ? O_CREAT : 0), 0600);
+    if(history.fd == -1){
+        free_history();
+        return;
+    }
+
+    struct stat history_stat;
+    struct history_index_header header = {{0}};
+    int index_fd = open(history.index_path, O_RDONLY | O_CLOEXEC);
+    if(index_fd != -1){
+        if(pread(index_fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, HISTORY_INDEX_MAGIC, 8) != 0){
+            header.covered_size = 0;
+        }
+        close(index_fd);
+    }
+    if(history.record && fstat(history.fd, &history_stat) == 0
+        && (size_t)history_stat.st_size - header.covered_size > (size_t)HISTORY_COMPACT_ENTRIES * 32){
+        compact_history();
+    }
+}
+
+/**
+ * This function should append one line read at the prompt to the history
+ * file. The whole entry goes out in one write() on an O_APPEND descriptor,
+ * under an exclusive flock() so concurrent sessions never interleave. Once
+ * history has been read, the new line is indexed right away.
+ * 
+ * Params:
+ *   line - line as read, newline included
+ */
+void add_history(char* line){
+    size_t length = strcspn(line, "\n");
+    size_t start = 0;
+
+    if(history.path == NULL || !history.record){
+        return;
+    }
+    while(start < length && isspace((unsigned char)line[start])){
+        start++;
+    }
+    if(start == length){ //Blank lines aren't kept
+        return;
+    }
+
+    struct iovec entry[2] = {{line, length}, {"\n", 1}}; //getline() drops it on a last line without one
+    flock(history.fd, LOCK_EX);
+    writev(history.fd, entry, 2);
+    flock(history.fd, LOCK_UN);
+
+    if(history.data != NULL){
+        sync_history();
+    }
+}
+
+/**
+ * This function should map the history file and split any complete lines
+ * appended since the last call, by this session or any other, into entries.
+ * If the file shrank or was replaced, everything read so far is dropped and
+ * read again. Returns -1 if the file can't be read.
+ */
+int scan_history(void){
+    struct stat history_stat, path_stat;
+
+    if(history.path == NULL){
+        return -1;
+    }
+    if(stat(history.path, &path_stat) == 0 && fstat(history.fd, &history_stat) == 0
+        && (path_stat.st_ino != history_stat.st_ino || path_stat.st_dev != history_stat.st_dev)){
+        int fd = open(history.path, O_RDWR | O_APPEND | O_CLOEXEC);
+        if(fd != -1){ //Replaced by another session, follow it
+            close(history.fd);
+            history.fd = fd;
+            reset_history();
+        }
+    }
+    if(fstat(history.fd, &history_stat) == -1){
+        return -1;
+    }
+    size_t size = history_stat.st_size;
+
+    if(size < history.scanned_size){ //Truncated or replaced, start over
+        reset_history();
+    }
+    if(size > history.mapped_size){
+        char* data = history.data == NULL ? mmap(NULL, size, PROT_READ, MAP_SHARED, history.fd, 0)
+            : mremap(history.data, history.mapped_size, size, MREMAP_MAYMOVE);
+        if(data == MAP_FAILED){
+            return -1;
+        }
+        history.data = data;
+        history.mapped_size = size;
+    }
+    if(history.offsets == NULL){
+        history.offsets_capacity = 1024;
+        history.offsets = malloc(history.offsets_capacity * sizeof(uint64_t));
+        history.offsets[0] = 0;
+    }
+
+    char* end;
+    while(history.scanned_size < history.mapped_size
+        && (end = memchr(history.data + history.scanned_size, '\n', history.mapped_size - history.scanned_size)) != NULL){
+        if(history.num_entries + 1 >= history.offsets_capacity){
+            history.offsets_capacity *= 2;
+            history.offsets = realloc(history.offsets, history.offsets_capacity * sizeof(uint64_t));
+        }
+        history.scanned_size = end - history.data + 1;
+        history.offsets[++history.num_entries] = history.scanned_size;
+    }
+    return 0;
+}
+
+/**
+ * This function should bring the history and its index up to date: split
+ * new lines into entries, switch to a newer compacted index file if another
+ * process wrote one, and add the entries past it to the in-memory index.
+ * When that tail gets long, a new index file is built in the background.
+ * Returns -1 if the history can't be read.
+ */
+int sync_history(void){
+    if(scan_history() == -1){
+        return -1;
+    }
+    load_history_index();
+    while(history.compact_entries + history.tail_indexed < history.num_entries){
+        uint32_t entry = history.compact_entries + history.tail_indexed++;
+        index_history_entry(&history.tail, entry, history.data + history.offsets[entry],
+            history.offsets[entry + 1] - history.offsets[entry] - 1);
+    }
+    if(history.tail_indexed >= HISTORY_COMPACT_ENTRIES){
+        compact_history();
+    }
+    return 0;
+}
+
+/**
+ * This function should drop everything read from the history file, when it
+ * was truncated or replaced under us
+ */
+void reset_history(void){
+    if(history.data != NULL){
+        munmap(history.data, history.mapped_size);
+    }
+    if(history.compact != NULL){
+        munmap(history.compact, history.compact_size);
+    }
+    free(history.offsets);
+    free_history_index(&history.tail);
+    history.data = NULL;
+    history.mapped_size = 0;
+    history.scanned_size = 0;
+    history.offsets = NULL;
+    history.num_entries = 0;
+    history.compact = NULL;
+    history.compact_ino = 0;
+    history.compact_entries = 0;
+    history.tail_indexed = 0;
+}
+
+/**
+ * This function should find a trigram's posting list in an in-memory index,
+ * adding an empty one if add is set. Returns NULL if it isn't there.
+ * 
+ * Params:
+ *   index - in-memory index
+ *   key - trigram, HISTORY_KEY_USED included
+ *   add - 1 to add the key if it's missing
+ */
+struct history_postings* history_slot(struct history_index* index, uint32_t key, int add){
+    if(index->capacity == 0 || (add && (index->num_keys + 1) * 4 > index->capacity * 3)){
+        if(!add){
+            return NULL;
+        }
+        struct history_index grown = {NULL, index->capacity == 0 ? 4096 : index->capacity * 2, 0};
+        grown.slots = calloc(grown.capacity, sizeof(struct history_postings));
+        for(uint32_t i = 0; i < index->capacity; i++){
+            if(index->slots[i].key != 0){
+                *history_slot(&grown, index->slots[i].key, 1) = index->slots[i];
+            }
+        }
+        grown.num_keys = index->num_keys;
+        free(index->slots);
+        *index = grown;
+    }
+
+    uint32_t mask = index->capacity - 1;
+    uint32_t hash = key * 2654435761u;
+    for(uint32_t i = (hash ^ hash >> 16) & mask; ; i = (i + 1) & mask){
+        if(index->slots[i].key == key){
+            return &index->slots[i];
+        }
+        if(index->slots[i].key == 0){
+            if(!add){
+                return NULL;
+            }
+            index->slots[i].key = key;
+            index->num_keys++;
+            return &index->slots[i];
+        }
+    }
+}
+
+/**
+ * This function should add one entry to an in-memory index under every
+ * trigram of its text. Entries are added in order, so each posting list
+ * stays sorted and a repeated trigram is caught by its last element.
+ * 
+ * Params:
+ *   index - in-memory index
+ *   entry - entry number
+ *   text - entry text, not NUL-terminated
+ *   length - bytes of text
+ */
+void index_history_entry(struct history_index* index, uint32_t entry, char* text, size_t length){
+    unsigned char* bytes = (unsigned char*)text;
+
+    for(size_t i = 0; i + 3 <= length; i++){
+        uint32_t key = HISTORY_KEY_USED | bytes[i] << 16 | bytes[i + 1] << 8 | bytes[i + 2];
+        struct history_postings* postings = history_slot(index, key, 1);
+        if(postings->count > 0 && postings->entries[postings->count - 1] == entry){
+            continue;
+        }
+        if(postings->count == postings->capacity){
+            postings->capacity = postings->capacity == 0 ? 4 : postings->capacity * 2;
+            postings->entries = realloc(postings->entries, postings->capacity * sizeof(uint32_t));
+        }
+        postings->entries[postings->count++] = entry;
+    }
+}
+
+/**
+ * This function should free an in-memory index
+ * 
+ * Params:
+ *   index - in-memory index
+ */
+void free_history_index(struct history_index* index){
+    for(uint32_t i = 0; i < index->capacity; i++){
+        free(index->slots[i].entries);
+    }
+    free(index->slots);
+    memset(index, 0, sizeof(struct history_index));
+}
+
+/**
+ * This function should sort posting lists by key, for qsort()
+ */
+int compare_history_keys(const void* a, const void* b){
+    uint32_t left = (*(struct history_postings**)a)->key;
+    uint32_t right = (*(struct history_postings**)b)->key;
+    return left < right ? -1 : left > right;
+}
+
+/**
+ * This function should write an in-memory index of the whole history as a
+ * compacted index file: sorted keys, offsets into one postings array, and the
+ * postings. It goes to a temporary file renamed over the old one, so readers
+ * only ever map a complete index. Returns -1 on failure.
+ * 
+ * Params:
+ *   index - index of entries 0 to history.num_entries
+ */
+int write_history_index(struct history_index* index){
+    struct history_index_header header = {HISTORY_INDEX_MAGIC};
+    struct stat history_stat;
+    char temp_path[PATH_MAX];
+
+    if(fstat(history.fd, &history_stat) == -1){
+        return -1;
+    }
+    header.dev = history_stat.st_dev;
+    header.ino = history_stat.st_ino;
+    header.covered_size = history.scanned_size;
+    header.num_entries = history.num_entries;
+    header.num_keys = index->num_keys;
+
+    struct history_postings** sorted = malloc((index->num_keys + 1) * sizeof(struct history_postings*));
+    uint32_t* starts = malloc((index->num_keys + 1) * sizeof(uint32_t));
+    uint32_t* keys = malloc((index->num_keys + 1) * sizeof(uint32_t));
+    uint32_t num_keys = 0;
+    for(uint32_t i = 0; i < index->capacity; i++){
+        if(index->slots[i].key != 0){
+            sorted[num_keys++] = &index->slots[i];
+        }
+    }
+    qsort(sorted, num_keys, sizeof(struct history_postings*), compare_history_keys);
+    for(uint32_t i = 0; i < num_keys; i++){
+        keys[i] = sorted[i]->key;
+        starts[i] = header.num_postings;
+        header.num_postings += sorted[i]->count;
+    }
+    starts[num_keys] = header.num_postings;
+
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", history.index_path, (int)getpid());
+    FILE* out = fopen(temp_path, "w");
+    int failed = out == NULL;
+    if(out != NULL){
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(keys, sizeof(uint32_t), num_keys, out);
+        fwrite(starts, sizeof(uint32_t), num_keys + 1, out);
+        for(uint32_t i = 0; i < num_keys; i++){
+            fwrite(sorted[i]->entries, sizeof(uint32_t), sorted[i]->count, out);
+        }
+        failed = ferror(out);
+        failed |= fclose(out) != 0;
+        if(failed || rename(temp_path, history.index_path) == -1){
+            unlink(temp_path);
+            failed = 1;
+        }
+    }
+    free(sorted);
+    free(starts);
+    free(keys);
+    return failed ? -1 : 0;
+}
+
+/**
+ * This function should rebuild the compacted index file in a low priority
+ * background process, so the shell never stalls on it. The child reads the
+ * whole file itself, indexes every entry and exits; the shell picks the new
+ * file up on its next search and drops its in-memory tail. The child is
+ * reaped with the shell's other children, as a pid that isn't in the job
+ * table.
+ */
+void compact_history(void){
+    if(history.compactor != 0 && kill(history.compactor, 0) == 0){
+        return; //Still running
+    }
+    history.compactor = 0;
+    fflush(stdout); //Don't write buffered output twice
+
+    pid_t pid = fork();
+    if(pid != 0){
+        if(pid > 0){
+            history.compactor = pid;
+        }
+        return;
+    }
+
+    struct history_index index = {NULL, 0, 0};
+    setpriority(PRIO_PROCESS, 0, 19);
+    if(scan_history() == -1){
+        _exit(1);
+    }
+    for(uint32_t entry = 0; entry < history.num_entries; entry++){
+        index_history_entry(&index, entry, history.data + history.offsets[entry],
+            history.offsets[entry + 1] - history.offsets[entry] - 1);
+    }
+    _exit(write_history_index(&index) == -1);
+}
+
+/**
+ * This function should map the compacted index file if it changed since it
+ * was last looked at. It is only used if it was built from this history
+ * file and ends on one of our entries, and its starts[] only go up and stay
+ * inside the postings; then the in-memory index is started over from where
+ * the file stops.
+ */
+void load_history_index(void){
+    struct stat index_stat, history_stat;
+
+    if(stat(history.index_path, &index_stat) == -1 || fstat(history.fd, &history_stat) == -1){
+        return;
+    }
+    if(index_stat.st_ino == history.compact_ino
+        && index_stat.st_mtim.tv_sec == history.compact_mtime.tv_sec && index_stat.st_mtim.tv_nsec == history.compact_mtime.tv_nsec){
+        return;
+    }
+    int fd = open(history.index_path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1){
+        return;
+    }
+    size_t size = index_stat.st_size;
+    char* compact = size < sizeof(struct history_index_header) ? MAP_FAILED : mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(compact == MAP_FAILED){
+        return;
+    }
+
+    struct history_index_header* header = (struct history_index_header*)compact;
+    int valid = memcmp(header->magic, HISTORY_INDEX_MAGIC, 8) == 0
+        && header->dev == (uint64_t)history_stat.st_dev && header->ino == (uint64_t)history_stat.st_ino
+        && header->num_entries <= history.num_entries && history.offsets[header->num_entries] == header->covered_size
+        && header->num_postings <= size / sizeof(uint32_t)
+        && size == sizeof(*header) + ((uint64_t)header->num_keys * 2 + 1 + header->num_postings) * sizeof(uint32_t);
+    uint32_t* starts = (uint32_t*)(header + 1) + header->num_keys;
+    for(uint32_t i = 0; valid && i < header->num_keys; i++){
+        valid = starts[i] <= starts[i + 1];
+    }
+    valid = valid && starts[0] == 0 && starts[header->num_keys] == header->num_postings;
+    if(!valid || header->num_entries < history.compact_entries){
+        munmap(compact, size);
+        return;
+    }
+
+    if(history.compact != NULL){
+        munmap(history.compact, history.compact_size);
+    }
+    history.compact = compact;
+    history.compact_size = size;
+    history.compact_ino = index_stat.st_ino;
+    history.compact_mtime = index_stat.st_mtim;
+    history.compact_entries = header->num_entries;
+    free_history_index(&history.tail);
+    history.tail_indexed = 0;
+}
+
+/**
+ * This function should find a trigram's posting list, either in the
+ * compacted index file, by binary search over its sorted keys, or in the
+ * in-memory tail. Returns NULL if no entry has the trigram.
+ * 
+ * Params:
+ *   compacted - 1 for the index file, 0 for the in-memory tail
+ *   key - trigram, HISTORY_KEY_USED included
+ *   count - set to the list's length
+ */
+uint32_t* find_postings(int compacted, uint32_t key, uint32_t* count){
+    if(!compacted){
+        struct history_postings* postings = history_slot(&history.tail, key, 0);
+        *count = postings == NULL ? 0 : postings->count;
+        return postings == NULL ? NULL : postings->entries;
+    }
+    if(history.compact == NULL){
+        return NULL;
+    }
+
+    struct history_index_header* header = (struct history_index_header*)history.compact;
+    uint32_t* keys = (uint32_t*)(header + 1);
+    uint32_t* starts = keys + header->num_keys;
+    uint32_t* postings = starts + header->num_keys + 1;
+    uint32_t low = 0, high = header->num_keys;
+    while(low < high){
+        uint32_t middle = low + (high - low) / 2;
+        if(keys[middle] < key){
+            low = middle + 1;
+        }
+        else{
+            high = middle;
+        }
+    }
+    if(low == header->num_keys || keys[low] != key){
+        return NULL;
+    }
+    *count = starts[low + 1] - starts[low];
+    return postings + starts[low];
+}
+
+/**
+ * This function should print one entry, numbered from 1 like bash
+ * 
+ * Params:
+ *   entry - entry number
+ */
+void print_history_entry(uint32_t entry){
+    printf("%5u  %.*s\n", entry + 1, (int)(history.offsets[entry + 1] - history.offsets[entry] - 1),
+        history.data + history.offsets[entry]);
+}
+
+/**
+ * This function should print the entries in one part of the index that
+ * contain a string. The posting lists of the string's trigrams are
+ * intersected starting from the shortest, so only entries that have every
+ * trigram are ever looked at, and those are checked with memmem(). Entries
+ * past the part's end are skipped, a corrupt index file can't send the
+ * lookup past history.offsets. Returns how many matched.
+ * 
+ * Params:
+ *   compacted - 1 for the index file, 0 for the in-memory tail
+ *   text - string to find, at least 3 bytes
+ *   length - bytes of text
+ */
+int search_history_part(int compacted, char* text, size_t length){
+    size_t num_lists = length - 2;
+    uint32_t** lists = malloc(num_lists * sizeof(uint32_t*));
+    uint32_t* counts = malloc(num_lists * sizeof(uint32_t));
+    unsigned char* bytes = (unsigned char*)text;
+    size_t shortest = 0;
+    int num_matches = 0;
+    uint32_t end = !compacted ? history.num_entries : history.compact == NULL ? 0 : ((struct history_index_header*)history.compact)->num_entries;
+
+    for(size_t i = 0; i < num_lists; i++){
+        uint32_t key = HISTORY_KEY_USED | bytes[i] << 16 | bytes[i + 1] << 8 | bytes[i + 2];
+        lists[i] = find_postings(compacted, key, &counts[i]);
+        if(lists[i] == NULL){
+            free(lists);
+            free(counts);
+            return 0;
+        }
+        if(counts[i] < counts[shortest]){
+            shortest = i;
+        }
+    }
+
+    for(uint32_t k = 0; k < counts[shortest]; k++){
+        uint32_t entry = lists[shortest][k];
+        int found = entry < end;
+        for(size_t i = 0; i < num_lists && found; i++){
+            if(i == shortest){
+                continue;
+            }
+            //Binary search the rest of each list, the candidates only go up
+            uint32_t low = 0, high = counts[i];
+            while(low < high){
+                uint32_t middle = low + (high - low) / 2;
+                if(lists[i][middle] < entry){
+                    low = middle + 1;
+                }
+                else{
+                    high = middle;
+                }
+            }
+            found = low < counts[i] && lists[i][low] == entry;
+            lists[i] += low;
+            counts[i] -= low;
+        }
+        if(found && memmem(history.data + history.offsets[entry], history.offsets[entry + 1] - history.offsets[entry] - 1, text, length) != NULL){
+            print_history_entry(entry);
+            num_matches++;
+        }
+    }
+    free(lists);
+    free(counts);
+    return num_matches;
+}
+
+/**
+ * This function should handle the history built-in command. "history [n]"
+ * prints every entry, or the last n, from every session. "history -s text"
+ * prints the entries containing text, with the rest of the args joined by
+ * spaces, using the trigram index; strings shorter than a trigram are
+ * found with a scan. Returns 1 if nothing matched or on a usage error.
+ * 
+ * Params:
+ *   input - struct holding command args
+ */
+int history_execute(struct command* input){
+    if(history.path == NULL){
+        printf("bash: history: history is off\n");
+        return 1;
+    }
+    if(sync_history() == -1){
+        file_directory_error(history.path);
+        return 1;
+    }
+
+    if(input->num_args >= 3 && strcmp(input->args[1], "-s") == 0){
+        size_t length = 0;
+        for(int i = 2; i < input->num_args; i++){
+            length += strlen(input->args[i]) + 1;
+        }
+        char* text = malloc(length);
+        char* ptr = text;
+        for(int i = 2; i < input->num_args; i++){
+            ptr = stpcpy(ptr, input->args[i]);
+            *ptr++ = ' ';
+        }
+        length--;
+        text[length] = '\0';
+
+        int num_matches = 0;
+        if(length < 3){
+            for(uint32_t entry = 0; entry < history.num_entries; entry++){
+                if(memmem(history.data + history.offsets[entry], history.offsets[entry + 1] - history.offsets[entry] - 1, text, length) != NULL){
+                    print_history_entry(entry);
+                    num_matches++;
+                }
+            }
+        }
+        else{
+            num_matches = search_history_part(1, text, length) + search_history_part(0, text, length);
+        }
+        free(text);
+        return num_matches == 0;
+    }
+
+    char* end = NULL;
+    long count = input->num_args == 2 ? strtol(input->args[1], &end, 10) : history.num_entries;
+    if(input->num_args > 2 || (end != NULL && (*end != '\0' || count < 0))){
+        printf("bash: history: usage: history [n] | history -s text\n");
+        return 1;
+    }
+    uint32_t first = count >= history.num_entries ? 0 : history.num_entries - count;
+    for(uint32_t entry = first; entry < history.num_entries; entry++){
+        print_history_entry(entry);
+    }
+    return 0;
+}
+
+/**
+ * This function should unmap and free the history at exit. A compaction
+ * still running is left to finish on its own.
+ */
+void free_history(void){
+    reset_history();
+    if(history.fd != -1){
+        close(history.fd);
+    }
+    free(history.path);
+    free(history.index_path);
+    history.path = NULL;
+    history.index_path = NULL;
+    history.fd = -1;
+}
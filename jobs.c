@@ -0,0 +1,391 @@
+#include "smallsh.h"
+
+/**
+ * This function should hash a pid into a slot of the pid index
+ * 
+ * Params:
+ *   pid - process id to hash
+ *   capacity - size of the index, always a power of two
+ */
+int pid_hash(pid_t pid, int capacity){
+    return (int)(((unsigned int)pid * 2654435761u) & (capacity - 1)); //Knuth's multiplicative hash
+}
+
+/**
+ * This function should insert a pid into the job table's pid index, which
+ * maps every running pid to its job with linear probing
+ * 
+ * Params:
+ *   jobs - job table
+ *   pid - pid to add
+ *   job - job the pid belongs to
+ */
+void index_pid(struct job_table* jobs, pid_t pid, struct job* job){
+    if((jobs->index_used + 1) * 2 > jobs->index_capacity){ //Keep load under 1/2 so probes stay short
+        struct pid_slot* old_index = jobs->index;
+        int old_capacity = jobs->index_capacity;
+
+        jobs->index_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+        jobs->index = calloc(jobs->index_capacity, sizeof(struct pid_slot));
+        jobs->index_used = 0;
+        for(int i = 0; i < old_capacity; i++){
+            if(old_index[i].job != NULL){
+                index_pid(jobs, old_index[i].pid, old_index[i].job);
+            }
+        }
+        free(old_index);
+    }
+
+    int i = pid_hash(pid, jobs->index_capacity);
+    while(jobs->index[i].job != NULL){
+        i = (i + 1) & (jobs->index_capacity - 1);
+    }
+    jobs->index[i].pid = pid;
+    jobs->index[i].job = job;
+    jobs->index_used++;
+}
+
+/**
+ * This function should find the job a pid belongs to, or NULL
+ * 
+ * Params:
+ *   jobs - job table
+ *   pid - pid to look up
+ */
+struct job* find_job(struct job_table* jobs, pid_t pid){
+    if(jobs->index_capacity == 0){
+        return NULL;
+    }
+    int i = pid_hash(pid, jobs->index_capacity);
+    while(jobs->index[i].job != NULL){
+        if(jobs->index[i].pid == pid){
+            return jobs->index[i].job;
+        }
+        i = (i + 1) & (jobs->index_capacity - 1);
+    }
+    return NULL;
+}
+
+/**
+ * This function should remove a reaped pid from the pid index. Later entries
+ * in the probe run are shifted back so no tombstones are needed.
+ * 
+ * Params:
+ *   jobs - job table
+ *   pid - pid to remove
+ */
+void unindex_pid(struct job_table* jobs, pid_t pid){
+    int mask = jobs->index_capacity - 1;
+    int i = pid_hash(pid, jobs->index_capacity);
+    while(jobs->index[i].job != NULL && jobs->index[i].pid != pid){
+        i = (i + 1) & mask;
+    }
+    if(jobs->index[i].job == NULL){ //Not indexed
+        return;
+    }
+
+    jobs->index[i].job = NULL;
+    jobs->index_used--;
+    for(int j = (i + 1) & mask; jobs->index[j].job != NULL; j = (j + 1) & mask){
+        int home = pid_hash(jobs->index[j].pid, jobs->index_capacity);
+        if(((j - home) & mask) >= ((j - i) & mask)){ //Entry can fill the hole without passing its home slot
+            jobs->index[i] = jobs->index[j];
+            jobs->index[j].job = NULL;
+            i = j;
+        }
+    }
+}
+
+/**
+ * This function should set up an empty job table. SIGCHLD is blocked and
+ * read through a signalfd instead, so children can be reaped from the
+ * shell's wait loops without a signal handler. Every job's deadline shares
+ * one timerfd, armed for whichever is first.
+ * 
+ * Params:
+ *   jobs - job table to set up
+ */
+void init_job_table(struct job_table* jobs){
+    sigset_t sigchld_set;
+
+    memset(jobs, 0, sizeof(struct job_table));
+    sigemptyset(&sigchld_set);
+    sigaddset(&sigchld_set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld_set, NULL);
+    jobs->sigchld_fd = signalfd(-1, &sigchld_set, SFD_NONBLOCK | SFD_CLOEXEC);
+    jobs->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    jobs->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    jobs->next_timeout = -1;
+    jobs->next_grace = -1;
+}
+
+/**
+ * This function should add a job for the stages of a command or pipeline.
+ * Stages that failed to launch (pid -1) are skipped. The job gets its
+ * deadline, if it has one. Returns the new job, or NULL if no stage launched.
+ * 
+ * Params:
+ *   jobs - job table
+ *   pids - pid of every stage
+ *   num_pids - number of stages
+ *   background - 1 if the job runs in the background
+ */
+struct job* add_job(struct job_table* jobs, pid_t* pids, int num_pids, int background){
+    struct job* job = malloc(sizeof(struct job) + num_pids * sizeof(pid_t));
+    job->pid = -1;
+    job->num_pids = 0;
+    job->status = 0;
+    job->background = background;
+    job->done = 0;
+    job->next_done = NULL;
+    memset(&job->usage, 0, sizeof(struct rusage));
+    job->output_fd = -1;
+    memset(&job->output, 0, sizeof(struct output_ring));
+    job->kept = 0;
+    job->next_kept = NULL;
+    job->placement = NULL;
+    job->deadline_slot = -1;
+    job->timed_out = 0;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+    for(int i = 0; i < num_pids; i++){
+        if(pids[i] != -1){
+            job->pids[job->num_pids] = pids[i];
+            job->num_pids++;
+            job->pid = pids[i]; //Job is reported by its last stage that launched
+            index_pid(jobs, pids[i], job);
+        }
+    }
+    if(job->num_pids == 0){
+        free(job);
+        return NULL;
+    }
+    job->num_running = job->num_pids;
+
+    if(jobs->num_jobs == jobs->capacity){ //Grow geometrically
+        jobs->capacity = jobs->capacity == 0 ? 16 : jobs->capacity * 2;
+        jobs->jobs = realloc(jobs->jobs, jobs->capacity * sizeof(struct job*));
+    }
+    job->slot = jobs->num_jobs;
+    jobs->jobs[jobs->num_jobs] = job;
+    jobs->num_jobs++;
+    start_deadline(jobs, job);
+    METRIC_ADD(metrics.externals, 1);
+    if(background){
+        METRIC_ADD(metrics.background_started, 1);
+    }
+    return job;
+}
+
+/**
+ * This function should remove a job from the table and free it by moving
+ * the last job into its slot
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job to remove
+ */
+void remove_job(struct job_table* jobs, struct job* job){
+    for(int i = 0; i < job->num_pids; i++){ //Only still-running pids are indexed
+        if(find_job(jobs, job->pids[i]) == job){
+            unindex_pid(jobs, job->pids[i]);
+        }
+    }
+
+    cancel_deadline(jobs, job);
+    release_job_output(jobs, job);
+    free(job->output.data);
+    free(job->placement);
+
+    jobs->num_jobs--;
+    jobs->jobs[job->slot] = jobs->jobs[jobs->num_jobs];
+    jobs->jobs[job->slot]->slot = job->slot;
+    free(job);
+}
+
+/**
+ * This function should add one child's resource usage to a job's total.
+ * CPU times and context switches add up, max RSS keeps the largest.
+ * 
+ * Params:
+ *   total - running total
+ *   usage - usage of one reaped child
+ */
+void add_rusage(struct rusage* total, struct rusage* usage){
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if(usage->ru_maxrss > total->ru_maxrss){
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/**
+ * This function should record that one child has exited, matching it to its
+ * job through the pid index. Finished background jobs are queued to be
+ * reported at the next prompt.
+ * 
+ * Params:
+ *   jobs - job table
+ *   pid - pid of the child
+ *   status - its raw wait status
+ *   usage - its resource usage
+ */
+void finish_child(struct job_table* jobs, pid_t pid, int status, struct rusage* usage){
+    struct job* job = find_job(jobs, pid);
+    if(job == NULL){ //Not one of ours
+        return;
+    }
+    unindex_pid(jobs, pid);
+    TRACE(TRACE_REAP, 'i', pid);
+    if(pid == job->pid){
+        job->status = status;
+    }
+    add_rusage(&job->usage, usage);
+    job->num_running--;
+    if(job->num_running == 0){
+        job->done = 1;
+        clock_gettime(CLOCK_MONOTONIC, &job->end);
+        cancel_deadline(jobs, job);
+        read_job_output(jobs, job); //Everything it wrote is in the pipe now
+        if(job->background){ //Queue to be reported
+            jobs->num_background_running--;
+            count_placement(job->placement, -1);
+            if(jobs->done_tail == NULL){
+                jobs->done_head = job;
+            }
+            else{
+                jobs->done_tail->next_done = job;
+            }
+            jobs->done_tail = job;
+        }
+    }
+}
+
+/**
+ * This function should reap every child that has finished, without blocking.
+ * Children are reaped with wait4() so their resource usage is added to their
+ * job. Children the zygote launched are reported by it instead. Deadlines
+ * that have passed are acted on here too.
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void reap_children(struct job_table* jobs){
+    struct signalfd_siginfo info;
+    int childExitStatus = -5;
+    struct rusage usage;
+    pid_t pid;
+
+    //SIGCHLDs coalesce, so clear them all and let waitpid() find every child
+    while(read(jobs->sigchld_fd, &info, sizeof(info)) > 0);
+
+    while((pid = wait4(-1, &childExitStatus, WNOHANG, &usage)) > 0){
+        if(server != NULL){ //Daemon mode, the child may be any client's
+            serve_finish_child(pid, childExitStatus, &usage);
+        }
+        else{
+            finish_child(jobs, pid, childExitStatus, &usage);
+        }
+    }
+    if(zygote_fd != -1){
+        reap_zygote(jobs);
+    }
+    drain_output(jobs);
+    expire_deadlines(jobs);
+    admit_jobs(jobs); //Start held background jobs if that freed up room
+}
+
+/**
+ * This function should block until a child may have finished, either a
+ * SIGCHLD, an exit report from the zygote or a deadline, then reap.
+ * Background output that arrives meanwhile is drained too. While jobs are held for admission
+ * it wakes up every ADMIT_RECHECK_MS to re-check the limits.
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void wait_for_children(struct job_table* jobs){
+    struct pollfd polls[4] = {{jobs->sigchld_fd, POLLIN, 0}, {jobs->epoll_fd, POLLIN, 0}, {jobs->timer_fd, POLLIN, 0}, {zygote_fd, POLLIN, 0}};
+    int timeout = jobs->queue_head != NULL ? ADMIT_RECHECK_MS : -1;
+
+    if(zygote_num_pending > 0){ //Exit reports already read while admitting a job
+        timeout = 0;
+    }
+    poll(polls, zygote_fd != -1 ? 4 : 3, timeout); //EINTR from SIGTSTP just goes around again
+    reap_children(jobs);
+}
+
+/**
+ * This function should block until every stage of a job has finished.
+ * Background jobs that finish meanwhile are reaped right away too.
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job to wait for
+ */
+void wait_for_job(struct job_table* jobs, struct job* job){
+    reap_children(jobs);
+    while(!job->done){
+        wait_for_children(jobs);
+    }
+}
+
+/**
+ * This function should free every job and the table itself
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void free_job_table(struct job_table* jobs){
+    for(int i = 0; i < jobs->num_jobs; i++){
+        release_job_output(jobs, jobs->jobs[i]);
+        free(jobs->jobs[i]->output.data);
+        free(jobs->jobs[i]->placement);
+        free(jobs->jobs[i]);
+    }
+    free(jobs->jobs);
+    free(jobs->index);
+    free(jobs->deadlines);
+    close(jobs->sigchld_fd);
+    close(jobs->epoll_fd);
+    close(jobs->timer_fd);
+    memset(jobs, 0, sizeof(struct job_table));
+}
+
+/**
+ * This function should copy a finished job's status and resource usage into
+ * a record that outlives the job
+ * 
+ * Params:
+ *   job - finished job
+ *   record - record to fill in
+ */
+void record_job_usage(struct job* job, struct job_usage* record){
+    record->valid = 1;
+    record->pid = job->pid;
+    record->status = job->status;
+    record->real = (job->end.tv_sec - job->start.tv_sec) + (job->end.tv_nsec - job->start.tv_nsec) / 1e9;
+    record->usage = job->usage;
+    record->timed_out = job->timed_out;
+    record->timeout = job->timeout;
+}
+
+/**
+ * This function should display a job's wall-clock time, CPU times, max RSS
+ * and context switches on one line
+ * 
+ * Params:
+ *   record - recorded job usage
+ */
+void print_job_usage(struct job_usage* record){
+    struct rusage* usage = &record->usage;
+    printf("real %.3fs user %.3fs sys %.3fs maxrss %ldKB ctxsw %ld voluntary %ld involuntary", record->real,
+        usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6, usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+        usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+    if(record->timed_out != 0){
+        printf(" (timed out after %gs)", record->timeout);
+    }
+    printf("\n");
+}
@@ -0,0 +1,237 @@
+#include "smallsh.h"
+
+struct metrics metrics = {.file = NULL, .interval = METRICS_INTERVAL_DEFAULT}; //Updated with relaxed atomics, see METRIC_ADD
+
+/**
+ * This function should read where to write the metrics file from the
+ * SMALLSH_METRICS environment variable and how often, in seconds or a
+ * duration like "1m", from SMALLSH_METRICS_INTERVAL, at least
+ * METRICS_INTERVAL_MIN so the daemon's loop never spins. The file is in
+ * Prometheus text format, replaced atomically so a scraper (node_exporter's
+ * textfile collector, for one) never reads half of it.
+ */
+void set_metrics(void){
+    char* path = getenv("SMALLSH_METRICS");
+    char* interval = getenv("SMALLSH_METRICS_INTERVAL");
+
+    if(path != NULL && path[0] != '\0'){
+        metrics.file = path;
+    }
+    if(interval != NULL){
+        parse_duration(interval, &metrics.interval);
+    }
+    if(metrics.interval < METRICS_INTERVAL_MIN){
+        metrics.interval = METRICS_INTERVAL_MIN;
+    }
+}
+
+/**
+ * This function should find a value's histogram bucket. Buckets are
+ * log-linear like an HDR histogram: every power of two from 1.024us up is
+ * split into METRIC_SUB_BUCKETS equal parts, so a bucket's bound is at most
+ * 25% over any value in it. Returns METRIC_BUCKETS for values past the last one.
+ * 
+ * Params:
+ *   nanoseconds - value to place
+ */
+int metric_bucket(unsigned long nanoseconds){
+    if(nanoseconds <= (1UL << METRIC_MIN_SHIFT)){
+        return 0;
+    }
+    nanoseconds--; //A value on a bound belongs to the bucket it ends, as "le" says
+    int shift = 63 - __builtin_clzl(nanoseconds);
+    if(shift >= METRIC_MAX_SHIFT){
+        return METRIC_BUCKETS;
+    }
+    int sub = (nanoseconds >> (shift - METRIC_SUB_BITS)) & (METRIC_SUB_BUCKETS - 1);
+    return 1 + (shift - METRIC_MIN_SHIFT) * METRIC_SUB_BUCKETS + sub;
+}
+
+/**
+ * This function should find the upper bound of a histogram bucket, in
+ * nanoseconds
+ * 
+ * Params:
+ *   bucket - index from metric_bucket()
+ */
+unsigned long metric_bucket_bound(int bucket){
+    if(bucket == 0){
+        return 1UL << METRIC_MIN_SHIFT;
+    }
+    int shift = METRIC_MIN_SHIFT + (bucket - 1) / METRIC_SUB_BUCKETS;
+    int sub = (bucket - 1) % METRIC_SUB_BUCKETS;
+    return (1UL << shift) + (sub + 1) * (1UL << (shift - METRIC_SUB_BITS));
+}
+
+/**
+ * This function should add one value to a histogram. Each field is its own
+ * atomic add, so it never locks; a reader can see count and sum a value
+ * apart, which Prometheus tolerates.
+ * 
+ * Params:
+ *   histogram - histogram to add to
+ *   nanoseconds - value to add
+ */
+void record_latency(struct metric_histogram* histogram, unsigned long nanoseconds){
+    int bucket = metric_bucket(nanoseconds);
+    if(bucket < METRIC_BUCKETS){
+        METRIC_ADD(histogram->buckets[bucket], 1);
+    }
+    METRIC_ADD(histogram->count, 1);
+    METRIC_ADD(histogram->sum, nanoseconds);
+}
+
+/**
+ * This function should add the time since start to a histogram
+ * 
+ * Params:
+ *   histogram - histogram to add to
+ *   start - CLOCK_MONOTONIC when the timed step began
+ */
+void record_since(struct metric_histogram* histogram, struct timespec* start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long nanoseconds = (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+    record_latency(histogram, nanoseconds > 0 ? nanoseconds : 0);
+}
+
+/**
+ * This function should count a command line the shell ran, and whether a
+ * built-in ran it. Comments and blank lines aren't counted. Fast path
+ * built-ins are counted by run_builtin(), external jobs by add_job().
+ * 
+ * Params:
+ *   args - the line's args
+ *   last_cmd - 0 if a built-in ran it
+ */
+void count_command(char** args, int last_cmd){
+    if(args[0][0] == '#' || args[0][0] == '\0'){
+        return;
+    }
+    METRIC_ADD(metrics.commands, 1);
+    if(last_cmd == 0){
+        METRIC_ADD(metrics.builtins, 1);
+    }
+}
+
+/**
+ * This function should count the background jobs running: every client's
+ * in the daemon, or the shell's own
+ * 
+ * Params:
+ *   jobs - shell's job table, unused in the daemon
+ */
+int background_jobs_running(struct job_table* jobs){
+    int running = 0;
+
+    if(server == NULL){
+        return jobs->num_background_running;
+    }
+    for(int i = 0; i < server->num_clients; i++){
+        running += server->clients[i]->jobs.num_background_running;
+    }
+    return running;
+}
+
+/**
+ * This function should write one histogram in Prometheus text format:
+ * cumulative buckets with their bound in seconds, then sum and count
+ * 
+ * Params:
+ *   out - stream to write to
+ *   name - metric name
+ *   help - HELP text
+ *   histogram - histogram to write
+ */
+void print_histogram(FILE* out, char* name, char* help, struct metric_histogram* histogram){
+    unsigned long cumulative = 0;
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for(int i = 0; i < METRIC_BUCKETS; i++){
+        cumulative += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        fprintf(out, "%s_bucket{le=\"%.9g\"} %lu\n", name, metric_bucket_bound(i) / 1e9, cumulative);
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, __atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+    fprintf(out, "%s_sum %.9f\n", name, __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) / 1e9);
+    fprintf(out, "%s_count %lu\n", name, __atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+}
+
+/**
+ * This function should write every metric in Prometheus text format
+ * 
+ * Params:
+ *   out - stream to write to
+ *   jobs - shell's job table, for the background job gauge
+ */
+void print_metrics(FILE* out, struct job_table* jobs){
+    struct metric_counter{
+        char* name;
+        char* help;
+        unsigned long* value;
+    } counters[] = {
+        {"smallsh_commands_total", "Command lines run.", &metrics.commands},
+        {"smallsh_builtin_commands_total", "Command lines run by a built-in, in the shell's process.", &metrics.builtins},
+        {"smallsh_external_commands_total", "Jobs launched as external processes, a pipeline counts once.", &metrics.externals},
+        {"smallsh_background_jobs_started_total", "Background jobs started.", &metrics.background_started},
+    };
+
+    for(size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++){
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", counters[i].name, counters[i].help, counters[i].name,
+            counters[i].name, __atomic_load_n(counters[i].value, __ATOMIC_RELAXED));
+    }
+    fprintf(out, "# HELP smallsh_signals_total Signals caught by the shell.\n# TYPE smallsh_signals_total counter\n");
+    fprintf(out, "smallsh_signals_total{signal=\"SIGTSTP\"} %lu\n", __atomic_load_n(&metrics.sigtstp, __ATOMIC_RELAXED));
+    fprintf(out, "# HELP smallsh_background_jobs Background jobs running.\n# TYPE smallsh_background_jobs gauge\n");
+    fprintf(out, "smallsh_background_jobs %d\n", background_jobs_running(jobs));
+    print_histogram(out, "smallsh_spawn_seconds", "Time to launch one process, fork/posix_spawn/zygote through exec.", &metrics.spawn);
+    print_histogram(out, "smallsh_wait_seconds", "Time a foreground job ran before the shell had its status.", &metrics.wait);
+    print_histogram(out, "smallsh_reap_lag_seconds", "Time from a background job being reaped to its report by report_background_processes().", &metrics.reap_lag);
+}
+
+/**
+ * This function should rewrite the metrics file if SMALLSH_METRICS is set
+ * and the interval has passed. Called after every command line, since
+ * nothing changes while the shell waits for the next one. The file is
+ * written next to its final name and renamed over it.
+ * 
+ * Params:
+ *   jobs - shell's job table, for the background job gauge
+ *   force - 1 to write even if the interval hasn't passed, at exit
+ */
+void write_metrics_file(struct job_table* jobs, int force){
+    struct timespec now;
+    char temp_path[PATH_MAX];
+
+    if(metrics.file == NULL){
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - metrics.written_at.tv_sec) + (now.tv_nsec - metrics.written_at.tv_nsec) / 1e9;
+    if(!force && metrics.written_at.tv_sec != 0 && elapsed < metrics.interval){
+        return;
+    }
+    metrics.written_at = now;
+
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", metrics.file, getpid());
+    FILE* out = fopen(temp_path, "w");
+    if(out == NULL){
+        return;
+    }
+    print_metrics(out, jobs);
+    if(fclose(out) != 0 || rename(temp_path, metrics.file) == -1){
+        unlink(temp_path);
+    }
+}
+
+/**
+ * This function should handle the metrics built-in command, printing every
+ * metric in Prometheus text format
+ * 
+ * Params:
+ *   jobs - shell's job table, for the background job gauge
+ */
+void metrics_execute(struct job_table* jobs){
+    print_metrics(stdout, jobs);
+    fflush(stdout);
+}
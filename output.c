@@ -0,0 +1,367 @@
+#include "smallsh.h"
+
+size_t output_ring_size = OUTPUT_RING_DEFAULT; //Max bytes kept per background job, 0 sends output to /dev/null
+
+/**
+ * This function should set output_ring_size from the SMALLSH_OUTPUT_BUFFER
+ * environment variable (bytes). 0 turns capturing off, so background output
+ * goes to /dev/null.
+ */
+void set_output_capture(void){
+    char* size = getenv("SMALLSH_OUTPUT_BUFFER");
+    if(size != NULL && isdigit((unsigned char)size[0])){
+        output_ring_size = strtoul(size, NULL, 10);
+    }
+}
+
+/**
+ * This function should append captured bytes to a ring. The ring grows
+ * geometrically up to output_ring_size, after that the oldest bytes are
+ * overwritten. Since it only wraps once it is full size, start is 0 while
+ * it grows.
+ * 
+ * Params:
+ *   ring - ring to append to
+ *   data - bytes to append
+ *   length - number of bytes
+ */
+void ring_write(struct output_ring* ring, char* data, size_t length){
+    ring->total += length;
+    if(ring->length + length > ring->capacity && ring->capacity < output_ring_size){
+        size_t capacity = ring->capacity == 0 ? 4096 : ring->capacity;
+        while(capacity < ring->length + length && capacity < output_ring_size){
+            capacity *= 2;
+        }
+        if(capacity > output_ring_size){
+            capacity = output_ring_size;
+        }
+        ring->data = realloc(ring->data, capacity);
+        ring->capacity = capacity;
+    }
+
+    if(length >= ring->capacity){ //Only the newest bytes fit
+        data += length - ring->capacity;
+        length = ring->capacity;
+        ring->start = 0;
+        ring->length = 0;
+    }
+    size_t end = (ring->start + ring->length) % ring->capacity;
+    size_t first = length < ring->capacity - end ? length : ring->capacity - end;
+    memcpy(ring->data + end, data, first);
+    memcpy(ring->data, data + first, length - first);
+
+    ring->length += length;
+    if(ring->length > ring->capacity){ //Overwrote the oldest bytes
+        ring->start = (ring->start + ring->length - ring->capacity) % ring->capacity;
+        ring->length = ring->capacity;
+    }
+}
+
+/**
+ * This function should print a ring's bytes to stdout, oldest first
+ * 
+ * Params:
+ *   ring - ring to print
+ */
+void ring_print(struct output_ring* ring){
+    if(ring->length == 0){
+        return;
+    }
+    size_t first = ring->length < ring->capacity - ring->start ? ring->length : ring->capacity - ring->start;
+    fwrite(ring->data + ring->start, 1, first, stdout);
+    fwrite(ring->data, 1, ring->length - first, stdout);
+}
+
+/**
+ * This function should start capturing a background job's output from the
+ * read end of its pipe. The pipe is made non-blocking and watched by the job
+ * table's epoll instance, which hands back the job when it is readable.
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - background job
+ *   fd - read end of the job's capture pipe
+ */
+void capture_job_output(struct job_table* jobs, struct job* job, int fd){
+    struct epoll_event event = {0};
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    event.events = EPOLLIN;
+    event.data.ptr = job;
+    if(epoll_ctl(jobs->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1){
+        close(fd);
+        return;
+    }
+    job->output_fd = fd;
+    jobs->num_capturing++;
+}
+
+/**
+ * This function should read everything waiting in a job's capture pipe into
+ * its ring, without blocking. The pipe is closed at EOF, once every process
+ * holding the write end has exited.
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job to read from
+ */
+void read_job_output(struct job_table* jobs, struct job* job){
+    char chunk[OUTPUT_CHUNK];
+
+    while(job->output_fd != -1){
+        ssize_t num_read = read(job->output_fd, chunk, sizeof(chunk));
+        if(num_read > 0){
+            ring_write(&job->output, chunk, num_read);
+            continue;
+        }
+        if(num_read == -1 && errno == EINTR){
+            continue;
+        }
+        if(num_read == -1 && errno == EAGAIN){
+            return;
+        }
+        release_job_output(jobs, job); //EOF or error, keep the ring
+    }
+}
+
+/**
+ * This function should read every capture pipe that has data, without
+ * blocking
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void drain_output(struct job_table* jobs){
+    struct epoll_event events[64];
+    int num_events = 64;
+
+    while(jobs->num_capturing > 0 && num_events == 64){
+        num_events = epoll_wait(jobs->epoll_fd, events, 64, 0);
+        for(int i = 0; i < num_events; i++){
+            read_job_output(jobs, events[i].data.ptr);
+        }
+    }
+}
+
+/**
+ * This function should stop capturing a job's output, closing its pipe. The
+ * pipe is removed from epoll explicitly, since relay children forked by the
+ * shell may still hold a copy of it.
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job to stop capturing
+ */
+void release_job_output(struct job_table* jobs, struct job* job){
+    if(job->output_fd == -1){
+        return;
+    }
+    epoll_ctl(jobs->epoll_fd, EPOLL_CTL_DEL, job->output_fd, NULL);
+    close(job->output_fd);
+    job->output_fd = -1;
+    jobs->num_capturing--;
+}
+
+/**
+ * This function should keep a reported background job in the table so its
+ * output can be read with "output". Only MAX_KEPT_OUTPUT jobs are kept, the
+ * oldest is freed to make room.
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - finished, reported job
+ */
+void keep_job_output(struct job_table* jobs, struct job* job){
+    job->kept = 1;
+    job->next_kept = NULL;
+    if(jobs->kept_tail == NULL){
+        jobs->kept_head = job;
+    }
+    else{
+        jobs->kept_tail->next_kept = job;
+    }
+    jobs->kept_tail = job;
+    jobs->num_kept++;
+
+    if(jobs->num_kept > MAX_KEPT_OUTPUT){
+        struct job* oldest = jobs->kept_head;
+        unkeep_job_output(jobs, oldest);
+        remove_job(jobs, oldest);
+    }
+}
+
+/**
+ * This function should take a job off the list of jobs kept for their output
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - kept job
+ */
+void unkeep_job_output(struct job_table* jobs, struct job* job){
+    struct job* previous = NULL;
+    struct job* current = jobs->kept_head;
+
+    while(current != NULL && current != job){
+        previous = current;
+        current = current->next_kept;
+    }
+    if(current == NULL){
+        return;
+    }
+    if(previous == NULL){
+        jobs->kept_head = job->next_kept;
+    }
+    else{
+        previous->next_kept = job->next_kept;
+    }
+    if(jobs->kept_tail == job){
+        jobs->kept_tail = previous;
+    }
+    job->kept = 0;
+    jobs->num_kept--;
+}
+
+/**
+ * This function should wait for a line on stdin while still draining
+ * background output, so a chatty job doesn't block on a full pipe while the
+ * shell waits for input, whether from a terminal or a pipe that may itself
+ * be waiting on the job. Held background jobs are admitted meanwhile too,
+ * re-checking every ADMIT_RECHECK_MS, and background jobs whose deadline
+ * passes are signalled on time. Lines are read by read_input_line(), which
+ * never reads past the newline, so poll() sees every line still to come.
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void wait_for_input(struct job_table* jobs){
+    struct pollfd polls[4] = {{STDIN_FILENO, POLLIN, 0}, {jobs->epoll_fd, POLLIN, 0}, {jobs->sigchld_fd, POLLIN, 0}, {jobs->timer_fd, POLLIN, 0}};
+
+    if(jobs->num_capturing == 0 && jobs->queue_head == NULL && jobs->num_deadlines == 0){
+        return;
+    }
+    while(jobs->num_capturing > 0 || jobs->queue_head != NULL || jobs->num_deadlines > 0){
+        if(poll(polls, 4, jobs->queue_head != NULL ? ADMIT_RECHECK_MS : -1) == -1){
+            continue; //EINTR from SIGTSTP
+        }
+        if(polls[0].revents != 0){
+            return;
+        }
+        if(jobs->queue_head != NULL || jobs->num_deadlines > 0){
+            reap_children(jobs); //Frees up room and admits, and acts on deadlines
+        }
+        else{
+            drain_output(jobs);
+        }
+    }
+}
+
+/**
+ * This function should compare two jobs by start time for qsort()
+ * 
+ * Params:
+ *   a - pointer to the first job pointer
+ *   b - pointer to the second job pointer
+ */
+int compare_job_start(const void* a, const void* b){
+    const struct job* x = *(struct job* const*)a;
+    const struct job* y = *(struct job* const*)b;
+    if(x->start.tv_sec != y->start.tv_sec){
+        return x->start.tv_sec < y->start.tv_sec ? -1 : 1;
+    }
+    return (x->start.tv_nsec > y->start.tv_nsec) - (x->start.tv_nsec < y->start.tv_nsec);
+}
+
+/**
+ * This function should handle the jobs built-in command, listing every
+ * background job still running or kept for its output, oldest first, with
+ * its pid, state, runtime, how much output it captured and the CPUs it was
+ * placed on. Jobs held for
+ * admission follow, in the order they will start.
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void jobs_execute(struct job_table* jobs){
+    struct job** listed = malloc((jobs->num_jobs + 1) * sizeof(struct job*));
+    int num_listed = 0;
+    struct timespec now;
+    char state[32];
+
+    reap_children(jobs);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for(int i = 0; i < jobs->num_jobs; i++){
+        if(jobs->jobs[i]->background){
+            listed[num_listed++] = jobs->jobs[i];
+        }
+    }
+    qsort(listed, num_listed, sizeof(struct job*), compare_job_start);
+
+    for(int i = 0; i < num_listed; i++){
+        struct job* job = listed[i];
+        struct timespec* end = job->done ? &job->end : &now;
+        double runtime = (end->tv_sec - job->start.tv_sec) + (end->tv_nsec - job->start.tv_nsec) / 1e9;
+        if(!job->done){
+            strcpy(state, job->timed_out != 0 ? "timing out" : "running");
+        }
+        else if(job->timed_out != 0){
+            snprintf(state, sizeof(state), "timed out after %gs", job->timeout);
+        }
+        else if(WIFSIGNALED(job->status)){
+            snprintf(state, sizeof(state), "terminated by signal %d", WTERMSIG(job->status));
+        }
+        else{
+            snprintf(state, sizeof(state), "exit value %d", WEXITSTATUS(job->status));
+        }
+        printf("%-8d %-24s %9.3fs %10zu bytes  %s\n", job->pid, state, runtime, job->output.total, job->placement != NULL ? job->placement->label : "-");
+    }
+    for(struct queued_job* queued = jobs->queue_head; queued != NULL; queued = queued->next){
+        double waited = (now.tv_sec - queued->queued_at.tv_sec) + (now.tv_nsec - queued->queued_at.tv_nsec) / 1e9;
+        snprintf(state, sizeof(state), "queued as job %d", queued->id);
+        printf("%-8s %-24s %9.3fs %10d bytes  %s\n", "-", state, waited, 0, "-");
+    }
+    fflush(stdout);
+    free(listed);
+}
+
+/**
+ * This function should handle the output built-in command, printing what a
+ * background job has written to stdout and stderr so far. Once a finished
+ * job's output has been read, the job and its buffer are freed. Returns 1 if
+ * there is no such job.
+ * 
+ * Params:
+ *   input - struct holding command args
+ *   jobs - job table
+ */
+int output_execute(struct command* input, struct job_table* jobs){
+    struct job* job = NULL;
+
+    if(input->num_args < 2){
+        printf("bash: output: usage: output pid\n");
+        return 1;
+    }
+    pid_t pid = atoi(input->args[1]);
+    for(int i = 0; i < jobs->num_jobs; i++){
+        if(jobs->jobs[i]->background && jobs->jobs[i]->pid == pid){
+            job = jobs->jobs[i];
+            break;
+        }
+    }
+    if(job == NULL){
+        printf("bash: output: %s: no such job\n", input->args[1]);
+        return 1;
+    }
+
+    read_job_output(jobs, job);
+    if(job->output.total > job->output.length){
+        printf("output: first %zu bytes were dropped\n", job->output.total - job->output.length);
+    }
+    ring_print(&job->output);
+    fflush(stdout);
+
+    if(job->kept){ //Read and reported, nothing left to keep it for
+        unkeep_job_output(jobs, job);
+        remove_job(jobs, job);
+    }
+    return 0;
+}
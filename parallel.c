@@ -0,0 +1,258 @@
+#include "smallsh.h"
+
+volatile sig_atomic_t parallel_interrupted = 0; //Set by SIGINT while parallel runs, stops new launches
+
+/**
+ * This function should be called when a SIGINT is caught while parallel is
+ * running. The running commands get it from the terminal too; no more are
+ * started.
+ * 
+ * Params:
+ *   signo - signal number
+ */
+void catch_parallel_SIGINT(int signo){
+    parallel_interrupted = 1;
+}
+
+/**
+ * This function should build one command from the parallel template by
+ * replacing every "{}" with the argument line, or appending the line as the
+ * last arg (before any redirection) if the template has no "{}". The
+ * strings are built in one reusable scratch buffer, so nothing is allocated
+ * per job once the buffer has grown.
+ * 
+ * Params:
+ *   template - NULL-terminated template args
+ *   line - argument line to substitute
+ *   argv - array to hold the built args, NULL-terminated
+ *   scratch - pointer to the scratch buffer (by reference)
+ *   scratch_size - pointer to the scratch buffer's size (by reference)
+ */
+void build_parallel_command(char** template, char* line, char** argv, char** scratch, size_t* scratch_size){
+    size_t line_length = strlen(line);
+    size_t needed = line_length + 1;
+    int has_placeholder = 0;
+    int append_at = -1;
+    int num_args = 0;
+
+    //First pass to size the buffer
+    for(int i = 0; template[i] != NULL; i++){
+        needed += strlen(template[i]) + 1;
+        for(char* found = strstr(template[i], "{}"); found != NULL; found = strstr(found + 2, "{}")){
+            needed += line_length;
+            has_placeholder = 1;
+        }
+        if(append_at == -1 && i > 0 && (strcmp(template[i], "<") == 0 || strcmp(template[i], ">") == 0)){
+            append_at = i;
+        }
+    }
+    if(needed > *scratch_size){
+        *scratch_size = needed * 2;
+        *scratch = realloc(*scratch, *scratch_size);
+    }
+
+    char* ptr = *scratch;
+    for(int i = 0; template[i] != NULL; i++){
+        if(!has_placeholder && i == append_at){ //Line goes before the redirection
+            argv[num_args++] = strcpy(ptr, line);
+            ptr += line_length + 1;
+        }
+        argv[num_args++] = ptr;
+        char* src = template[i];
+        char* found;
+        while((found = strstr(src, "{}")) != NULL){
+            memcpy(ptr, src, found - src);
+            ptr += found - src;
+            memcpy(ptr, line, line_length);
+            ptr += line_length;
+            src = found + 2;
+        }
+        ptr = stpcpy(ptr, src) + 1;
+    }
+    if(!has_placeholder && append_at == -1){
+        argv[num_args++] = strcpy(ptr, line);
+    }
+    argv[num_args] = NULL;
+}
+
+/**
+ * This function should record a finished parallel job's status in the
+ * summary counts
+ * 
+ * Params:
+ *   status - raw wait status, or -1 if the command never launched
+ *   exit_counts - count of jobs per exit value
+ *   signal_counts - count of jobs per terminating signal
+ */
+void count_parallel_status(int status, int* exit_counts, int* signal_counts){
+    if(status == -1){ //Never ran, same as a child that called exit(1)
+        exit_counts[1]++;
+    }
+    else if(WIFSIGNALED(status)){
+        signal_counts[WTERMSIG(status) % NSIG]++;
+    }
+    else{
+        exit_counts[WEXITSTATUS(status)]++;
+    }
+}
+
+/**
+ * This function should handle the parallel built-in command. Each line read
+ * from stdin (or the -a file) is substituted into the command template and
+ * run with launch_command(), keeping exactly N children running until the
+ * input runs out or SIGINT arrives. Commands read /dev/null when the lines
+ * come from stdin, so they can't eat the lines still to come, as in xargs.
+ * It then prints how many jobs ended with each status. Returns 0 if every
+ * job exited with 0, else 1.
+ * 
+ * Params:
+ *   input - struct holding command args
+ *   jobs - job table
+ */
+int parallel_execute(struct command* input, struct job_table* jobs){
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    FILE* arg_file = stdin;
+    int i = 1;
+
+    //Built-ins run in the foreground
+    if(input->num_args > 1 && strcmp(input->args[input->num_args - 1], "&") == 0){
+        input->args[input->num_args - 1] = NULL;
+        input->num_args--;
+    }
+
+    //Options come before the template
+    for(; i < input->num_args && input->args[i][0] == '-'; i++){
+        if(strncmp(input->args[i], "-j", 2) == 0){
+            char* value = input->args[i][2] != '\0' ? &input->args[i][2] : input->args[++i];
+            max_jobs = value != NULL ? atol(value) : 0;
+        }
+        else if(strcmp(input->args[i], "-a") == 0 && input->args[i + 1] != NULL){
+            i++;
+            if(arg_file != stdin){
+                fclose(arg_file);
+            }
+            arg_file = fopen(input->args[i], "r");
+            if(arg_file == NULL){
+                file_directory_error(input->args[i]);
+                return 1;
+            }
+        }
+        else{
+            break;
+        }
+    }
+    if(i >= input->num_args || max_jobs < 1){
+        printf("bash: parallel: usage: parallel [-j jobs] [-a file] command [args...]\n");
+        if(arg_file != stdin){
+            fclose(arg_file);
+        }
+        return 1;
+    }
+    char** template = &input->args[i];
+
+    struct job** running = calloc(max_jobs, sizeof(struct job*));
+    char** argv = malloc((input->num_args + 2) * sizeof(char*));
+    char* scratch = NULL;
+    size_t scratch_size = 0;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length = 0;
+    int exit_counts[256] = {0};
+    int signal_counts[NSIG] = {0};
+    int num_running = 0;
+    int num_total = 0;
+    int null_fd = arg_file == stdin ? open("/dev/null", O_RDONLY | O_CLOEXEC) : -1;
+    struct sigaction interrupt_action = {0}, saved_action;
+
+    interrupt_action.sa_handler = catch_parallel_SIGINT;
+    sigfillset(&interrupt_action.sa_mask);
+    parallel_interrupted = 0;
+    sigaction(SIGINT, &interrupt_action, &saved_action); //Children get the default action back when they exec
+
+    while(1){
+        //Fill every free slot while there is input
+        while(num_running < max_jobs && line_length != -1 && !parallel_interrupted){
+            line_length = getline(&line, &line_size, arg_file);
+            if(line_length == -1){
+                break;
+            }
+            if(line_length > 0 && line[line_length - 1] == '\n'){
+                line[--line_length] = '\0';
+            }
+            if(line_length == 0){ //Nothing to substitute
+                continue;
+            }
+
+            build_parallel_command(template, line, argv, &scratch, &scratch_size);
+            num_total++;
+            fflush(stdout);
+            pid_t spawnPid = launch_command(argv, 0, null_fd, -1, -1);
+            struct job* job = spawnPid == -1 ? NULL : add_job(jobs, &spawnPid, 1, 0);
+            if(job == NULL){
+                count_parallel_status(-1, exit_counts, signal_counts);
+                continue;
+            }
+            for(int slot = 0; slot < max_jobs; slot++){
+                if(running[slot] == NULL){
+                    running[slot] = job;
+                    break;
+                }
+            }
+            num_running++;
+        }
+        if(num_running == 0){
+            break;
+        }
+
+        //Wait for at least one slot to free up
+        int num_finished = 0;
+        reap_children(jobs);
+        while(1){
+            for(int slot = 0; slot < max_jobs; slot++){
+                if(running[slot] != NULL && running[slot]->done){
+                    count_parallel_status(running[slot]->status, exit_counts, signal_counts);
+                    remove_job(jobs, running[slot]);
+                    running[slot] = NULL;
+                    num_running--;
+                    num_finished++;
+                }
+            }
+            if(num_finished > 0){
+                break;
+            }
+            wait_for_children(jobs);
+        }
+    }
+
+    sigaction(SIGINT, &saved_action, NULL);
+    if(null_fd != -1){
+        close(null_fd);
+    }
+
+    //Summary of how every job ended
+    int failed = num_total - exit_counts[0];
+    printf("parallel: %d jobs, %d failed\n", num_total, failed);
+    for(int status = 0; status < 256; status++){
+        if(exit_counts[status] > 0){
+            printf("  %d exit value %d\n", exit_counts[status], status);
+        }
+    }
+    for(int signo = 1; signo < NSIG; signo++){
+        if(signal_counts[signo] > 0){
+            printf("  %d terminated by signal %d\n", signal_counts[signo], signo);
+        }
+    }
+    fflush(stdout);
+
+    if(arg_file != stdin){
+        fclose(arg_file);
+    }
+    else{
+        clearerr(stdin); //Interactive shell keeps reading after ^D
+    }
+    free(line);
+    free(scratch);
+    free(argv);
+    free(running);
+    return failed > 0;
+}
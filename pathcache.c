@@ -0,0 +1,219 @@
+#include "smallsh.h"
+
+#define PATH_TABLE_SIZE 256 //Number of buckets, scripts only use a few dozen commands
+
+struct path_entry* path_table[PATH_TABLE_SIZE]; //Command name -> absolute path
+char* cached_PATH = NULL; //Value of PATH the table was built from
+
+/**
+ * This function should hash a command name into a bucket index (djb2)
+ * 
+ * Params:
+ *   name - command name to hash
+ */
+unsigned int path_hash(char* name){
+    unsigned int hash = 5381;
+    for(; *name != '\0'; name++){
+        hash = hash * 33 + (unsigned char)*name;
+    }
+    return hash % PATH_TABLE_SIZE;
+}
+
+/**
+ * This function should free every entry in the PATH cache
+ */
+void clear_path_cache(void){
+    for(int i = 0; i < PATH_TABLE_SIZE; i++){
+        struct path_entry* entry = path_table[i];
+        while(entry != NULL){
+            struct path_entry* next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        path_table[i] = NULL;
+    }
+}
+
+/**
+ * This function should clear the cache if PATH has changed since the table
+ * was built, since every cached path may now resolve somewhere else
+ */
+void check_PATH_changed(void){
+    char* PATH = getenv("PATH");
+    if(PATH == NULL){
+        PATH = "";
+    }
+    if(cached_PATH == NULL || strcmp(cached_PATH, PATH) != 0){
+        clear_path_cache();
+        free(cached_PATH);
+        cached_PATH = strdup(PATH);
+    }
+}
+
+/**
+ * This function should walk the directories in PATH looking for an
+ * executable regular file with the given name, the same way execvp() does.
+ * Returns a newly allocated path, or NULL if nothing was found.
+ * 
+ * Params:
+ *   name - command name to search for
+ */
+char* search_path(char* name){
+    char* PATH = getenv("PATH");
+    char candidate[PATH_MAX];
+    struct stat info;
+
+    if(PATH == NULL){
+        PATH = "/bin:/usr/bin"; //Same default as execvp()
+    }
+
+    while(1){
+        char* end = strchr(PATH, ':');
+        int dir_len = end != NULL ? end - PATH : (int)strlen(PATH);
+        if(dir_len == 0){ //Empty entry means the current directory
+            snprintf(candidate, sizeof(candidate), "./%s", name);
+        }
+        else{
+            snprintf(candidate, sizeof(candidate), "%.*s/%s", dir_len, PATH, name);
+        }
+
+        if(stat(candidate, &info) == 0 && S_ISREG(info.st_mode) && access(candidate, X_OK) == 0){
+            return strdup(candidate);
+        }
+        if(end == NULL){
+            return NULL;
+        }
+        PATH = end + 1;
+    }
+}
+
+/**
+ * This function should find the cache entry for a command name, or NULL
+ * 
+ * Params:
+ *   name - command name to find
+ */
+struct path_entry* find_path_entry(char* name){
+    struct path_entry* entry = path_table[path_hash(name)];
+    while(entry != NULL && strcmp(entry->name, name) != 0){
+        entry = entry->next;
+    }
+    return entry;
+}
+
+/**
+ * This function should search PATH for a command and add it to the cache.
+ * Returns the new entry, or NULL if the command wasn't found.
+ * 
+ * Params:
+ *   name - command name to add
+ */
+struct path_entry* add_path_entry(char* name){
+    char* path = search_path(name);
+    if(path == NULL){
+        return NULL;
+    }
+
+    unsigned int bucket = path_hash(name);
+    struct path_entry* entry = malloc(sizeof(struct path_entry));
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 0;
+    entry->next = path_table[bucket];
+    path_table[bucket] = entry;
+    return entry;
+}
+
+/**
+ * This function should return the path to exec for a command name, searching
+ * PATH only on a cache miss. Names containing a '/' are used as-is, like
+ * execvp(). Returns NULL if the command can't be found.
+ * 
+ * Params:
+ *   name - command name (args[0])
+ */
+char* lookup_command_path(char* name){
+    if(strchr(name, '/') != NULL){
+        return name;
+    }
+
+    check_PATH_changed();
+    struct path_entry* entry = find_path_entry(name);
+    if(entry == NULL){
+        entry = add_path_entry(name);
+        if(entry == NULL){
+            return NULL;
+        }
+    }
+    entry->hits++;
+    return entry->path;
+}
+
+/**
+ * This function should drop a command from the cache, used when its cached
+ * binary has disappeared. Returns 1 if there was an entry to drop.
+ * 
+ * Params:
+ *   name - command name to drop
+ */
+int forget_command_path(char* name){
+    struct path_entry** link = &path_table[path_hash(name)];
+    while(*link != NULL){
+        if(strcmp((*link)->name, name) == 0){
+            struct path_entry* entry = *link;
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return 1;
+        }
+        link = &(*link)->next;
+    }
+    return 0;
+}
+
+/**
+ * This function should handle the hash built-in command like bash does.
+ * With no args it lists the cache, "hash -r" clears it and "hash name..."
+ * looks up each name and adds it to the cache.
+ * 
+ * Params:
+ *   input - struct holding command args
+ */
+void hash_execute(struct command* input){
+    check_PATH_changed();
+
+    if(input->num_args == 1){ //Just hash... list the table
+        int printed = 0;
+        for(int i = 0; i < PATH_TABLE_SIZE; i++){
+            for(struct path_entry* entry = path_table[i]; entry != NULL; entry = entry->next){
+                if(!printed){
+                    printf("hits\tcommand\n");
+                    printed = 1;
+                }
+                printf("%4d\t%s\n", entry->hits, entry->path);
+            }
+        }
+        if(!printed){
+            printf("hash: hash table empty\n");
+        }
+        return;
+    }
+
+    for(int i = 1; i < input->num_args; i++){
+        if(strcmp(input->args[i], "-r") == 0){
+            clear_path_cache();
+        }
+        else if(strcmp(input->args[i], "&") == 0){ //Built-ins always run in the foreground
+            continue;
+        }
+        else if(strchr(input->args[i], '/') == NULL){
+            forget_command_path(input->args[i]); //hash name re-searches PATH like bash
+            if(add_path_entry(input->args[i]) == NULL){
+                printf("bash: hash: %s: not found\n", input->args[i]);
+            }
+        }
+    }
+}
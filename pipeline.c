@@ -0,0 +1,270 @@
+#include "smallsh.h"
+
+int relay_mode = 0; //1 if relay-only stages (cat, tee) are run with splice()/tee()
+
+/**
+ * This function should split a command's args into pipeline stages at each
+ * "|" token. The "|" tokens are replaced by NULL so each stage is its own
+ * NULL-terminated argv. Returns the number of stages, or -1 on a syntax error.
+ * 
+ * Params:
+ *   input - command struct that holds args
+ *   stages - array to hold a pointer to the first arg of each stage
+ */
+int split_pipeline(struct command* input, char** stages[]){
+    int num_stages = 1;
+    stages[0] = input->args;
+
+    for(int i = 0; i < input->num_args; i++){
+        if(strcmp(input->args[i], "|") != 0){
+            continue;
+        }
+        input->args[i] = NULL; //End the previous stage
+        if(stages[num_stages - 1][0] == NULL || input->args[i + 1] == NULL || num_stages == MAX_STAGES){
+            printf("bash: syntax error near unexpected token `|'\n");
+            fflush(stdout);
+            return -1;
+        }
+        stages[num_stages] = &input->args[i + 1];
+        num_stages++;
+    }
+    return num_stages;
+}
+
+/**
+ * This function should decide if a stage only relays data and can be run
+ * without exec'ing anything. "cat" with no args can relay between any pipe
+ * and fd, "tee" with at most one file needs pipes on both sides for tee().
+ * 
+ * Params:
+ *   args - NULL-terminated stage args
+ *   input_is_pipe - 1 if the stage reads from a pipe
+ *   output_is_pipe - 1 if the stage writes to a pipe
+ */
+int relay_kind(char** args, int input_is_pipe, int output_is_pipe){
+    struct redirection redir;
+
+    if(!relay_mode || (!input_is_pipe && !output_is_pipe)){
+        return RELAY_NONE;
+    }
+    find_redirection(args, &redir);
+    if(redir.redirected){ //Leave redirected stages to the real tools
+        return RELAY_NONE;
+    }
+    if(strcmp(args[0], "cat") == 0 && args[1] == NULL){
+        return RELAY_CAT;
+    }
+    if(strcmp(args[0], "tee") == 0 && (args[1] == NULL || (args[1][0] != '-' && args[2] == NULL))){
+        if(args[1] == NULL){
+            return RELAY_CAT; //tee with no files is just cat
+        }
+        if(input_is_pipe && output_is_pipe){
+            return RELAY_TEE;
+        }
+    }
+    return RELAY_NONE;
+}
+
+/**
+ * This function should move everything from input_fd to output_fd with
+ * splice(), so the bytes never pass through user space. One side must be a
+ * pipe; if the kernel can't splice the other side it falls back to read()
+ * and write().
+ * 
+ * Params:
+ *   input_fd - fd to read from
+ *   output_fd - fd to write to
+ */
+void relay_splice(int input_fd, int output_fd){
+    char buffer[65536];
+    ssize_t num_read;
+
+    while((num_read = splice(input_fd, NULL, output_fd, NULL, RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) != 0){
+        if(num_read == -1 && errno == EINTR){
+            continue;
+        }
+        if(num_read == -1){
+            break;
+        }
+    }
+    if(num_read == 0 || errno != EINVAL){ //Done, or the reader went away
+        return;
+    }
+
+    //Neither side supports splicing with the other, copy the slow way
+    while((num_read = read(input_fd, buffer, sizeof(buffer))) > 0){
+        char* ptr = buffer;
+        while(num_read > 0){
+            ssize_t num_written = write(output_fd, ptr, num_read);
+            if(num_written == -1){
+                return;
+            }
+            ptr += num_written;
+            num_read -= num_written;
+        }
+    }
+}
+
+/**
+ * This function should copy everything from the input pipe to both the
+ * output pipe and a file. tee() duplicates the pipe contents into the output
+ * pipe without consuming them, then splice() moves the same bytes into the
+ * file, so nothing is copied through user space.
+ * 
+ * Params:
+ *   input_fd - pipe to read from
+ *   output_fd - pipe to write to
+ *   file_fd - file to also write to
+ */
+void relay_tee(int input_fd, int output_fd, int file_fd){
+    while(1){
+        ssize_t num_teed = tee(input_fd, output_fd, RELAY_CHUNK, 0);
+        if(num_teed == -1 && errno == EINTR){
+            continue;
+        }
+        if(num_teed <= 0){ //EOF, or the reader went away
+            return;
+        }
+        while(num_teed > 0){ //Consume exactly what was teed
+            ssize_t num_moved = splice(input_fd, NULL, file_fd, NULL, num_teed, SPLICE_F_MOVE);
+            if(num_moved == -1 && errno == EINTR){
+                continue;
+            }
+            if(num_moved <= 0){
+                return;
+            }
+            num_teed -= num_moved;
+        }
+    }
+}
+
+/**
+ * This function should run a relay stage in a forked child instead of
+ * exec'ing cat or tee. Returns the child's pid, or -1 if nothing was launched.
+ * 
+ * Params:
+ *   args - NULL-terminated stage args
+ *   kind - RELAY_CAT or RELAY_TEE
+ *   background - 1 if the pipeline runs in the background
+ *   input_fd - fd to relay from, or -1 for the shell's stdin
+ *   output_fd - fd to relay to, or -1 for the shell's stdout
+ *   unused_fd - pipe end the child inherits but must close, or -1
+ */
+pid_t launch_relay(char** args, int kind, int background, int input_fd, int output_fd, int unused_fd){
+    int file_fd = -1;
+
+    if(kind == RELAY_TEE){
+        file_fd = open(args[1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(file_fd == -1){
+            file_directory_error(args[1]);
+            return -1;
+        }
+    }
+
+    fflush(stdout); //Don't let the child inherit unwritten output
+    pid_t spawnPid = fork();
+    switch(spawnPid){
+        case -1:{perror("Hull Breach!\n"); exit(1); break;}
+        case 0:{
+            signal(SIGINT, background ? SIG_IGN : SIG_DFL);
+            signal(SIGTSTP, SIG_IGN);
+            signal(SIGPIPE, SIG_DFL);
+            sigset_t child_mask; //The shell blocks SIGCHLD (the daemon SIGINT and SIGTERM too), don't keep that
+            sigemptyset(&child_mask);
+            sigprocmask(SIG_SETMASK, &child_mask, NULL);
+            if(unused_fd != -1){ //Holding this open would keep the next stage from seeing EOF
+                close(unused_fd);
+            }
+            if(input_fd == -1){
+                input_fd = STDIN_FILENO;
+            }
+            if(output_fd == -1){
+                output_fd = STDOUT_FILENO;
+            }
+
+            if(kind == RELAY_TEE){
+                relay_tee(input_fd, output_fd, file_fd);
+            }
+            else{
+                relay_splice(input_fd, output_fd);
+            }
+            _exit(0); //Skip stdio, the parent owns those buffers
+        }
+    }
+
+    if(file_fd != -1){
+        close(file_fd);
+    }
+    return spawnPid;
+}
+
+/**
+ * This function should start every stage of a pipeline, connecting each
+ * stage's stdout to the next stage's stdin with a pipe. Background pipelines
+ * read from /dev/null unless they redirect. Their output goes to capture_fd,
+ * the last stage's stdout and every stage's stderr, or to /dev/null if
+ * there is none. A stage that fails to launch gets -1 in pids, the rest of
+ * the pipeline still runs.
+ * 
+ * Params:
+ *   stages - NULL-terminated args for each stage
+ *   num_stages - number of stages
+ *   background - 1 if the pipeline runs in the background
+ *   capture_fd - pipe that captures a background pipeline's output, or -1
+ *   pids - array to hold the pid of each stage
+ */
+void start_pipeline(char** stages[], int num_stages, int background, int capture_fd, pid_t* pids){
+    int input_fd = -1; //Read end of the previous stage's pipe
+    int null_fd = -1;
+
+    fflush(stdout); //Children write straight to fd 1, get ours out first
+    if(background){ //Background processes read from /dev/null
+        null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+        input_fd = null_fd;
+    }
+    int last_output_fd = capture_fd != -1 ? capture_fd : null_fd;
+
+    for(int i = 0; i < num_stages; i++){
+        int pipe_fds[2] = {-1, -1};
+        int output_fd = last_output_fd;
+
+        if(i < num_stages - 1){
+            if(pipe2(pipe_fds, O_CLOEXEC) == -1){
+                perror("Failed to create pipe\n");
+                pids[i] = -1;
+                continue;
+            }
+            output_fd = pipe_fds[1];
+        }
+
+        int kind = relay_kind(stages[i], i > 0, i < num_stages - 1);
+        if(kind != RELAY_NONE){
+            pids[i] = launch_relay(stages[i], kind, background, input_fd, output_fd, pipe_fds[0]);
+        }
+        else{
+            pids[i] = launch_command(stages[i], background, input_fd, output_fd, capture_fd);
+        }
+
+        //The children have their ends now, only keep the read end for the next stage
+        if(input_fd != -1 && input_fd != null_fd){
+            close(input_fd);
+        }
+        if(pipe_fds[1] != -1){
+            close(pipe_fds[1]);
+        }
+        input_fd = pipe_fds[0];
+    }
+
+    if(null_fd != -1){
+        close(null_fd);
+    }
+}
+
+/**
+ * This function should set relay_mode from the SMALLSH_RELAY environment
+ * variable, "splice" turns it on
+ */
+void set_relay_mode(void){
+    char* mode = getenv("SMALLSH_RELAY");
+    relay_mode = mode != NULL && strcmp(mode, "splice") == 0;
+}
@@ -0,0 +1,354 @@
+#include "smallsh.h"
+
+int placement_policy = PLACE_OFF; //How background jobs are spread over CPUs
+int placement_numa = 0; //1 if a placed job's memory is bound to its CPU's node
+struct placement* active_placement = NULL; //Placement of the job being launched, for the zygote
+cpu_set_t placement_allowed; //CPUs the shell itself may run on
+int placement_cpus[CPU_SETSIZE]; //Allowed CPUs in order, for round-robin
+int placement_num_cpus = 0;
+int placement_next = 0; //Round-robin cursor into placement_cpus
+int placement_jobs[CPU_SETSIZE]; //Running background jobs placed on each CPU
+int placement_node[CPU_SETSIZE]; //NUMA node of each CPU, -1 if unknown
+int placement_stat_fd = -1; //Open /proc/stat for least-loaded
+unsigned long long placement_busy[CPU_SETSIZE]; //Busy and total jiffies at the last sample
+int placement_saved_mode = MPOL_DEFAULT; //Shell's own memory policy while a placed job launches
+unsigned long placement_saved_nodes[CPU_SETSIZE / (8 * sizeof(unsigned long))];
+unsigned long long placement_total[CPU_SETSIZE];
+
+/**
+ * This function should set the placement policy from the SMALLSH_PLACEMENT
+ * environment variable: roundrobin or leastloaded, optionally followed by
+ * ",numa" to bind each job's memory to its CPU's node. The CPUs the shell
+ * may run on are read either way, since "@cpus=" works without a policy.
+ */
+void set_placement(void){
+    char* spec = getenv("SMALLSH_PLACEMENT");
+
+    sched_getaffinity(0, sizeof(placement_allowed), &placement_allowed);
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        placement_node[cpu] = -1;
+        if(CPU_ISSET(cpu, &placement_allowed)){
+            placement_cpus[placement_num_cpus++] = cpu;
+        }
+    }
+    if(spec == NULL){
+        return;
+    }
+
+    if(strncmp(spec, "roundrobin", 10) == 0){
+        placement_policy = PLACE_ROUND_ROBIN;
+    }
+    else if(strncmp(spec, "leastloaded", 11) == 0){
+        placement_policy = PLACE_LEAST_LOADED;
+        placement_stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    }
+    if(strstr(spec, ",numa") != NULL){
+        placement_numa = 1;
+        read_cpu_nodes();
+    }
+}
+
+/**
+ * This function should fill placement_node from the cpulist of every node
+ * under /sys/devices/system/node
+ */
+void read_cpu_nodes(void){
+    char path[PATH_MAX];
+    char list[4096];
+    cpu_set_t cpus;
+
+    DIR* nodes = opendir("/sys/devices/system/node");
+    if(nodes == NULL){
+        return;
+    }
+    struct dirent* entry;
+    while((entry = readdir(nodes)) != NULL){
+        if(strncmp(entry->d_name, "node", 4) != 0 || !isdigit((unsigned char)entry->d_name[4])){
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1){
+            continue;
+        }
+        ssize_t num_read = read(fd, list, sizeof(list) - 1);
+        close(fd);
+        if(num_read <= 0){
+            continue;
+        }
+        list[num_read] = '\0';
+        list[strcspn(list, "\n")] = '\0';
+        if(parse_cpu_list(list, &cpus) == -1){
+            continue;
+        }
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+            if(CPU_ISSET(cpu, &cpus)){
+                placement_node[cpu] = atoi(entry->d_name + 4);
+            }
+        }
+    }
+    closedir(nodes);
+}
+
+/**
+ * This function should parse a CPU list like "0-3,6" into a set. Returns
+ * -1 if it is malformed or empty.
+ * 
+ * Params:
+ *   list - CPU list
+ *   cpus - set to fill
+ */
+int parse_cpu_list(char* list, cpu_set_t* cpus){
+    char* ptr = list;
+
+    CPU_ZERO(cpus);
+    while(*ptr != '\0'){
+        char* end;
+        if(!isdigit((unsigned char)*ptr)){
+            return -1;
+        }
+        long first = strtol(ptr, &end, 10);
+        long last = first;
+        if(*end == '-'){
+            if(!isdigit((unsigned char)end[1])){
+                return -1;
+            }
+            last = strtol(end + 1, &end, 10);
+        }
+        if(last < first || last >= CPU_SETSIZE){
+            return -1;
+        }
+        for(long cpu = first; cpu <= last; cpu++){
+            CPU_SET(cpu, cpus);
+        }
+        if(*end == ','){
+            end++;
+        }
+        else if(*end != '\0'){
+            return -1;
+        }
+        ptr = end;
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+/**
+ * This function should write a set back as a CPU list, ranges collapsed
+ * 
+ * Params:
+ *   cpus - set to write
+ *   buffer - output
+ *   size - size of the output
+ */
+void format_cpu_list(cpu_set_t* cpus, char* buffer, size_t size){
+    size_t used = 0;
+
+    buffer[0] = '\0';
+    for(int cpu = 0; cpu < CPU_SETSIZE && used < size; cpu++){
+        if(!CPU_ISSET(cpu, cpus)){
+            continue;
+        }
+        int last = cpu;
+        while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus)){
+            last++;
+        }
+        if(last == cpu){
+            used += snprintf(buffer + used, size - used, "%s%d", used == 0 ? "" : ",", cpu);
+        }
+        else{
+            used += snprintf(buffer + used, size - used, "%s%d-%d", used == 0 ? "" : ",", cpu, last);
+        }
+        cpu = last;
+    }
+}
+
+/**
+ * This function should find the allowed CPU with the fewest of our running
+ * background jobs, ties broken by how busy /proc/stat says each CPU was
+ * since the last placement. Jobs placed moments ago don't show up in
+ * /proc/stat yet, so our own count comes first.
+ */
+int least_loaded_cpu(void){
+    char buffer[65536];
+    double busy[CPU_SETSIZE] = {0};
+
+    ssize_t num_read = placement_stat_fd == -1 ? -1 : pread(placement_stat_fd, buffer, sizeof(buffer) - 1, 0);
+    if(num_read > 0){
+        buffer[num_read] = '\0';
+        char* line = strstr(buffer, "\ncpu");
+        while(line != NULL && strncmp(line + 1, "cpu", 3) == 0){
+            unsigned long long user = 0, nice = 0, system = 0, idle = 0, iowait = 0, irq = 0, softirq = 0, steal = 0;
+            int cpu;
+            if(sscanf(line + 1, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu, &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal) == 9 &&
+                cpu >= 0 && cpu < CPU_SETSIZE){
+                unsigned long long now_busy = user + nice + system + irq + softirq + steal;
+                unsigned long long now_total = now_busy + idle + iowait;
+                if(now_total > placement_total[cpu]){
+                    busy[cpu] = (double)(now_busy - placement_busy[cpu]) / (now_total - placement_total[cpu]);
+                }
+                placement_busy[cpu] = now_busy;
+                placement_total[cpu] = now_total;
+            }
+            line = strchr(line + 1, '\n');
+        }
+    }
+
+    int best = placement_cpus[0];
+    for(int i = 1; i < placement_num_cpus; i++){
+        int cpu = placement_cpus[i];
+        if(placement_jobs[cpu] + busy[cpu] < placement_jobs[best] + busy[best]){
+            best = cpu;
+        }
+    }
+    return best;
+}
+
+/**
+ * This function should decide where a background job runs. A leading
+ * "@cpus=LIST" word is taken off the args and pins the job to those CPUs;
+ * otherwise the policy picks one CPU. With ",numa" the job's memory is bound
+ * to the node of its CPUs, if they all share one. Returns 0 with *result
+ * NULL if the job isn't placed, -1 if the CPU list is invalid.
+ * 
+ * Params:
+ *   input - command struct that holds args, '&' already removed
+ *   result - set to a new placement, or NULL
+ */
+int plan_placement(struct command* input, struct placement** result){
+    struct placement placement;
+    char list[sizeof(placement.label) - 16]; //Room for "cpus " and "/node N"
+
+    *result = NULL;
+    if(input->num_args > 1 && strncmp(input->args[0], "@cpus=", 6) == 0){
+        if(parse_cpu_list(input->args[0] + 6, &placement.cpus) == -1){
+            printf("bash: %s: invalid CPU list\n", input->args[0]);
+            fflush(stdout);
+            return -1;
+        }
+        CPU_AND(&placement.cpus, &placement.cpus, &placement_allowed);
+        if(CPU_COUNT(&placement.cpus) == 0){
+            printf("bash: %s: no allowed CPU in list\n", input->args[0]);
+            fflush(stdout);
+            return -1;
+        }
+        memmove(input->args, input->args + 1, input->num_args * sizeof(char*)); //Moves the NULL too
+        input->num_args--;
+    }
+    else if(placement_policy != PLACE_OFF && placement_num_cpus > 0){
+        int cpu;
+        if(placement_policy == PLACE_ROUND_ROBIN){
+            cpu = placement_cpus[placement_next];
+            placement_next = (placement_next + 1) % placement_num_cpus;
+        }
+        else{
+            cpu = least_loaded_cpu();
+        }
+        CPU_ZERO(&placement.cpus);
+        CPU_SET(cpu, &placement.cpus);
+    }
+    else{
+        return 0;
+    }
+
+    //Bind memory only if every CPU is on the same node
+    placement.node = -1;
+    for(int cpu = 0; placement_numa && cpu < CPU_SETSIZE; cpu++){
+        if(!CPU_ISSET(cpu, &placement.cpus)){
+            continue;
+        }
+        if(placement_node[cpu] == -1 || (placement.node != -1 && placement_node[cpu] != placement.node)){
+            placement.node = -1;
+            break;
+        }
+        placement.node = placement_node[cpu];
+    }
+
+    format_cpu_list(&placement.cpus, list, sizeof(list));
+    snprintf(placement.label, sizeof(placement.label), "%s %s", CPU_COUNT(&placement.cpus) == 1 ? "cpu" : "cpus", list);
+    *result = malloc(sizeof(struct placement));
+    **result = placement;
+    return 0;
+}
+
+/**
+ * This function should bind the calling process's future allocations to a
+ * NUMA node, or go back to the default policy for node -1. Children inherit
+ * the policy across fork() and exec. Returns -1 on failure.
+ * 
+ * Params:
+ *   node - NUMA node, -1 for the default policy
+ */
+int bind_memory(int node){
+    unsigned long nodemask[CPU_SETSIZE / (8 * sizeof(unsigned long))] = {0};
+
+    if(node == -1){
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+    }
+    if(node >= CPU_SETSIZE){
+        return -1;
+    }
+    nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_set_mempolicy, MPOL_BIND, nodemask, CPU_SETSIZE);
+}
+
+/**
+ * This function should apply a placement to the shell itself while a job's
+ * stages are launched, so children from fork() and posix_spawn() inherit it
+ * before they exec. The zygote applies it in its own children. A node the
+ * kernel won't bind to is dropped from the placement. The shell's own
+ * memory policy, which may be inherited (numactl --interleave), is saved
+ * first for restore_placement().
+ * 
+ * Params:
+ *   placement - placement to apply
+ */
+void apply_placement(struct placement* placement){
+    sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus);
+    if(placement->node != -1){
+        if(syscall(SYS_get_mempolicy, &placement_saved_mode, placement_saved_nodes, CPU_SETSIZE, NULL, 0) == -1){
+            placement_saved_mode = MPOL_DEFAULT;
+        }
+        if(bind_memory(placement->node) == -1){
+            placement->node = -1;
+        }
+        else{
+            size_t length = strlen(placement->label);
+            snprintf(placement->label + length, sizeof(placement->label) - length, "/node %d", placement->node);
+        }
+    }
+    active_placement = placement;
+}
+
+/**
+ * This function should give the shell back its own CPUs and the memory
+ * policy apply_placement() saved, once a placed job's stages are launched
+ * 
+ * Params:
+ *   placement - placement that was applied
+ */
+void restore_placement(struct placement* placement){
+    sched_setaffinity(0, sizeof(cpu_set_t), &placement_allowed);
+    if(placement->node != -1){
+        syscall(SYS_set_mempolicy, placement_saved_mode, placement_saved_mode == MPOL_DEFAULT ? NULL : placement_saved_nodes, CPU_SETSIZE);
+    }
+    active_placement = NULL;
+}
+
+/**
+ * This function should count a placed job on or off the CPUs it runs on,
+ * for least-loaded placement
+ * 
+ * Params:
+ *   placement - job's placement, may be NULL
+ *   delta - 1 when the job starts, -1 when it finishes
+ */
+void count_placement(struct placement* placement, int delta){
+    if(placement == NULL){
+        return;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if(CPU_ISSET(cpu, &placement->cpus)){
+            placement_jobs[cpu] += delta;
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#include "smallsh.h"
+
+/**
+ * This function should map a script file so its lines can be walked without
+ * copying them. The mapping is private and writable, so lines can be split
+ * and tokenized in place without touching the file. Files that can't be
+ * mapped (pipes, /dev/stdin) are read in large chunks instead. With
+ * SMALLSH_SCRIPT_CACHE set, a mapped script runs from its parsed-script
+ * cache. Returns -1 if the script can't be opened.
+ * 
+ * Params:
+ *   script - script struct to fill in
+ *   path - path of the script file
+ */
+int open_script(struct script* script, char* path){
+    struct stat info;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    memset(script, 0, sizeof(struct script));
+    if(fd == -1){
+        file_directory_error(path);
+        return -1;
+    }
+
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode)){
+        script->size = info.st_size;
+        if(script->size > 0){
+            script->data = mmap(NULL, script->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if(script->data == MAP_FAILED){
+                script->data = NULL;
+            }
+            else{
+                madvise(script->data, script->size, MADV_SEQUENTIAL);
+                script->mapped = 1;
+                if(script_cache_enabled){
+                    load_script_cache(script, path, &info);
+                }
+            }
+        }
+    }
+
+    if(!script->mapped){ //Stream it in instead
+        size_t capacity = 0;
+        script->size = 0;
+        while(1){
+            if(capacity - script->size < SCRIPT_CHUNK){
+                capacity = capacity == 0 ? SCRIPT_CHUNK : capacity * 2;
+                script->data = realloc(script->data, capacity);
+            }
+            ssize_t num_read = read(fd, script->data + script->size, SCRIPT_CHUNK);
+            if(num_read == -1 && errno == EINTR){
+                continue;
+            }
+            if(num_read <= 0){
+                break;
+            }
+            script->size += num_read;
+        }
+        script->owned = 1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+/**
+ * This function should use a string as the script, for "smallsh -c"
+ * 
+ * Params:
+ *   script - script struct to fill in
+ *   text - commands to run, one per line, modified in place
+ */
+void string_script(struct script* script, char* text){
+    memset(script, 0, sizeof(struct script));
+    script->data = text;
+    script->size = strlen(text);
+}
+
+/**
+ * This function should return the next line of a script, NUL-terminated in
+ * place, or NULL when the script is finished. A last line with no trailing
+ * newline can't be terminated in the buffer, so it is copied into overflow,
+ * which is grown to fit.
+ * 
+ * Params:
+ *   script - script to read from
+ *   overflow - pointer to a malloc'd buffer for an unterminated last line (by reference)
+ *   overflow_size - pointer to the overflow buffer's size (by reference)
+ */
+char* next_script_line(struct script* script, char** overflow, size_t* overflow_size){
+    if(script->offset >= script->size){
+        return NULL;
+    }
+
+    char* line = script->data + script->offset;
+    size_t remaining = script->size - script->offset;
+    char* newline = memchr(line, '\n', remaining);
+
+    if(newline == NULL){ //Unterminated last line
+        if(remaining + 1 > *overflow_size){
+            *overflow_size = remaining + 1;
+            *overflow = realloc(*overflow, *overflow_size);
+        }
+        memcpy(*overflow, line, remaining);
+        (*overflow)[remaining] = '\0';
+        script->offset = script->size;
+        return *overflow;
+    }
+
+    *newline = '\0';
+    script->offset += newline - line + 1;
+    return line;
+}
+
+/**
+ * This function should release a script's buffer
+ * 
+ * Params:
+ *   script - script to close
+ */
+void close_script(struct script* script){
+    if(script->cache_mapped){
+        munmap(script->cache, script->cache_size);
+    }
+    else{
+        free(script->cache);
+    }
+    if(script->mapped){
+        munmap(script->data, script->size);
+    }
+    else if(script->owned){
+        free(script->data);
+    }
+    memset(script, 0, sizeof(struct script));
+}
@@ -0,0 +1,381 @@
+#include "smallsh.h"
+
+int script_cache_enabled = 0; //1 if SMALLSH_SCRIPT_CACHE is set
+
+/**
+ * This function should turn the parsed-script cache on if the
+ * SMALLSH_SCRIPT_CACHE environment variable is set to anything but 0
+ */
+void set_script_cache(void){
+    char* enabled = getenv("SMALLSH_SCRIPT_CACHE");
+    script_cache_enabled = enabled != NULL && enabled[0] != '\0' && strcmp(enabled, "0") != 0;
+}
+
+/**
+ * This function should hash a buffer 8 bytes at a time. It only has to
+ * notice a script that changed without its size or mtime changing, so
+ * speed matters more than quality.
+ * 
+ * Params:
+ *   data - bytes to hash
+ *   size - number of bytes
+ */
+uint64_t hash_script(char* data, size_t size){
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+    uint64_t word;
+    size_t i = 0;
+
+    for(; i + 8 <= size; i += 8){
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 29;
+    }
+    word = 0;
+    memcpy(&word, data + i, size - i);
+    hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 32);
+}
+
+/**
+ * This function should find where a script's cache lives:
+ * $XDG_CACHE_HOME/smallsh/<hash of the script's real path> if XDG_CACHE_HOME
+ * is set, or a hidden ".name.smallsh-cache" file beside the script. Returns
+ * -1 if the script's real path can't be found.
+ * 
+ * Params:
+ *   path - script path as given
+ *   real - buffer of PATH_MAX bytes for the script's real path
+ *   cache_path - buffer of PATH_MAX bytes for the cache file's path
+ */
+int script_cache_path(char* path, char* real, char* cache_path){
+    char* cache_home = getenv("XDG_CACHE_HOME");
+
+    if(realpath(path, real) == NULL){
+        return -1;
+    }
+    if(cache_home != NULL && cache_home[0] == '/'){
+        snprintf(cache_path, PATH_MAX, "%s/smallsh/%016llx.cache", cache_home, (unsigned long long)hash_script(real, strlen(real)));
+        return 0;
+    }
+    char* name = strrchr(real, '/') + 1;
+    snprintf(cache_path, PATH_MAX, "%.*s.%s.smallsh-cache", (int)(name - real), real, name);
+    return 0;
+}
+
+/**
+ * This function should check that a mapped cache belongs to this exact
+ * script: same real path, size, mtime and content hash, and offsets that
+ * stay inside the file. Every line's words and strings are checked too,
+ * down to the strings ending in a NUL, since a corrupt or hostile cache is
+ * used without copying. Returns 0 if it can be used.
+ * 
+ * Params:
+ *   cache - mapped cache file
+ *   cache_size - size of the cache file
+ *   real - script's real path
+ *   info - script's stat
+ *   hash - script's content hash
+ */
+int check_script_cache(char* cache, size_t cache_size, char* real, struct stat* info, uint64_t hash){
+    struct script_cache_header* header = (struct script_cache_header*)cache;
+    size_t path_length = strlen(real);
+
+    if(cache_size < sizeof(struct script_cache_header) || memcmp(header->magic, SCRIPT_CACHE_MAGIC, sizeof(header->magic)) != 0){
+        return -1;
+    }
+    if(header->size != (uint64_t)info->st_size || header->mtime_sec != (int64_t)info->st_mtim.tv_sec ||
+        header->mtime_nsec != (int64_t)info->st_mtim.tv_nsec || header->hash != hash){
+        return -1; //Stale
+    }
+    if(header->path_length != path_length || sizeof(struct script_cache_header) + path_length > cache_size ||
+        memcmp(cache + sizeof(struct script_cache_header), real, path_length) != 0){
+        return -1; //Another script with the same path hash
+    }
+    if(header->lines_offset > header->args_offset || header->args_offset > header->strings_offset || header->strings_offset > cache_size ||
+        (uint64_t)header->num_lines * sizeof(struct cached_line) > header->args_offset - header->lines_offset ||
+        header->lines_offset < sizeof(struct script_cache_header) + path_length || ((header->lines_offset | header->args_offset) & 3) != 0){
+        return -1;
+    }
+
+    struct cached_line* lines = (struct cached_line*)(cache + header->lines_offset);
+    uint32_t* words = (uint32_t*)(cache + header->args_offset);
+    uint64_t num_words = (header->strings_offset - header->args_offset) / sizeof(uint32_t);
+    uint64_t strings_size = cache_size - header->strings_offset;
+    if(header->num_lines > 0 && (strings_size == 0 || cache[cache_size - 1] != '\0')){ //Every string ends before the file does
+        return -1;
+    }
+    for(uint32_t i = 0; i < header->num_lines; i++){
+        if(lines[i].type == CACHED_EXPAND){
+            if(lines[i].start >= strings_size){
+                return -1;
+            }
+            continue;
+        }
+        if((lines[i].type != CACHED_WORDS && lines[i].type != CACHED_GLOB) || (uint64_t)lines[i].start + lines[i].num_args > num_words){
+            return -1;
+        }
+        for(uint32_t j = 0; j < lines[i].num_args; j++){
+            if(words[lines[i].start + j] >= strings_size){
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function should append bytes to a growable buffer, doubling it when
+ * full, and return the offset they were written at
+ * 
+ * Params:
+ *   buffer - pointer to the malloc'd buffer (by reference)
+ *   used - pointer to the bytes used (by reference)
+ *   capacity - pointer to the buffer's size (by reference)
+ *   data - bytes to append
+ *   length - number of bytes
+ */
+size_t cache_append(char** buffer, size_t* used, size_t* capacity, void* data, size_t length){
+    size_t offset = *used;
+    if(*used + length > *capacity){
+        *capacity = *capacity == 0 ? 4096 : *capacity;
+        while(*used + length > *capacity){
+            *capacity *= 2;
+        }
+        *buffer = realloc(*buffer, *capacity);
+    }
+    memcpy(*buffer + *used, data, length);
+    *used += length;
+    return offset;
+}
+
+/**
+ * This function should parse a whole script into the cache format. Lines
+ * without a '$' are split into words once, here; lines with one are kept
+ * whole and expanded each run, since $$, $? and $! change. Lines with glob
+ * characters are split once and globbed each run. Empty lines and
+ * comments are dropped. Redirection and '&' stay in argv, where the
+ * launcher finds them with a strcmp. Returns the malloc'd cache, or NULL if
+ * it would be too large for 32-bit offsets.
+ * 
+ * Params:
+ *   data - script text
+ *   size - script size
+ *   real - script's real path
+ *   info - script's stat
+ *   hash - script's content hash
+ *   cache_size - pointer to the cache's size (by reference)
+ */
+char* build_script_cache(char* data, size_t size, char* real, struct stat* info, uint64_t hash, size_t* cache_size){
+    char* lines = NULL;
+    char* args = NULL;
+    char* strings = NULL;
+    size_t lines_used = 0, lines_capacity = 0;
+    size_t args_used = 0, args_capacity = 0;
+    size_t strings_used = 0, strings_capacity = 0;
+    struct script_cache_header header = {{0}};
+    size_t offset = 0;
+
+    while(offset < size){
+        char* line = data + offset;
+        char* newline = memchr(line, '\n', size - offset);
+        size_t length = newline == NULL ? size - offset : (size_t)(newline - line);
+        struct cached_line cached = {0};
+        offset += length + 1;
+
+        if(is_comment(line, length)){ //Dropped, before a $(...) in it could be kept to run
+            continue;
+        }
+        if(memchr(line, '$', length) != NULL){ //Expanded each run
+            cached.type = CACHED_EXPAND;
+            cached.start = cache_append(&strings, &strings_used, &strings_capacity, line, length);
+            cache_append(&strings, &strings_used, &strings_capacity, "", 1);
+        }
+        else{
+            size_t i = 0;
+            cached.type = CACHED_WORDS;
+            cached.start = args_used / sizeof(uint32_t);
+            while(1){
+                while(i < length && (line[i] == ' ' || line[i] == '\t')){ //Same separators as split_command()
+                    i++;
+                }
+                if(i == length){
+                    break;
+                }
+                size_t start = i;
+                while(i < length && line[i] != ' ' && line[i] != '\t'){
+                    i++;
+                }
+                uint32_t word = cache_append(&strings, &strings_used, &strings_capacity, line + start, i - start);
+                cache_append(&strings, &strings_used, &strings_capacity, "", 1);
+                cache_append(&args, &args_used, &args_capacity, &word, sizeof(word));
+                cached.num_args++;
+            }
+            if(cached.num_args == 0){ //Nothing to run
+                continue;
+            }
+            if(has_glob(line, length)){
+                cached.type = CACHED_GLOB;
+            }
+        }
+        cache_append(&lines, &lines_used, &lines_capacity, &cached, sizeof(cached));
+        header.num_lines++;
+    }
+
+    //Header, path, lines, args, strings, each 8-byte aligned
+    size_t path_length = strlen(real);
+    size_t lines_offset = (sizeof(header) + path_length + 7) & ~(size_t)7;
+    size_t args_offset = lines_offset + ((lines_used + 7) & ~(size_t)7);
+    size_t strings_offset = args_offset + ((args_used + 7) & ~(size_t)7);
+    *cache_size = strings_offset + strings_used;
+    char* cache = NULL;
+    if(*cache_size <= UINT32_MAX){
+        memcpy(header.magic, SCRIPT_CACHE_MAGIC, sizeof(header.magic));
+        header.size = size;
+        header.mtime_sec = info->st_mtim.tv_sec;
+        header.mtime_nsec = info->st_mtim.tv_nsec;
+        header.hash = hash;
+        header.path_length = path_length;
+        header.lines_offset = lines_offset;
+        header.args_offset = args_offset;
+        header.strings_offset = strings_offset;
+        cache = calloc(1, *cache_size);
+        memcpy(cache, &header, sizeof(header));
+        memcpy(cache + sizeof(header), real, path_length);
+        memcpy(cache + lines_offset, lines, lines_used);
+        memcpy(cache + args_offset, args, args_used);
+        memcpy(cache + strings_offset, strings, strings_used);
+    }
+    free(lines);
+    free(args);
+    free(strings);
+    return cache;
+}
+
+/**
+ * This function should write a cache file through a temporary file and
+ * rename(), so a concurrent run never maps a half-written cache. Failures
+ * are silent, the script just runs from the built cache in memory.
+ * 
+ * Params:
+ *   cache_path - cache file to write
+ *   cache - cache to write
+ *   cache_size - size of the cache
+ */
+void write_script_cache(char* cache_path, char* cache, size_t cache_size){
+    char temp_path[PATH_MAX + 32];
+    char* cache_home = getenv("XDG_CACHE_HOME");
+
+    if(cache_home != NULL && cache_home[0] == '/'){
+        snprintf(temp_path, sizeof(temp_path), "%s/smallsh", cache_home);
+        mkdir(temp_path, 0700); //Already there is fine
+    }
+    snprintf(temp_path, sizeof(temp_path), "%s.%d", cache_path, (int)getpid());
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if(fd == -1){
+        return;
+    }
+    size_t written = 0;
+    while(written < cache_size){
+        ssize_t num_written = write(fd, cache + written, cache_size - written);
+        if(num_written == -1 && errno == EINTR){
+            continue;
+        }
+        if(num_written <= 0){
+            break;
+        }
+        written += num_written;
+    }
+    close(fd);
+    if(written != cache_size || rename(temp_path, cache_path) == -1){
+        unlink(temp_path);
+    }
+}
+
+/**
+ * This function should give a script its parsed form: the cache file if it
+ * is still valid, otherwise one built now and saved for the next run. The
+ * script must be a regular file that is mapped, and its text untouched.
+ * 
+ * Params:
+ *   script - mapped script
+ *   path - script path as given
+ *   info - script's stat
+ */
+void load_script_cache(struct script* script, char* path, struct stat* info){
+    char real[PATH_MAX];
+    char cache_path[PATH_MAX];
+    struct stat cache_info;
+
+    if(script_cache_path(path, real, cache_path) == -1){
+        return;
+    }
+    uint64_t hash = hash_script(script->data, script->size);
+
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if(fd != -1){
+        if(fstat(fd, &cache_info) == 0 && cache_info.st_size >= (off_t)sizeof(struct script_cache_header)){
+            char* cache = mmap(NULL, cache_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(cache != MAP_FAILED && check_script_cache(cache, cache_info.st_size, real, info, hash) == 0){
+                script->cache = cache;
+                script->cache_size = cache_info.st_size;
+                script->cache_mapped = 1;
+            }
+            else if(cache != MAP_FAILED){
+                munmap(cache, cache_info.st_size);
+            }
+        }
+        close(fd);
+    }
+
+    if(script->cache == NULL){ //Missing or stale, parse it now
+        script->cache = build_script_cache(script->data, script->size, real, info, hash, &script->cache_size);
+        if(script->cache == NULL){
+            return;
+        }
+        write_script_cache(cache_path, script->cache, script->cache_size);
+    }
+    script->next_cached = 0;
+}
+
+/**
+ * This function should load the next line of a cached script into the
+ * command struct. Words point straight into the cache, lines with
+ * variables go through expand_command(). Returns 0 once the script is
+ * finished.
+ * 
+ * Params:
+ *   script - script with a cache
+ *   input - command struct to hold args
+ *   last_status - value for $?
+ *   last_background - value for $!, 0 if no background job has run
+ */
+int next_cached_command(struct script* script, struct command* input, int last_status, pid_t last_background){
+    struct script_cache_header* header = (struct script_cache_header*)script->cache;
+
+    if(script->next_cached >= header->num_lines){
+        return 0;
+    }
+    struct cached_line* line = (struct cached_line*)(script->cache + header->lines_offset) + script->next_cached++;
+    char* strings = script->cache + header->strings_offset;
+    TRACE(TRACE_POPULATE, 'B', 0);
+
+    if(line->type == CACHED_EXPAND){
+        expand_command(input, strings + line->start, last_status, last_background);
+        expand_globs(input);
+    }
+    else{
+        uint32_t* words = (uint32_t*)(script->cache + header->args_offset) + line->start;
+        reserve_args(input, line->num_args);
+        for(uint32_t i = 0; i < line->num_args; i++){
+            input->args[i] = strings + words[i];
+        }
+        input->args[line->num_args] = NULL;
+        input->num_args = line->num_args;
+        if(line->type == CACHED_GLOB){
+            expand_globs(input);
+        }
+    }
+    strip_background(input);
+    TRACE(TRACE_POPULATE, 'E', input->num_args);
+    return 1;
+}
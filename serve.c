@@ -0,0 +1,838 @@
+#include "smallsh.h"
+
+struct server* server = NULL; //Set while running as a daemon, reap_children() routes children through it
+
+/**
+ * This function should run smallsh as a daemon on a Unix domain socket. One
+ * process and one epoll loop serve every client, and each client is a
+ * session of its own with its own cwd, last status and job table. Clients
+ * send command lines; each line is answered with its output and then one
+ * status frame:
+ * 
+ *   "o N\n" then N bytes of stdout/stderr
+ *   "s N\n" exit value of the line, or "k N\n" if it was killed by signal N
+ * 
+ * Foreground commands don't block the loop: their output streams back
+ * through a pipe and the status is sent once they are reaped. Returns the
+ * exit status of the daemon.
+ * 
+ * Params:
+ *   path - socket to listen on
+ */
+int serve_main(char* path){
+    struct server state = {0};
+    struct sockaddr_un address = {0};
+    struct stat path_stat;
+    sigset_t signal_set;
+
+    if(strlen(path) >= sizeof(address.sun_path)){
+        printf("bash: %s: socket path too long\n", path);
+        return 1;
+    }
+    server = &state;
+
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    dup2(null_fd, STDIN_FILENO); //Commands never read the daemon's stdin
+    close(null_fd);
+    init_expansion();
+    init_trace();
+    //The zygote reports exits to a single job table, so clients launch directly
+    spawn_mode = getenv("SMALLSH_SPAWN") != NULL && strcmp(getenv("SMALLSH_SPAWN"), "fork") == 0 ? SPAWN_FORK : SPAWN_POSIX;
+    set_relay_mode();
+    set_output_capture();
+    set_admission();
+    set_placement();
+    set_history();
+    set_timeouts();
+    set_pure_commands();
+    set_metrics();
+
+    sigemptyset(&signal_set);
+    sigaddset(&signal_set, SIGCHLD);
+    sigaddset(&signal_set, SIGINT);
+    sigaddset(&signal_set, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signal_set, NULL);
+    state.signal_fd = signalfd(-1, &signal_set, SFD_NONBLOCK | SFD_CLOEXEC);
+    state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    state.scratch_fd = memfd_create("smallsh-serve", MFD_CLOEXEC);
+    state.start_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    state.saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    state.saved_stderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if(lstat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)){ //Left over from an earlier daemon
+        unlink(path);
+    }
+    state.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    mode_t saved_mask = umask(077); //Anyone who can connect runs commands as us, the socket is created 0600
+    int bound = state.listen_fd != -1 && bind(state.listen_fd, (struct sockaddr*)&address, sizeof(address)) == 0;
+    umask(saved_mask);
+    if(!bound || listen(state.listen_fd, SOMAXCONN) == -1 || state.scratch_fd == -1){
+        printf("bash: %s: %s\n", path, strerror(errno));
+        stop_server(&state, NULL);
+        return 1;
+    }
+
+    state.listen_watch.kind = WATCH_LISTEN;
+    state.signal_watch.kind = WATCH_SIGNALS;
+    serve_watch(&state, state.listen_fd, &state.listen_watch, EPOLL_CTL_ADD, EPOLLIN);
+    serve_watch(&state, state.signal_fd, &state.signal_watch, EPOLL_CTL_ADD, EPOLLIN);
+
+    int stopping = 0;
+    while(!stopping){
+        struct epoll_event events[SERVE_MAX_EVENTS];
+        int queued = 0;
+        for(int i = 0; i < state.num_clients; i++){
+            queued |= state.clients[i]->jobs.queue_head != NULL;
+        }
+
+        int wait_ms = queued ? ADMIT_RECHECK_MS : -1;
+        if(metrics.file != NULL && (wait_ms == -1 || metrics.interval * 1000 < wait_ms)){ //Wake up to rewrite SMALLSH_METRICS
+            wait_ms = metrics.interval * 1000 < INT_MAX ? (int)(metrics.interval * 1000) : INT_MAX;
+        }
+        int num_events = epoll_wait(state.epoll_fd, events, SERVE_MAX_EVENTS, wait_ms);
+        for(int i = 0; i < num_events; i++){
+            struct serve_watch* watch = events[i].data.ptr;
+            switch(watch->kind){
+                case WATCH_LISTEN: serve_accept(&state); break;
+                case WATCH_SIGNALS: stopping = serve_signals(&state); break;
+                case WATCH_SOCKET:
+                    if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+                        serve_read(watch->client);
+                    }
+                    if(events[i].events & EPOLLOUT){
+                        serve_flush(watch->client);
+                    }
+                    break;
+                case WATCH_OUTPUT: serve_read_output(&state, watch->client); break;
+                case WATCH_JOBS: drain_output(&watch->client->jobs); break;
+                case WATCH_TIMER: expire_deadlines(&watch->client->jobs); break;
+            }
+        }
+
+        //Run the next line of every idle client, dropping clients that are done
+        for(int i = state.num_clients - 1; i >= 0; i--){
+            struct serve_client* client = state.clients[i];
+            if(client->jobs.queue_head != NULL){
+                fchdir(client->cwd_fd);
+                serve_capture_begin(&state);
+                admit_jobs(&client->jobs);
+                serve_capture_end(&state, client);
+            }
+            serve_advance(&state, client);
+            if(client->closing && !client->busy && client->out_used == client->out_start){
+                remove_client(&state, client);
+            }
+            else{
+                serve_update(&state, client);
+            }
+        }
+        write_metrics_file(NULL, 0);
+    }
+
+    stop_server(&state, path);
+    return 0;
+}
+
+/**
+ * This function should add, change or remove an fd in the daemon's epoll set
+ * 
+ * Params:
+ *   state - daemon
+ *   fd - fd to watch
+ *   watch - what the fd is, handed back with its events
+ *   op - EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+ *   events - epoll events to wait for
+ */
+void serve_watch(struct server* state, int fd, struct serve_watch* watch, int op, int events){
+    struct epoll_event event = {0};
+
+    event.events = events;
+    event.data.ptr = watch;
+    epoll_ctl(state->epoll_fd, op, fd, &event);
+}
+
+/**
+ * This function should accept every pending connection and give each one a
+ * fresh session: its own job table and command buffers, starting in the
+ * daemon's starting directory with a last status of 0
+ * 
+ * Params:
+ *   state - daemon
+ */
+void serve_accept(struct server* state){
+    int fd;
+
+    while((fd = accept4(state->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1){
+        struct serve_client* client = calloc(1, sizeof(struct serve_client));
+        client->fd = fd;
+        client->cwd_fd = fcntl(state->start_fd, F_DUPFD_CLOEXEC, 10);
+        client->last_cmd = -1;
+        client->output_fd = -1;
+        init_job_table(&client->jobs);
+        close(client->jobs.sigchld_fd); //The daemon reaps for every client
+        client->jobs.sigchld_fd = -1;
+        init_command(&client->input);
+
+        client->socket_watch = (struct serve_watch){WATCH_SOCKET, client};
+        client->output_watch = (struct serve_watch){WATCH_OUTPUT, client};
+        client->jobs_watch = (struct serve_watch){WATCH_JOBS, client};
+        client->timer_watch = (struct serve_watch){WATCH_TIMER, client};
+        client->events = EPOLLIN;
+        serve_watch(state, fd, &client->socket_watch, EPOLL_CTL_ADD, EPOLLIN);
+        serve_watch(state, client->jobs.epoll_fd, &client->jobs_watch, EPOLL_CTL_ADD, EPOLLIN);
+        serve_watch(state, client->jobs.timer_fd, &client->timer_watch, EPOLL_CTL_ADD, EPOLLIN);
+
+        if(state->num_clients == state->capacity){
+            state->capacity = state->capacity == 0 ? 16 : state->capacity * 2;
+            state->clients = realloc(state->clients, state->capacity * sizeof(struct serve_client*));
+        }
+        client->slot = state->num_clients;
+        state->clients[state->num_clients++] = client;
+    }
+}
+
+/**
+ * This function should end a client's session: its background jobs are
+ * terminated, like when an interactive shell exits, and everything it owns
+ * is freed. Its children are still reaped, as pids that belong to no one.
+ * 
+ * Params:
+ *   state - daemon
+ *   client - client to drop
+ */
+void remove_client(struct server* state, struct serve_client* client){
+    end_background_processes(&client->jobs);
+    free_admission_queue(&client->jobs);
+    serve_watch(state, client->fd, NULL, EPOLL_CTL_DEL, 0);
+    serve_watch(state, client->jobs.epoll_fd, NULL, EPOLL_CTL_DEL, 0);
+    serve_watch(state, client->jobs.timer_fd, NULL, EPOLL_CTL_DEL, 0);
+    if(client->output_fd != -1){
+        serve_watch(state, client->output_fd, NULL, EPOLL_CTL_DEL, 0);
+        close(client->output_fd);
+    }
+    free_job_table(&client->jobs);
+    free_command(&client->input);
+    free(client->in);
+    free(client->out);
+    close(client->cwd_fd);
+    close(client->fd);
+
+    state->clients[client->slot] = state->clients[--state->num_clients];
+    state->clients[client->slot]->slot = client->slot;
+    free(client);
+}
+
+/**
+ * This function should read the signals the daemon is waiting on. SIGCHLD
+ * reaps children for every client; SIGINT and SIGTERM stop the daemon.
+ * Returns 1 to stop.
+ * 
+ * Params:
+ *   state - daemon
+ */
+int serve_signals(struct server* state){
+    struct signalfd_siginfo info;
+    int reap = 0;
+    int stop = 0;
+
+    while(read(state->signal_fd, &info, sizeof(info)) == sizeof(info)){
+        if(info.ssi_signo == SIGCHLD){
+            reap = 1;
+        }
+        else{
+            stop = 1;
+        }
+    }
+    if(reap){
+        int status;
+        struct rusage usage;
+        pid_t pid;
+        while((pid = wait4(-1, &status, WNOHANG, &usage)) > 0){
+            serve_finish_child(pid, status, &usage);
+        }
+    }
+    return stop;
+}
+
+/**
+ * This function should hand a reaped child to the client whose job table
+ * has it. If that finishes a client's foreground job, its status is worked
+ * out like foreground_command() does and sent once the output is too.
+ * 
+ * Params:
+ *   pid - reaped child
+ *   status - raw wait status
+ *   usage - child's resource usage
+ */
+void serve_finish_child(pid_t pid, int status, struct rusage* usage){
+    for(int i = 0; i < server->num_clients; i++){
+        struct serve_client* client = server->clients[i];
+        if(find_job(&client->jobs, pid) == NULL){
+            continue;
+        }
+        finish_child(&client->jobs, pid, status, usage);
+
+        struct job* job = client->running;
+        if(job != NULL && job->done){
+            record_job_usage(job, &client->jobs.last_foreground);
+            record_since(&metrics.wait, &job->start); //Launch to reap, the daemon never blocks on it
+            client->signal = client->launched && WIFSIGNALED(job->status) ? WTERMSIG(job->status) : 0;
+            client->last_status = !client->launched ? 1 : job->status >= 256 ? job->status / 256 : job->status;
+            client->timed_out = client->launched && job->timed_out != 0;
+            if(client->timed_out){ //Reported as its own output, like the shell does
+                client->signal = 0;
+                client->last_status = TIMEOUT_STATUS;
+            }
+            remove_job(&client->jobs, job);
+            client->running = NULL;
+            if(client->output_fd == -1){
+                serve_finish_command(client);
+            }
+        }
+        return;
+    }
+}
+
+/**
+ * This function should read whatever a client sent. EOF, or a broken
+ * connection, closes the session once the line being run has finished.
+ * 
+ * Params:
+ *   client - client whose connection is readable
+ */
+void serve_read(struct serve_client* client){
+    while(!client->closing){
+        if(client->in_used == client->in_size){
+            if(client->in_start > 0){ //Move the unread part to the front before growing
+                memmove(client->in, client->in + client->in_start, client->in_used - client->in_start);
+                client->in_used -= client->in_start;
+                client->in_start = 0;
+            }
+            if(client->in_used == client->in_size){
+                client->in_size = client->in_size == 0 ? 4096 : client->in_size * 2;
+                client->in = realloc(client->in, client->in_size);
+            }
+        }
+        ssize_t num_read = read(client->fd, client->in + client->in_used, client->in_size - client->in_used);
+        if(num_read > 0){
+            client->in_used += num_read;
+        }
+        else if(num_read == 0 || errno != EAGAIN){
+            client->closing = 1;
+        }
+        else{
+            return;
+        }
+    }
+}
+
+/**
+ * This function should queue one frame for a client and try to send it
+ * 
+ * Params:
+ *   client - client to send to
+ *   kind - 'o', 's' or 'k'
+ *   number - output length, exit value or signal
+ *   data - output for 'o' frames, NULL otherwise
+ */
+void serve_frame(struct serve_client* client, char kind, size_t number, char* data){
+    char header[32];
+    int header_length = snprintf(header, sizeof(header), "%c %zu\n", kind, number);
+    size_t needed = header_length + (data != NULL ? number : 0);
+
+    if(client->out_start == client->out_used){
+        client->out_start = 0;
+        client->out_used = 0;
+    }
+    if(client->out_used + needed > client->out_size){
+        while(client->out_used + needed > client->out_size){
+            client->out_size = client->out_size == 0 ? 4096 : client->out_size * 2;
+        }
+        client->out = realloc(client->out, client->out_size);
+    }
+    memcpy(client->out + client->out_used, header, header_length);
+    if(data != NULL){
+        memcpy(client->out + client->out_used + header_length, data, number);
+    }
+    client->out_used += needed;
+    serve_flush(client);
+}
+
+/**
+ * This function should send as much queued output as the connection takes
+ * without blocking. If the client is gone, the rest is dropped and the
+ * session closes.
+ * 
+ * Params:
+ *   client - client to send to
+ */
+void serve_flush(struct serve_client* client){
+    while(client->out_start < client->out_used){
+        ssize_t num_sent = send(client->fd, client->out + client->out_start, client->out_used - client->out_start, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(num_sent > 0){
+            client->out_start += num_sent;
+        }
+        else if(num_sent == -1 && errno == EAGAIN){
+            return;
+        }
+        else{
+            client->out_start = client->out_used;
+            client->in_start = client->in_used;
+            client->closing = 1;
+        }
+    }
+}
+
+/**
+ * This function should watch a client's connection for what it needs now:
+ * input until EOF, and room to write while output is queued. The running
+ * command's output pipe isn't read while too much is queued, so a slow
+ * client holds back the command instead of growing the daemon.
+ * 
+ * Params:
+ *   state - daemon
+ *   client - client to update
+ */
+void serve_update(struct server* state, struct serve_client* client){
+    size_t queued = client->out_used - client->out_start;
+    int events = (client->closing ? 0 : EPOLLIN) | (queued > 0 ? EPOLLOUT : 0);
+
+    //Taken out of the set when nothing is wanted, a hung up socket would keep waking us
+    if(events != client->events){
+        int op = client->events == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+        serve_watch(state, client->fd, &client->socket_watch, op, events);
+        client->events = events;
+    }
+    int pause = queued > SERVE_OUT_LIMIT;
+    if(client->output_fd != -1 && pause != client->paused){
+        serve_watch(state, client->output_fd, &client->output_watch, EPOLL_CTL_MOD, pause ? 0 : EPOLLIN);
+        client->paused = pause;
+    }
+}
+
+/**
+ * This function should send along what the running command wrote, one
+ * read per wakeup so a chatty command can't starve other clients. At EOF
+ * the pipe is closed, and if the command was already reaped its status
+ * goes out.
+ * 
+ * Params:
+ *   state - daemon
+ *   client - client whose command's output is readable
+ */
+void serve_read_output(struct server* state, struct serve_client* client){
+    char buffer[OUTPUT_CHUNK];
+
+    ssize_t num_read = read(client->output_fd, buffer, sizeof(buffer));
+    if(num_read > 0){
+        serve_frame(client, 'o', num_read, buffer);
+        return;
+    }
+    if(num_read == -1 && errno == EAGAIN){
+        return;
+    }
+    serve_watch(state, client->output_fd, NULL, EPOLL_CTL_DEL, 0);
+    close(client->output_fd);
+    client->output_fd = -1;
+    client->paused = 0;
+    if(client->running == NULL){
+        serve_finish_command(client);
+    }
+}
+
+/**
+ * This function should point the daemon's stdout and stderr at the scratch
+ * memfd, so built-ins and error messages can be sent to the client whose
+ * command is running instead of the daemon's terminal
+ * 
+ * Params:
+ *   state - daemon
+ */
+void serve_capture_begin(struct server* state){
+    fflush(stdout);
+    dup2(state->scratch_fd, STDOUT_FILENO);
+    dup2(state->scratch_fd, STDERR_FILENO);
+}
+
+/**
+ * This function should restore the daemon's stdout and stderr and send
+ * everything written to the scratch memfd to a client as one frame
+ * 
+ * Params:
+ *   state - daemon
+ *   client - client the output belongs to
+ */
+void serve_capture_end(struct server* state, struct serve_client* client){
+    fflush(stdout);
+    clearerr(stdout);
+    dup2(state->saved_stdout, STDOUT_FILENO);
+    dup2(state->saved_stderr, STDERR_FILENO);
+
+    off_t length = lseek(state->scratch_fd, 0, SEEK_CUR);
+    if(length <= 0){
+        return;
+    }
+    char* data = malloc(length);
+    if(pread(state->scratch_fd, data, length, 0) == length){
+        serve_frame(client, 'o', length, data);
+    }
+    free(data);
+    ftruncate(state->scratch_fd, 0);
+    lseek(state->scratch_fd, 0, SEEK_SET);
+}
+
+/**
+ * This function should run a client's complete lines, one at a time, for
+ * as long as nothing it started is still running and its queued output
+ * isn't piling up. A last line without a newline runs at EOF.
+ * 
+ * Params:
+ *   state - daemon
+ *   client - client to advance
+ */
+void serve_advance(struct server* state, struct serve_client* client){
+    while(!client->busy && client->in_start < client->in_used && client->out_used - client->out_start <= SERVE_OUT_LIMIT){
+        char* line = client->in + client->in_start;
+        size_t available = client->in_used - client->in_start;
+        char* end = memchr(line, '\n', available);
+        if(end == NULL && !client->closing){
+            return;
+        }
+        size_t length = end != NULL ? (size_t)(end - line) : available;
+
+        if(length + 2 > client->input.line_size){
+            client->input.line_size = length + 2;
+            client->input.command_line = realloc(client->input.command_line, client->input.line_size);
+        }
+        memcpy(client->input.command_line, line, length);
+        client->input.command_line[length] = '\n';
+        client->input.command_line[length + 1] = '\0';
+        client->in_start += end != NULL ? length + 1 : length;
+
+        serve_command(state, client);
+    }
+}
+
+/**
+ * This function should run one line for a client, in its cwd and with its
+ * last status and job table. Built-ins run right here like in prompt(); a
+ * foreground command is only launched, with its stdout/stderr going to a
+ * pipe the loop reads, and the line finishes when it is reaped. "time" and
+ * "parallel" wait for their commands inside the shell, which would stall
+ * every other client, so they aren't available. A leading "timeout" gives
+ * the job the line starts a deadline, which the loop enforces.
+ * 
+ * Params:
+ *   state - daemon
+ *   client - client whose line is in input.command_line
+ */
+void serve_command(struct server* state, struct serve_client* client){
+    struct command* input = &client->input;
+    struct sigaction unused = {0};
+    struct builtin* builtin;
+
+    client->busy = 1;
+    client->signal = 0;
+    fchdir(client->cwd_fd);
+    serve_capture_begin(state);
+    report_background_processes(&client->jobs); //What a prompt would have shown first
+    if(strstr(input->command_line, "$(") != NULL && !is_comment(input->command_line, strlen(input->command_line))){ //Expanding runs it to the end inside the loop, stalling every client
+        printf("bash: $(...): not available in serve mode\n");
+        strcpy(input->command_line, "#"); //Runs as a comment, so nothing else runs or is counted
+        client->last_status = 1;
+        client->last_cmd = 1;
+    }
+    populate_command(input, input->command_line, client->last_status, client->jobs.last_background_pid);
+
+    if(strcmp(input->args[0], "timeout") == 0 && plan_timeout(input, &client->jobs) != 0){
+        client->last_status = 1;
+        client->last_cmd = 1;
+    }
+    else if(strcmp(input->args[0], "exit") == 0){
+        client->closing = 1;
+        client->in_start = client->in_used;
+        client->busy = 0;
+    }
+    else if(strcmp(input->args[0], "cd") == 0){
+        cd_execute(input);
+        int cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(cwd_fd != -1){
+            close(client->cwd_fd);
+            client->cwd_fd = cwd_fd;
+        }
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "hash") == 0){
+        hash_execute(input);
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "status") == 0){
+        status_execute(client->last_status, client->last_cmd, &client->jobs.last_foreground);
+        if(input->num_args > 1 && strcmp(input->args[1], "-v") == 0){
+            status_verbose(&client->jobs);
+        }
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "jobs") == 0){
+        jobs_execute(&client->jobs);
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "trace") == 0){
+        trace_execute(input);
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "history") == 0){
+        history_execute(input);
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "output") == 0){
+        output_execute(input, &client->jobs);
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "metrics") == 0){
+        metrics_execute(&client->jobs);
+        client->last_cmd = 0;
+    }
+    else if(strcmp(input->args[0], "time") == 0 || strcmp(input->args[0], "parallel") == 0){
+        printf("bash: %s: not available in serve mode\n", input->args[0]);
+        client->last_status = 1;
+        client->last_cmd = 1;
+    }
+    else if(input->args[0][0] != '#' && strcmp(input->args[0], "") != 0){
+        if(strcmp(input->args[0], "command") == 0 && input->num_args > 1){ //Skip the fast path
+            input->args++;
+            input->num_args--;
+            client->last_status = serve_foreground(state, client);
+            input->args--;
+        }
+        else if(input->num_args > 1 && strcmp(input->args[input->num_args - 1], "&") == 0){
+            client->last_status = background_command(input, &client->jobs, unused, unused, unused);
+        }
+        else if((builtin = fast_builtin(input)) != NULL){
+            client->last_status = run_builtin(builtin, input->args);
+        }
+        else{
+            client->last_status = serve_foreground(state, client);
+        }
+        client->last_cmd = 1;
+    }
+
+    if(strcmp(input->args[0], "exit") != 0){ //Not counted, as at the prompt
+        count_command(input->args, client->last_cmd);
+    }
+    serve_capture_end(state, client);
+    reset_command(input);
+    client->jobs.next_timeout = -1;
+    client->jobs.next_grace = -1;
+    if(client->busy && client->running == NULL && client->output_fd == -1){
+        serve_finish_command(client);
+    }
+}
+
+/**
+ * This function should launch a client's foreground command or pipeline
+ * without waiting for it. Its stages write to a pipe the loop reads, in
+ * place of the daemon's stdout and stderr. Returns 1 if nothing could be
+ * launched, 0 once it is running.
+ * 
+ * Params:
+ *   state - daemon
+ *   client - client whose args are in input
+ */
+int serve_foreground(struct server* state, struct serve_client* client){
+    char** stages[MAX_STAGES];
+    pid_t pids[MAX_STAGES];
+    int output_fds[2];
+
+    int num_stages = split_pipeline(&client->input, stages);
+    if(num_stages == -1){
+        return 1;
+    }
+    if(pipe2(output_fds, O_CLOEXEC) == -1){
+        perror("Failed to create pipe");
+        return 1;
+    }
+
+    fflush(stdout);
+    dup2(output_fds[1], STDOUT_FILENO);
+    dup2(output_fds[1], STDERR_FILENO);
+    start_pipeline(stages, num_stages, 0, -1, pids);
+    fflush(stdout); //Launch errors go with the command's output
+    dup2(state->scratch_fd, STDOUT_FILENO);
+    dup2(state->scratch_fd, STDERR_FILENO);
+    close(output_fds[1]);
+
+    fcntl(output_fds[0], F_SETFL, O_NONBLOCK);
+    client->output_fd = output_fds[0];
+    client->paused = 0;
+    serve_watch(state, client->output_fd, &client->output_watch, EPOLL_CTL_ADD, EPOLLIN);
+
+    client->running = add_job(&client->jobs, pids, num_stages, 0);
+    client->launched = pids[num_stages - 1] != -1;
+    return client->running == NULL; //Set again when it is reaped
+}
+
+/**
+ * This function should check a file the daemon opened for a '<' or '>'. It
+ * was opened with O_NONBLOCK, since opening a FIFO waits for the other end
+ * and would stall every client; a FIFO is refused outright, as reading or
+ * writing it could stall the command forever too. Anything else gets
+ * O_NONBLOCK cleared again for the command. Returns -1, with the fd closed
+ * and the error printed, if it is a FIFO.
+ * 
+ * Params:
+ *   fd - fd open_redirection() opened
+ *   name - redirection target
+ */
+int check_serve_redirection(int fd, char* name){
+    struct stat info;
+
+    if(fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode)){
+        printf("bash: %s: FIFOs can't be redirected in serve mode\n", name);
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return 0;
+}
+
+/**
+ * This function should send the status frame that ends a client's line,
+ * after the message for a command stopped by its deadline
+ * 
+ * Params:
+ *   client - client whose line finished
+ */
+void serve_finish_command(struct serve_client* client){
+    char message[TIMEOUT_MESSAGE + 1];
+
+    client->busy = 0;
+    if(client->timed_out){
+        struct job_usage* record = &client->jobs.last_foreground;
+        int length = format_timed_out(message, sizeof(message) - 1, record->timeout, record->status);
+        message[length++] = '\n';
+        serve_frame(client, 'o', length, message);
+        client->timed_out = 0;
+    }
+    if(client->signal != 0){
+        serve_frame(client, 'k', client->signal, NULL);
+    }
+    else{
+        serve_frame(client, 's', client->last_status, NULL);
+    }
+}
+
+/**
+ * This function should shut the daemon down: every client's session ends,
+ * the socket is removed and the daemon's own resources are released
+ * 
+ * Params:
+ *   state - daemon
+ *   path - socket to remove, or NULL if it was never bound
+ */
+void stop_server(struct server* state, char* path){
+    while(state->num_clients > 0){
+        remove_client(state, state->clients[state->num_clients - 1]);
+    }
+    free(state->clients);
+    if(path != NULL){
+        unlink(path);
+    }
+    int fds[] = {state->listen_fd, state->signal_fd, state->epoll_fd, state->scratch_fd, state->start_fd, state->saved_stdout, state->saved_stderr};
+    for(int i = 0; i < (int)(sizeof(fds) / sizeof(int)); i++){
+        if(fds[i] > 0){
+            close(fds[i]);
+        }
+    }
+    write_metrics_file(NULL, 1);
+    free_history();
+    free_substitution_cache();
+    stop_trace();
+    server = NULL;
+}
+
+/**
+ * This function should be the small client for --serve: it sends stdin to
+ * the daemon line for line, prints the output frames as they arrive and
+ * "terminated by signal N" for killed commands, like the shell does, and
+ * exits with the last status once the daemon closes the connection.
+ * 
+ * Params:
+ *   path - daemon's socket
+ */
+int serve_connect(char* path){
+    struct sockaddr_un address = {0};
+    char buffer[OUTPUT_CHUNK];
+    char* frames = NULL;
+    size_t used = 0, size = 0;
+    int status = 0;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if(fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1){
+        printf("bash: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct pollfd polls[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+    while(1){
+        if(poll(polls, 2, -1) == -1){
+            continue;
+        }
+        if(polls[0].revents != 0){
+            ssize_t num_read = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if(num_read <= 0){
+                shutdown(fd, SHUT_WR);
+                polls[0].fd = -1; //Ignored by poll() from now on
+            }
+            else if(zygote_write(fd, buffer, num_read) == -1){
+                break;
+            }
+        }
+        if(polls[1].revents == 0){
+            continue;
+        }
+
+        if(used + sizeof(buffer) > size){
+            size = used + sizeof(buffer);
+            frames = realloc(frames, size);
+        }
+        ssize_t num_read = read(fd, frames + used, size - used);
+        if(num_read <= 0){
+            break;
+        }
+        used += num_read;
+
+        //Handle every complete frame, keep a partial one for the next read
+        size_t start = 0;
+        char* end;
+        while((end = memchr(frames + start, '\n', used - start)) != NULL){
+            char kind = frames[start];
+            size_t number = strtoul(frames + start + 2, NULL, 10);
+            size_t header = end - (frames + start) + 1;
+            if(kind == 'o'){
+                if(used - start < header + number){
+                    break;
+                }
+                fwrite(frames + start + header, 1, number, stdout);
+                start += header + number;
+                continue;
+            }
+            if(kind == 'k'){
+                printf("terminated by signal %zu\n", number);
+            }
+            status = number;
+            start += header;
+        }
+        fflush(stdout);
+        memmove(frames, frames + start, used - start);
+        used -= start;
+    }
+
+    free(frames);
+    close(fd);
+    return status;
+}
@@ -1,6 +1,7 @@
 #include "smallsh.h"
 
 int SIGTSTPcount = 0; //Global variable to count number of SIGTSTP signals
+int spawn_mode = SPAWN_POSIX; //How child processes are launched, see set_spawn_mode()
 
 /**
  * This function should be called when a SIGINT is caught, display a message,
@@ -24,6 +25,7 @@ void catchSIGINT(int signo){
  */
 void catchSIGTSTP(int signo){
     SIGTSTPcount++;
+    METRIC_ADD(metrics.sigtstp, 1);
     char* message1 = "\nEntering foreground-only mode (& is now ignored)\n";
     char* message2 = "\nExiting foreground-only mode\n";
     
@@ -36,17 +38,64 @@ void catchSIGTSTP(int signo){
 }
 
 /**
- * This function should free the memory associated with a command
- * struct
+ * This function should set up an empty command struct. command_line is
+ * allocated by the first line read, args start small and grow as needed.
+ * 
+ * Params:
+ *   input - command to be initialized
+ */
+void init_command(struct command* input){
+    memset(input, 0, sizeof(struct command));
+    reserve_args(input, 64);
+    input->args[0] = NULL;
+}
+
+/**
+ * This function should free every buffer a command struct owns
  * 
  * Params:
  *   input - command to be freed
  */
-void reset_command(struct command* input){
-    for(int i = 0; i < input->num_args; i++){
-        free(input->args[i]); //Free individual args
-        input->args[i] = NULL;
+void free_command(struct command* input){
+    free(input->command_line);
+    free(input->args);
+    free(input->expansion);
+    free(input->globbed);
+    free(input->substituted);
+    memset(input, 0, sizeof(struct command));
+}
+
+/**
+ * This function should make sure args has room for needed pointers plus the
+ * NULL terminator, doubling it when it doesn't. The array is kept between
+ * commands, so it stops growing once it fits the longest command seen.
+ * 
+ * Params:
+ *   input - command that owns args
+ *   needed - number of args about to be stored
+ */
+void reserve_args(struct command* input, int needed){
+    if(needed < input->args_capacity){
+        return;
     }
+    int capacity = input->args_capacity == 0 ? 64 : input->args_capacity;
+    while(needed >= capacity){
+        capacity *= 2;
+    }
+    input->args = realloc(input->args, capacity * sizeof(char*));
+    input->args_capacity = capacity;
+}
+
+/**
+ * This function should reset a command struct for the next line. Args point
+ * into command_line or the expansion buffer, and every buffer is kept for the
+ * next line, so there is nothing to free.
+ * 
+ * Params:
+ *   input - command to be reset
+ */
+void reset_command(struct command* input){
+    input->args[0] = NULL;
     input->num_args = 0;
 }
 
@@ -57,10 +106,17 @@ void reset_command(struct command* input){
  * Params:
  *   last_status - last status to be displayed
  *   last_cmd - keeps track of last command to verify it wasn't built in
+ *   last_foreground - record of the last foreground job, to tell if it timed out
  */
-void status_execute(int last_status, int last_cmd){
+void status_execute(int last_status, int last_cmd, struct job_usage* last_foreground){
+    char message[TIMEOUT_MESSAGE];
+
     if(last_cmd != 0){
-        if(last_status > 1){
+        if(last_status == TIMEOUT_STATUS && last_foreground->timed_out != 0){
+            format_timed_out(message, sizeof(message), last_foreground->timeout, last_foreground->status);
+            printf("%s\n", message);
+        }
+        else if(last_status > 1){
             printf("terminated by signal %d\n", last_status);
         }
         else{
@@ -69,6 +125,105 @@ void status_execute(int last_status, int last_cmd){
     }
 }
 
+/**
+ * This function should display the resource usage of the last foreground
+ * job and the last background job reported, for status -v
+ * 
+ * Params:
+ *   jobs - job table holding the records
+ */
+void status_verbose(struct job_table* jobs){
+    if(jobs->last_foreground.valid){
+        printf("last foreground pid %d: ", jobs->last_foreground.pid);
+        print_job_usage(&jobs->last_foreground);
+    }
+    if(jobs->last_background.valid){
+        printf("last background pid %d: ", jobs->last_background.pid);
+        print_job_usage(&jobs->last_background);
+    }
+}
+
+/**
+ * This function should handle the command built-in by running the rest of
+ * the line as an external command, skipping the fast path built-ins. Returns
+ * the command's status.
+ * 
+ * Params:
+ *   input - struct holding command args, starting with "command"
+ *   jobs - job table
+ *   SIGINT_action - SIGINT action handler struct
+ *   SIGTSTP_action - SIGTSTP action handler struct
+ *   ignore_action - ignore action handler struct
+ */
+int command_execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){
+    //Drop "command"
+    memmove(input->args, input->args + 1, input->num_args * sizeof(char*));
+    input->num_args--;
+
+    if(input->num_args == 0){
+        return 0;
+    }
+    if(input->num_args > 1 && strcmp(input->args[input->num_args - 1], "&") == 0){
+        return background_command(input, jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+    }
+    return foreground_command(input, jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+}
+
+/**
+ * This function should handle the time built-in command by running the rest
+ * of the line in the foreground, the way it would run without time, then
+ * displaying its wall-clock time and the resource usage of every stage. A
+ * fast path built-in runs in the shell, so its figures are what the shell
+ * itself used meanwhile. Returns the command's status.
+ * 
+ * Params:
+ *   input - struct holding command args, starting with "time"
+ *   jobs - job table
+ *   SIGINT_action - SIGINT action handler struct
+ *   SIGTSTP_action - SIGTSTP action handler struct
+ *   ignore_action - ignore action handler struct
+ */
+int time_execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){
+    struct timespec start, end;
+    struct job_usage record = {0};
+    struct rusage before, after;
+    struct builtin* builtin;
+    int status = 0;
+
+    //Drop "time", and the '&' since a timed command runs in the foreground
+    memmove(input->args, input->args + 1, input->num_args * sizeof(char*));
+    input->num_args--;
+    if(input->num_args > 0 && strcmp(input->args[input->num_args - 1], "&") == 0){
+        input->args[input->num_args - 1] = NULL;
+        input->num_args--;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(input->num_args > 0 && (builtin = fast_builtin(input)) != NULL){ //echo, true, etc. stay in process
+        getrusage(RUSAGE_SELF, &before);
+        status = run_builtin(builtin, input->args);
+        getrusage(RUSAGE_SELF, &after);
+        timersub(&after.ru_utime, &before.ru_utime, &record.usage.ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &record.usage.ru_stime);
+        record.usage.ru_maxrss = after.ru_maxrss;
+        record.usage.ru_nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+        record.usage.ru_nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+    }
+    else if(input->num_args > 0){
+        jobs->last_foreground.valid = 0;
+        status = foreground_command(input, jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+        if(jobs->last_foreground.valid){
+            record = jobs->last_foreground;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    record.real = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    print_job_usage(&record);
+    fflush(stdout);
+    return status;
+}
+
 /**
  * This function should display an error message for file/
  * directory errors
@@ -108,7 +263,6 @@ void cd_execute(struct command* input){
     }
     if(input->num_args >= 2){ //2 or more arguments to cd, if '&' is one of them, remove it
         if(strcmp(input->args[1], "&") == 0){ //Only need to check if 2nd arg is "&" bc next if statement will execute regardless of &
-            free(input->args[1]);
             input->args[1] = NULL;
             input->num_args--;
             if(chdir(getenv("HOME"))){
@@ -123,26 +277,23 @@ void cd_execute(struct command* input){
 }
 
 /**
- * This function should remove redirection symbols and free the associated memory
+ * This function should remove redirection symbols and everything after them.
+ * Returns the new number of args.
  * 
  * Params:
- *   input - command args
+ *   args - NULL-terminated command args
  */
-void remove_redirection(struct command* input){
-    int i = 0;
+int remove_redirection(char** args){
+    int i = 1; //Redirection can't be the first arg
 
     //Loop to find index of first instance of redirection symbols
-    while(strcmp(input->args[i], ">") != 0 && strcmp(input->args[i], "<") != 0){
+    while(args[i] != NULL && strcmp(args[i], ">") != 0 && strcmp(args[i], "<") != 0){
         i++;
     }
 
-    //Given index, clear rest of arguments to leave original (ex: ls > junk becomes ls)
-    while(input->args[i] != NULL){
-        free(input->args[i]);
-        input->args[i] = NULL;
-        input->num_args--; //Need to decrement this to not seg fault when freeing in reset_command()
-        i++;
-    }
+    //Given index, cut off rest of arguments to leave original (ex: ls > junk becomes ls)
+    args[i] = NULL;
+    return i;
 }
 
 /**
@@ -173,222 +324,491 @@ void set_sigactions(struct sigaction SIGINT_action, struct sigaction SIGTSTP_act
 }
 
 /**
- * This function should execute a command in the foreground by using fork() 
- * and execvp(). The child process will ignore SIGTSTP while running but
- * catch and handle SIGINT and parent process will reap child when finished.
+ * This function should check that a command's args and the environment fit
+ * in the kernel's ARG_MAX, counting each string and its pointer the way
+ * execve() does. A single string must also fit in MAX_ARG_STRLEN (32 pages).
+ * Prints bash's error and returns -1 if exec would fail with E2BIG.
  * 
  * Params:
- *   input - command struct that holds arguments
- *   SIGINT_action - SIGINT action handler
- *   SIGTSTP_action - SIGTSTP action handler
- *   ignore_action - ignore action handler
+ *   args - NULL-terminated command args, redirection already removed
  */
-int foreground_command(struct command* input, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){
-    int childExitStatus = -5;
-    pid_t spawnPid = -5;
-    int output_fd = -1;
-    int input_fd = -1;
-    int i = 0;
-    int redirection = 0; //0 if false, 1 if true
-    //signal(SIGTSTP, SIG_IGN); //Ignore SIGTSTP while foreground running
-
-    spawnPid = fork();
+int check_arg_max(char** args){
+    static long arg_max = 0;
+    static size_t max_strlen = 0;
+    size_t total = 0;
+
+    if(arg_max == 0){ //Only depends on the stack limit, look it up once
+        arg_max = sysconf(_SC_ARG_MAX);
+        max_strlen = 32 * (size_t)sysconf(_SC_PAGESIZE);
+    }
+    for(char** arg = args; *arg != NULL; arg++){
+        size_t length = strlen(*arg) + 1;
+        if(length > max_strlen){
+            total = (size_t)-1;
+            break;
+        }
+        total += length + sizeof(char*);
+    }
+    for(char** var = environ; *var != NULL && total <= (size_t)arg_max; var++){
+        total += strlen(*var) + 1 + sizeof(char*);
+    }
+    if(arg_max > 0 && total > (size_t)arg_max){
+        printf("bash: %s: Argument list too long\n", args[0]);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function should find the '<' and '>' redirection targets in a
+ * command without modifying it
+ * 
+ * Params:
+ *   args - NULL-terminated command args
+ *   redir - redirection struct to fill in
+ */
+void find_redirection(char** args, struct redirection* redir){
+    redir->input_file = NULL;
+    redir->output_file = NULL;
+    redir->redirected = 0;
+
+    for(int i = 1; args[i] != NULL; i++){ //Redirection can't be the first arg
+        if(args[i + 1] == NULL){ //Symbol with no target, nothing to open
+            break;
+        }
+        if(strcmp(args[i], ">") == 0){ //If output redirection...
+            redir->output_file = args[i + 1];
+            redir->redirected = 1;
+        }
+        else if(strcmp(args[i], "<") == 0){ //If input redirection...
+            redir->input_file = args[i + 1];
+            redir->redirected = 1;
+        }
+    }
+}
+
+/**
+ * This function should open the files a command is redirected to in the
+ * parent, so a failed open is reported before anything is launched. Any fd
+ * without a redirection is left at -1. The daemon opens them without
+ * blocking and refuses FIFOs, see check_serve_redirection().
+ * 
+ * Params:
+ *   redir - redirection targets from find_redirection()
+ *   input_fd - pointer to the fd to use as stdin (by reference)
+ *   output_fd - pointer to the fd to use as stdout (by reference)
+ */
+int open_redirection(struct redirection* redir, int* input_fd, int* output_fd){
+    int nonblock = server != NULL ? O_NONBLOCK : 0;
+    *input_fd = -1;
+    *output_fd = -1;
+
+    if(redir->input_file != NULL){
+        *input_fd = open(redir->input_file, O_RDONLY | O_CLOEXEC | nonblock);
+        if(*input_fd == -1){ //Failed to open
+            file_directory_error(redir->input_file);
+            return -1;
+        }
+        if(server != NULL && check_serve_redirection(*input_fd, redir->input_file) == -1){
+            *input_fd = -1;
+            return -1;
+        }
+    }
+    if(redir->output_file != NULL){
+        *output_fd = open(redir->output_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | nonblock, 0644);
+        if(*output_fd == -1 && errno == ENXIO && server != NULL){ //FIFO with no reader
+            printf("bash: %s: FIFOs can't be redirected in serve mode\n", redir->output_file);
+        }
+        else if(*output_fd == -1){ //Failed to open
+            file_directory_error(redir->output_file);
+        }
+        else if(server != NULL && check_serve_redirection(*output_fd, redir->output_file) == -1){
+            *output_fd = -1;
+        }
+        if(*output_fd == -1){
+            if(*input_fd != -1){
+                close(*input_fd);
+                *input_fd = -1;
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function should launch a command with posix_spawn(). glibc implements
+ * it with clone(CLONE_VM | CLONE_VFORK), so the shell's page tables are never
+ * copied. Redirection is done with dup2 file actions and SIGINT is reset to
+ * default for foreground commands through the spawn attributes. Ignored
+ * signals stay ignored across exec, so SIGTSTP is ignored in the parent just
+ * long enough for the child to inherit that. Returns -1 with errno set if
+ * the exec failed.
+ * 
+ * Params:
+ *   args - NULL-terminated command args, redirection already removed
+ *   path - resolved path of the executable
+ *   background - 1 if the command will run in the background
+ *   input_fd - fd to use as stdin, or -1
+ *   output_fd - fd to use as stdout, or -1
+ *   error_fd - fd to use as stderr, or -1
+ */
+pid_t spawn_posix(char** args, char* path, int background, int input_fd, int output_fd, int error_fd){
+    pid_t spawnPid = -1;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t default_set, child_mask;
+    struct sigaction ignore_action = {0}, old_action;
+
+    posix_spawn_file_actions_init(&actions);
+    if(input_fd != -1){
+        posix_spawn_file_actions_adddup2(&actions, input_fd, 0);
+    }
+    if(output_fd != -1){
+        posix_spawn_file_actions_adddup2(&actions, output_fd, 1);
+    }
+    if(error_fd != -1){
+        posix_spawn_file_actions_adddup2(&actions, error_fd, 2);
+    }
+
+    posix_spawnattr_init(&attr);
+    sigemptyset(&default_set);
+    if(!background){ //Foreground children can be interrupted, background ones keep SIGINT ignored
+        sigaddset(&default_set, SIGINT);
+    }
+    sigemptyset(&child_mask);
+    posix_spawnattr_setsigdefault(&attr, &default_set);
+    posix_spawnattr_setsigmask(&attr, &child_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    //Handled signals are reset to default on exec, so ignore SIGTSTP while spawning
+    ignore_action.sa_handler = SIG_IGN;
+    sigaction(SIGTSTP, &ignore_action, &old_action);
+    int err = posix_spawn(&spawnPid, path, &actions, &attr, args, environ);
+    sigaction(SIGTSTP, &old_action, NULL);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if(err != 0){ //Exec failed, errno is reported back by posix_spawn
+        errno = err;
+        return -1;
+    }
+    return spawnPid;
+}
+
+/**
+ * This function should launch a command with the classic fork() and execv().
+ * It is kept as a fallback for systems where posix_spawn() misbehaves and as
+ * a baseline for spawn latency measurements. If the cached path has gone
+ * stale the child falls back to searching PATH with execvp().
+ * 
+ * Params:
+ *   args - NULL-terminated command args, redirection already removed
+ *   path - resolved path of the executable
+ *   background - 1 if the command will run in the background
+ *   input_fd - fd to use as stdin, or -1
+ *   output_fd - fd to use as stdout, or -1
+ *   error_fd - fd to use as stderr, or -1
+ */
+pid_t spawn_fork(char** args, char* path, int background, int input_fd, int output_fd, int error_fd){
+    fflush(stdout); //Don't let the child inherit unwritten output
+    pid_t spawnPid = fork();
     switch(spawnPid){
         case -1:{perror("Hull Breach!\n"); exit(1); break;} //Error in forking
         case 0:{
-            while (input->args[i] != NULL){ //Loops until end of arguments to find all redirections
-                if (strcmp(input->args[i], ">") == 0 && i != 0){ //If output redirection...
-                    output_fd = open(input->args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (output_fd == -1){ //Failed to open
-                        file_directory_error(input->args[i + 1]);
-                        exit(1);
-                    }
-                    if (dup2(output_fd, 1) == -1){ //Failed to redirect
-                        perror("Failed to redirect output\n");
-                        exit(1);
-                    }
-                    redirection = 1; //Redirection happened
-                }
-                if (strcmp(input->args[i], "<") == 0 && i != 0){ //If input redirection...
-                    input_fd = open(input->args[i + 1], O_RDONLY);
-                    if (input_fd == -1){ //Failed to open
-                        file_directory_error(input->args[i + 1]);
-                        exit(1);
-                    }
-
-                    if (dup2(input_fd, 0) == -1){ //Failed to redirect
-                        perror("Failed to redirect input\n");
-                        exit(1);
-                    }
-                    redirection = 1; //Redirection happened
-                }
-                i++;
+            if(TRACING){
+                trace_child();
             }
-
-            if (redirection){//Remove redirection symbols
-                remove_redirection(input);
+            TRACE(TRACE_DUP2, 'B', 0);
+            if(input_fd != -1 && dup2(input_fd, 0) == -1){ //Failed to redirect
+                perror("Failed to redirect input\n");
+                exit(1);
+            }
+            if(output_fd != -1 && dup2(output_fd, 1) == -1){ //Failed to redirect
+                perror("Failed to redirect output\n");
+                exit(1);
             }
-            
-            //Set signal handler
-            signal(SIGINT, catchSIGINT); 
+            if(error_fd != -1 && dup2(error_fd, 2) == -1){ //Failed to redirect
+                perror("Failed to redirect error output\n");
+                exit(1);
+            }
+            TRACE(TRACE_DUP2, 'E', 0);
+
+            //Set signal handlers, background processes ignore SIGINT
+            signal(SIGINT, background ? SIG_IGN : catchSIGINT);
             signal(SIGTSTP, SIG_IGN);
             //Chose to use signal() instead of sigaction() to simplify
 
-            execvp(input->args[0], input->args);
-            command_error(input->args[0]);
-            
-            //Free memory used by child bc exec did not
-            reset_command(input);
-            free(input);
+            sigset_t child_mask; //The shell blocks SIGCHLD for its signalfd, don't pass that on
+            sigemptyset(&child_mask);
+            sigprocmask(SIG_SETMASK, &child_mask, NULL);
 
+            TRACE(TRACE_EXEC, 'i', 0);
+            execv(path, args);
+            if(errno == ENOENT){ //Cached binary is gone, search PATH again
+                execvp(args[0], args);
+            }
+            command_error(args[0]);
             exit(1);
             break;
         }
-        default:{
-            signal(SIGTSTP, catchSIGTSTP);
-            waitpid(spawnPid, &childExitStatus, 0);
-            if(childExitStatus >= 256){//Handles weird formatting stuff for exit()
-                childExitStatus /= 256;
-            }
-            if(childExitStatus > 1){//If terminated by a signal
-                status_execute(childExitStatus, 1);
+    }
+    return spawnPid;
+}
+
+/**
+ * This function should open the command's own redirections, strip the
+ * redirection symbols and start the command with the current spawn_mode,
+ * using the PATH cache to find the executable. A '<' or '>' on the command
+ * overrides the fd it was given. Returns the child's pid, or -1 if nothing
+ * was launched.
+ * 
+ * Params:
+ *   args - NULL-terminated command args
+ *   background - 1 if the command will run in the background
+ *   input_fd - default fd to use as stdin (pipe, /dev/null), or -1 to inherit the shell's
+ *   output_fd - default fd to use as stdout, or -1 to inherit the shell's
+ *   error_fd - fd to use as stderr, or -1 to inherit the shell's
+ */
+pid_t launch_command(char** args, int background, int input_fd, int output_fd, int error_fd){
+    struct redirection redir;
+    int redirect_input_fd = -1;
+    int redirect_output_fd = -1;
+    pid_t spawnPid = -1;
+
+    find_redirection(args, &redir);
+    if(open_redirection(&redir, &redirect_input_fd, &redirect_output_fd) == -1){
+        return -1;
+    }
+    if(redir.redirected){ //Remove redirection symbols
+        remove_redirection(args);
+    }
+    if(redirect_input_fd != -1){
+        input_fd = redirect_input_fd;
+    }
+    if(redirect_output_fd != -1){
+        output_fd = redirect_output_fd;
+    }
+
+    char* path = NULL;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TRACE(TRACE_SPAWN, 'B', 0);
+    if(check_arg_max(args) == -1){
+        //exec would fail with E2BIG, the error is already printed
+    }
+    else if((path = lookup_command_path(args[0])) == NULL){
+        command_error(args[0]);
+    }
+    else if(spawn_mode == SPAWN_FORK){
+        spawnPid = spawn_fork(args, path, background, input_fd, output_fd, error_fd);
+    }
+    else{
+        spawnPid = spawn_mode == SPAWN_ZYGOTE ? spawn_zygote(args, path, background, input_fd, output_fd, error_fd) : spawn_posix(args, path, background, input_fd, output_fd, error_fd);
+        if(spawnPid == -1 && errno == ENOENT && forget_command_path(args[0])){ //Stale cache entry, retry once
+            path = lookup_command_path(args[0]);
+            if(path != NULL){
+                spawnPid = spawn_mode == SPAWN_ZYGOTE ? spawn_zygote(args, path, background, input_fd, output_fd, error_fd) : spawn_posix(args, path, background, input_fd, output_fd, error_fd);
             }
-            fflush(stdout);
-            break;
         }
+        if(spawnPid == -1){
+            command_error(args[0]);
+        }
+    }
+    TRACE(TRACE_SPAWN, 'E', spawnPid);
+    if(spawnPid != -1){
+        record_since(&metrics.spawn, &start);
+    }
+
+    //Child has its own copies now, close the files we opened
+    if(redirect_output_fd != -1){
+        close(redirect_output_fd);
+    }
+    if(redirect_input_fd != -1){
+        close(redirect_input_fd);
+    }
+
+    return spawnPid;
+}
+
+/**
+ * This function should set spawn_mode from the SMALLSH_SPAWN environment
+ * variable ("fork", "zygote" or "spawn"), defaulting to posix_spawn(). The
+ * zygote is started here, while the shell is still small, and posix_spawn()
+ * is used if it can't be.
+ */
+void set_spawn_mode(void){
+    char* mode = getenv("SMALLSH_SPAWN");
+    if(mode != NULL && strcmp(mode, "fork") == 0){
+        spawn_mode = SPAWN_FORK;
+    }
+    else if(mode != NULL && strcmp(mode, "zygote") == 0 && start_zygote() == 0){
+        spawn_mode = SPAWN_ZYGOTE;
     }
+    else{
+        spawn_mode = SPAWN_POSIX;
+    }
+}
 
-    if(output_fd != -1){ //Close if open
-        close(output_fd);
+/**
+ * This function should execute a command or pipeline in the foreground with
+ * start_pipeline(). The children ignore SIGTSTP while running but use the
+ * default SIGINT action. The pipeline is added to the job table as one job
+ * and the parent waits until every stage is reaped. The job's status is the
+ * status of its last stage.
+ * 
+ * Params:
+ *   input - command struct that holds arguments
+ *   jobs - job table
+ *   SIGINT_action - SIGINT action handler
+ *   SIGTSTP_action - SIGTSTP action handler
+ *   ignore_action - ignore action handler
+ */
+int foreground_command(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){
+    int childExitStatus = -5;
+    char** stages[MAX_STAGES];
+    pid_t pids[MAX_STAGES];
+    char message[TIMEOUT_MESSAGE];
+    struct timespec start;
+
+    int num_stages = split_pipeline(input, stages);
+    if(num_stages == -1){
+        return 1;
+    }
+    start_pipeline(stages, num_stages, 0, -1, pids);
+
+    struct job* job = add_job(jobs, pids, num_stages, 0);
+    if(job == NULL){ //Nothing ran, same status as a child that called exit(1)
+        return 1;
+    }
+    signal(SIGTSTP, catchSIGTSTP);
+    TRACE(TRACE_WAIT, 'B', job->pid);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wait_for_job(jobs, job);
+    record_since(&metrics.wait, &start);
+    TRACE(TRACE_WAIT, 'E', job->status);
+    childExitStatus = job->status;
+    pid_t job_pid = job->pid;
+    record_job_usage(job, &jobs->last_foreground);
+    remove_job(jobs, job);
+
+    if(job_pid != pids[num_stages - 1]){ //Last stage never ran
+        return 1;
+    }
+    if(jobs->last_foreground.timed_out != 0){ //Its deadline passed
+        format_timed_out(message, sizeof(message), jobs->last_foreground.timeout, childExitStatus);
+        printf("%s\n", message);
+        fflush(stdout);
+        return TIMEOUT_STATUS;
+    }
+    if(childExitStatus >= 256){//Handles weird formatting stuff for exit()
+        childExitStatus /= 256;
     }
-    if(input_fd != -1){ //Close if open
-        close(input_fd);
+    if(childExitStatus > 1){//If terminated by a signal
+        status_execute(childExitStatus, 1, &jobs->last_foreground);
     }
+    fflush(stdout);
 
     return childExitStatus;
 }
 
 /**
- * This function should execute a command in the background by using fork()
- * and execvp(). The child process ignores both SIGINT and SIGTSTP. The child
- * process's PID is added to an array of background pids to be periodically
- * checked later in the program and reaped. 
+ * This function should execute a command or pipeline in the background with
+ * start_pipeline(). The children ignore both SIGINT and SIGTSTP. The
+ * pipeline is added to the job table as one job, which is reaped as soon as
+ * it finishes and reported before the next prompt. Its stdout and stderr are
+ * captured into the job's ring buffer for the output built-in. If the
+ * admission limits are reached the command is queued instead and started
+ * by the reaper once there is room.
  * 
  * Params:
  *   input - command struct that holds args
- *   background_PIDS - array of background process ids
- *   num_background_proc - pointer to int holding number of current running background processes (by reference)
+ *   jobs - job table
  *   SIGINT_action - SIGINT action handler struct
  *   SIGTSTP_action - SIGTSTP action handler struct
  *   ignore_action - ignore action handler struct
  */
-int background_command(struct command* input, pid_t* background_PIDS, int* num_background_proc, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){
-    int childExitStatus = -5;
-    pid_t spawnPid = -5;
-    int output_fd = -1;
-    int input_fd = -1;
-    int i = 0;
-    int redirection = 0; //0 if false, 1 if true
-
-    //Free memory used by '&'
-    free(input->args[input->num_args - 1]);
+int background_command(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){
+    //Remove '&'
     input->args[input->num_args - 1] = NULL;
     input->num_args--;
 
-    spawnPid = fork();
-    switch(spawnPid){
-        case -1:{perror("Hull Breach!\n"); exit(1); break;}
-        case 0:{
-            while (input->args[i] != NULL){ //Loops to find all redirections
-                if (strcmp(input->args[i], ">") == 0 && i != 0){ //If output redirection
-                    output_fd = open(input->args[i + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (output_fd == -1){ //Failed to open
-                        file_directory_error(input->args[i + 1]);
-                        exit(1);
-                    }
-
-                    if (dup2(output_fd, 1) == -1){ //Failed to redirect
-                        perror("Failed to redirect output\n");
-                        exit(1);
-                    }
-                    redirection = 1; //Redirection happened
-                }
-                if (strcmp(input->args[i], "<") == 0 && i != 0){ //If input redirection
-                    input_fd = open(input->args[i + 1], O_RDONLY);
-                    if (input_fd == -1){ //Failed to open
-                        file_directory_error(input->args[i + 1]);
-                        exit(1);
-                    }
-
-                    if (dup2(input_fd, 0) == -1){ //Failed to redirect
-                        perror("Failed to redirect input\n");
-                        exit(1);
-                    }
-                    redirection = 1; //Redirection happened
-                }
-                i++;
-            }
+    char* reason = admission_hold(jobs);
+    if(reason != NULL || jobs->queue_head != NULL){ //Too busy, or jobs are already waiting ahead of it
+        int status = queue_background(input, jobs, reason != NULL ? reason : "jobs waiting");
+        admit_jobs(jobs);
+        return status;
+    }
 
-            if (redirection){ //If redirection happened, remove symbols
-                remove_redirection(input);
-            }
+    struct job* job = launch_background(input, jobs);
+    if(job == NULL){
+        return 1;
+    }
 
-            else{ //If no redirection in background processes...
-                if(input_fd == -1){ //Background processes redirect to /dev/null
-                    input_fd = open("/dev/null", O_RDONLY);
-                    if(input_fd == -1){
-                        file_directory_error("/dev/null");
-                        exit(1);
-                    }
-                    if (dup2(input_fd, 0) == -1){
-                        perror("Failed to redirect input\n");
-                        exit(1);
-                    }
-                }
-                if(output_fd == -1){ //Background processes redirect to /dev/null
-                    output_fd = open("/dev/null", O_WRONLY);
-                    if(output_fd == -1){
-                        file_directory_error("/dev/null");
-                        exit(1);
-                    }
-                    if (dup2(output_fd, 1) == -1){
-                        perror("Failed to redirect input\n");
-                        exit(1);
-                    }
-                }
-            }
+    jobs->last_background_pid = job->pid; //For $!
+    printf("background process pid is %d\n", job->pid);
+    fflush(stdout);
 
-            signal(SIGINT, SIG_IGN); //Ignore SIGINT in background process
-            signal(SIGTSTP, SIG_IGN); //Ignore SIGTSTP in background process
-            
-            execvp(input->args[0], input->args);
-            command_error(input->args[0]);
+    return 0;
+}
 
-            //Free memory used by child process, because exec did not execute properly
-            reset_command(input); 
-            free(input); 
+/**
+ * This function should start a background command or pipeline and add it
+ * to the job table. Its stdout and stderr go to a pipe drained into the
+ * job's ring buffer. With a placement policy or a leading "@cpus=LIST" its
+ * stages are pinned to CPUs. Returns the job, or NULL if nothing ran.
+ * 
+ * Params:
+ *   input - command struct that holds args, '&' already removed
+ *   jobs - job table
+ */
+struct job* launch_background(struct command* input, struct job_table* jobs){
+    char** stages[MAX_STAGES];
+    pid_t pids[MAX_STAGES];
+    struct placement* placement;
 
-            exit(1);
-            break;
-        }
-        default:{
-            printf("background process pid is %d\n", spawnPid);
-            fflush(stdout);
-            background_PIDS[*num_background_proc] = spawnPid; //Add new pid to array
-            (*num_background_proc)++; //Increment number of background processes
-            break;
-        }
+    if(plan_placement(input, &placement) == -1){
+        return NULL;
+    }
+    int num_stages = split_pipeline(input, stages);
+    if(num_stages == -1){
+        free(placement);
+        return NULL;
     }
 
-    //Close open files
-    if(output_fd != -1){
-        close(output_fd);
+    //stdout and stderr go to a pipe drained into the job's ring buffer
+    int capture_fds[2] = {-1, -1};
+    if(output_ring_size > 0 && pipe2(capture_fds, O_CLOEXEC) == -1){
+        capture_fds[0] = -1;
+        capture_fds[1] = -1;
     }
-    if(input_fd != -1){
-        close(input_fd);
+    if(placement != NULL){ //Stages inherit the shell's CPUs and memory policy
+        apply_placement(placement);
+    }
+    start_pipeline(stages, num_stages, 1, capture_fds[1], pids);
+    if(placement != NULL){
+        restore_placement(placement);
+    }
+    if(capture_fds[1] != -1){
+        close(capture_fds[1]);
     }
 
-    return childExitStatus / 256; //Divide by 256 bc exit() multiplies by 256
+    struct job* job = add_job(jobs, pids, num_stages, 1);
+    if(job == NULL){
+        if(capture_fds[0] != -1){
+            close(capture_fds[0]);
+        }
+        free(placement);
+        return NULL;
+    }
+    job->placement = placement;
+    count_placement(placement, 1);
+    if(capture_fds[0] != -1){
+        capture_job_output(jobs, job, capture_fds[0]);
+    }
+    jobs->num_background_running++;
+    return job;
 }
 
 /**
@@ -397,120 +817,193 @@ int background_command(struct command* input, pid_t* background_PIDS, int* num_b
  * 
  * Params:
  *   input - command struct that holds args
- *   background_PIDS - array of background process ids
- *   num_background_proc - pointer to int holding number of current running background processes (by reference)
+ *   jobs - job table
  *   SIGINT_action - SIGINT action handler struct
  *   SIGTSTP_action - SIGTSTP action handler struct
  *   ignore_action - ignore action handler struct
  */
-int execute(struct command* input, pid_t* background_PIDS, int* num_background_proc, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){   
-    if(strcmp(input->args[input->num_args - 1], "&") == 0){//If & --> background command
-        return background_command(input, background_PIDS, num_background_proc, SIGINT_action, SIGTSTP_action, ignore_action);
+int execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){   
+    struct builtin* builtin;
+
+    if(input->num_args > 1 && strcmp(input->args[input->num_args - 1], "&") == 0){//If & --> background command
+        return background_command(input, jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+    }
+    else if((builtin = fast_builtin(input)) != NULL){//echo, true, etc. run without a new process
+        return run_builtin(builtin, input->args);
     }
     else{
-        return foreground_command(input, SIGINT_action, SIGTSTP_action, ignore_action);
+        return foreground_command(input, jobs, SIGINT_action, SIGTSTP_action, ignore_action);
     } 
 }
 
 /**
- * This function should replace any instance of "$$" with the process id of
- * the current running process.
+ * This function should reap any finished children and display an
+ * informational message for each background job that has ended since the
+ * last prompt, then drop it from the job table
  * 
  * Params:
- *   command - command to search and replace
+ *   jobs - job table
  */
-void replace_PID(char* command){
-    char pid[10]; //Won't be more than 10 characters
-    sprintf(pid, "%d", getpid()); //Set pid string
+void check_background_processes(struct job_table* jobs){
+    if(jobs->num_jobs == 0){ //No children to reap, skip the syscalls
+        return;
+    }
+    reap_children(jobs);
+    report_background_processes(jobs);
+}
 
-    char* ptr = command;
-    char* found;
+/**
+ * This function should display a message for each background job that has
+ * been reaped since the last call, then drop it from the job table unless
+ * its output is still to be read
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void report_background_processes(struct job_table* jobs){
+    char message[TIMEOUT_MESSAGE];
 
-    //While $$ still in the command
-    while((found = strstr(ptr, "$$")) != NULL){
-        char temp[2048];
-        snprintf(temp, found - command + 1, "%s", command);
-        strcat(temp, pid);
-        strcat(temp, found + strlen("$$"));
-        strcpy(command, temp);
-        ptr = found + strlen(pid);
+    while(jobs->done_head != NULL){
+        struct job* job = jobs->done_head;
+        jobs->done_head = job->next_done;
+        record_since(&metrics.reap_lag, &job->end);
+        if(job->timed_out != 0){
+            format_timed_out(message, sizeof(message), job->timeout, job->status);
+            printf("background pid %d is done: %s\n", job->pid, message);
+        }
+        else if(WIFSIGNALED(job->status)){
+            printf("background pid %d is done: terminated by signal %d\n", job->pid, WTERMSIG(job->status));
+        }
+        else{
+            printf("background pid %d is done: exit value %d\n", job->pid, WEXITSTATUS(job->status));
+        }
+        record_job_usage(job, &jobs->last_background);
+        if(job->output.total > 0){ //Keep it until its output is read
+            keep_job_output(jobs, job);
+        }
+        else{
+            remove_job(jobs, job);
+        }
     }
+    jobs->done_tail = NULL;
 }
 
 /**
- * This function should loop through background pids array to wait() on
- * each of the processes with the WNOHANG flag. Function will then display
- * an informational message about the process that just ended
+ * This function should end all background processes in the job table
  * 
  * Params:
- *   background_PIDS - array of background process ids
- *   num_background_proc - pointer to int holding number of current running background processes
+ *   jobs - job table
  */
-void check_background_processes(pid_t* background_PIDS, int* num_background_proc){
-    int childExitStatus = -5;
-    for(int i = 0; i < *num_background_proc; i++){
-        if(waitpid(background_PIDS[i], &childExitStatus, WNOHANG) != 0){ //If process ended...
-            if(childExitStatus > 1){
-                printf("background pid %d is done: terminated by signal %d\n", background_PIDS[i], childExitStatus);
-            }
-            else{
-                printf("background pid %d is done: exit value %d\n", background_PIDS[i], childExitStatus);
+void end_background_processes(struct job_table* jobs){
+    for(int i = 0; i < jobs->num_jobs; i++){
+        struct job* job = jobs->jobs[i];
+        for(int j = 0; j < job->num_pids; j++){
+            if(find_job(jobs, job->pids[j]) == job){ //Still running
+                kill(job->pids[j], 15); //Kills running child processes with terminate signal
             }
-            for(int j = i; j < *num_background_proc; j++){ //Shift elemenmts down when removed
-                background_PIDS[j] = background_PIDS[j + 1];
-            }
-            (*num_background_proc)--;
         }
     }
 }
 
 /**
- * This function should end all background processes in the background_PIDS array
+ * This function should split a line into args in place, so each arg points
+ * into the line
  * 
  * Params:
- *   background_PIDS - array of background process ids
- *   num_background_proc - pointer to int holding number of current running background processes
+ *   input - command struct to hold args
+ *   line - NUL-terminated line to split, modified in place
  */
-void end_background_processes(pid_t* background_PIDS, int* num_background_proc){
-    int childExitStatus = -5;
-    for(int i = 0; i < *num_background_proc; i++){
-        kill(background_PIDS[i], 15); //Kills running child processes with terminate signal
+void split_command(struct command* input, char* line){
+    char* ptr = line;
+    input->num_args = 0;
+
+    //Loop to put args in args[] until the end of the line
+    while(1){
+        while(*ptr == ' ' || *ptr == '\t' || *ptr == '\n'){ //Skip whitespace between args
+            ptr++;
+        }
+        if(*ptr == '\0'){
+            break;
+        }
+        reserve_args(input, input->num_args + 1);
+        input->args[input->num_args] = ptr;
+        input->num_args++;
+        while(*ptr != '\0' && *ptr != ' ' && *ptr != '\t' && *ptr != '\n'){ //Find end of arg
+            ptr++;
+        }
+        if(*ptr == '\0'){
+            break;
+        }
+        *ptr = '\0'; //Terminate arg in place
+        ptr++;
+    }
+
+    if(input->num_args == 0){//Accounts for signals and empty command lines
+        line[0] = '\0';
+        input->args[0] = line;
+        input->num_args = 1;
+    }
+    input->args[input->num_args] = NULL;
+}
+
+/**
+ * This function should check if a line is a comment: its first char that
+ * isn't a space or tab is '#'
+ * 
+ * Params:
+ *   line - line to check
+ *   length - bytes of line
+ */
+int is_comment(char* line, size_t length){
+    size_t i = 0;
+
+    while(i < length && (line[i] == ' ' || line[i] == '\t')){ //Same separators as split_command()
+        i++;
     }
+    return i < length && line[i] == '#';
 }
 
 /**
- * This function should populate the command struct with the user's input from
- * the command_line attribute by using strtok_r() and dynamically allocated
- * memory.
+ * This function should populate the command struct with a line of input,
+ * either command_line or a line of a script. Lines without a '$' are split
+ * in place, lines with one go through expand_command(), which runs any
+ * $(...) too. Neither allocates
+ * memory per command. Args with glob characters are then replaced by the
+ * paths they match. Comments are only split, so a $(...) in one never runs.
  * 
  * Params:
  *   input - command struct to hold commands and arguments
+ *   line - NUL-terminated line to split, modified in place
+ *   last_status - value for $?
+ *   last_background - value for $!, 0 if no background job has run
  */
-void populate_command(struct command* input){
-    //Sets up and retrieves first arg using strtok_r()
-    char* saveptr;
-    char* token = strtok_r(input->command_line, " ", &saveptr);
-    if(token == NULL){//Accounts for signals and empty command lines
-        token = " \0"; //Specific format to allocate and accurately replace last arg with '\0'
-    }
-    input->args[0] = calloc(strlen(token) + 1, sizeof(char)); //Allocates memory for the token
-    strcpy(input->args[0], token); //Sets input->args[0] to token
-    input->num_args++;
-
-    //Loop to put args in args[] until saveptr == '\0'
-    while(strcmp(saveptr, "\0")){
-        token = strtok_r(NULL, " ", &saveptr);
-        input->args[input->num_args] = calloc(strlen(token) + 1, sizeof(char));
-        strcpy(input->args[input->num_args], token);
-        input->num_args++;
+void populate_command(struct command* input, char* line, int last_status, pid_t last_background){
+    int comment = is_comment(line, strlen(line));
+    int globbing = !comment && strpbrk(line, "*?[") != NULL; //Checked before splitting puts NULs in the line
+
+    if(!comment && strchr(line, '$') != NULL){ //Variables to expand, can't be done in place
+        expand_command(input, line, last_status, last_background);
+        globbing = 1; //Values can hold glob characters too
     }
-    //Sets last command's terminator to \0 instead of newline to accurately execute
-    int length = strlen(input->args[input->num_args - 1]);
-    input->args[input->num_args - 1][length - 1] = '\0';
+    else{
+        split_command(input, line);
+    }
+    if(globbing){
+        expand_globs(input);
+    }
+    strip_background(input);
+}
 
+/**
+ * This function should drop a trailing '&' while the shell is in
+ * foreground-only mode
+ * 
+ * Params:
+ *   input - command struct holding args
+ */
+void strip_background(struct command* input){
     if(SIGTSTPcount % 2 != 0){ //If in foreground-only mode...
-        if(strcmp(input->args[input->num_args - 1], "&") == 0){ //If last arg is a background command
-            free(input->args[input->num_args - 1]);
+        if(input->num_args > 1 && strcmp(input->args[input->num_args - 1], "&") == 0){ //If last arg is a background command
             input->args[input->num_args - 1] = NULL;
             input->num_args--;
         }
@@ -518,36 +1011,146 @@ void populate_command(struct command* input){
 }
 
 /**
- * This function should prompt the user for input until they enter 'exit'.
- * This is the main action function for the entire program and calls to
- * every other function.
+ * This function should read one line of stdin into a buffer grown to fit,
+ * like getline() but with read(2), so nothing past the newline is left in a
+ * buffer poll() can't see, or that a command reading the shell's stdin would
+ * miss. A terminal hands over at most a line per read() and a file is read
+ * in chunks and seeked back to just past the newline; a pipe can't be, so
+ * it's read a byte at a time, as bash does. Returns the line's length, or
+ * -1 at end of input.
+ * 
+ * Params:
+ *   line - pointer to the buffer, grown with realloc() (by reference)
+ *   size - pointer to the buffer's size (by reference)
+ */
+ssize_t read_input_line(char** line, size_t* size){
+    int seekable = lseek(STDIN_FILENO, 0, SEEK_CUR) != -1;
+    int chunked = seekable || isatty(STDIN_FILENO);
+    size_t length = 0;
+
+    while(1){
+        if(*size < length + 128){
+            *size = *size < 128 ? 128 : *size * 2;
+            *line = realloc(*line, *size);
+        }
+        ssize_t num_read = read(STDIN_FILENO, *line + length, chunked ? *size - length - 1 : 1);
+        if(num_read == -1 && errno == EINTR){ //SIGTSTP while the user types
+            continue;
+        }
+        if(num_read <= 0){
+            break;
+        }
+        char* newline = memchr(*line + length, '\n', num_read);
+        if(newline != NULL){
+            size_t used = newline - (*line + length) + 1;
+            if(seekable && used < (size_t)num_read){
+                lseek(STDIN_FILENO, (off_t)used - num_read, SEEK_CUR); //Leave the next line for the next read
+            }
+            length += used;
+            break;
+        }
+        length += num_read;
+    }
+    if(length == 0){
+        return -1;
+    }
+    (*line)[length] = '\0';
+    return length;
+}
+
+/**
+ * This function should get the next line to run. Interactively it prints the
+ * prompt and reads into command_line, which read_input_line() grows to fit any line.
+ * In script mode it takes the next line of the script in place. Returns NULL
+ * at end of input.
+ * 
+ * Params:
+ *   input - command struct holding command_line
+ *   script - script being run, or NULL for interactive mode
+ *   jobs - job table, its background output is drained while waiting
+ */
+char* read_command_line(struct command* input, struct script* script, struct job_table* jobs){
+    char* line = NULL;
+
+    if(script == NULL){
+        printf(": "); //Simple prompt line
+        fflush(stdout); //Prompt has no newline, make sure it shows even when stdout isn't a terminal
+        TRACE(TRACE_PROMPT, 'i', 0);
+        TRACE(TRACE_READ_LINE, 'B', 0);
+        wait_for_input(jobs); //Keep draining background output while the user types
+        if(read_input_line(&input->command_line, &input->line_size) == -1){ //End of input, same as exit
+            line = NULL;
+        }
+        else{
+            line = input->command_line; //read_input_line() may have moved it
+        }
+    }
+    else{
+        TRACE(TRACE_READ_LINE, 'B', 0);
+        line = next_script_line(script, &input->command_line, &input->line_size);
+    }
+    TRACE(TRACE_READ_LINE, 'E', line != NULL);
+    return line;
+}
+
+/**
+ * This function should run commands until 'exit' or the end of input, either
+ * prompting the user or walking a script. This is the main action function
+ * for the entire program and calls to every other function. In script mode
+ * there is no prompt and stdout is only flushed when a child is launched.
+ * Returns the last status.
  * 
  * Params:
  *   input - command struct to hold commands/arguments
+ *   script - script to run, or NULL to prompt the user
  */
-void prompt(struct command* input){
+int prompt(struct command* input, struct script* script){
     int last_status = 0; //Stores the exit status of the last command
     int last_cmd = -1; //Only for determining if last cmd was built-in: 0-built in, 1-not built-in
-    pid_t background_PIDS[30]; //Stores background process IDs, assume no more than 30 PIDs
-    int num_background_proc = 0; //Number of background processes, used in conjunction with background_PIDS arr
+    struct job_table jobs; //Every running command/pipeline, grows as needed
+    char* line;
 
     //Initialize sigaction structs
     struct sigaction SIGINT_action = {0}, SIGTSTP_action = {0}, ignore_action = {0};
+
+    init_job_table(&jobs); //Blocks SIGCHLD, children are reaped through jobs.sigchld_fd
+    init_expansion(); //Caches the pid for $$
+    init_trace(); //Before the zygote starts so it shares the ring, on if SMALLSH_TRACE is set
+    set_spawn_mode(); //posix_spawn() unless SMALLSH_SPAWN=fork
+    set_relay_mode(); //Relay cat/tee stages with splice() if SMALLSH_RELAY=splice
+    set_output_capture(); //Background output ring size from SMALLSH_OUTPUT_BUFFER
+    set_admission(); //Background job limits from SMALLSH_ADMIT
+    set_placement(); //Background job CPU placement from SMALLSH_PLACEMENT
+    set_history(); //Persistent history file from SMALLSH_HISTORY or ~/.smallsh_history
+    set_timeouts(); //Default job deadline from SMALLSH_TIMEOUT
+    set_pure_commands(); //$(...) commands whose output is memoized, from SMALLSH_PURE
+    set_metrics(); //Metrics file from SMALLSH_METRICS
+    set_sigactions(SIGINT_action, SIGTSTP_action, ignore_action);
     
     //While loop to execute shell
     while(1){
-        set_sigactions(SIGINT_action, SIGTSTP_action, ignore_action); //Set/reset sigactions before restoring command access
-        check_background_processes(background_PIDS, &num_background_proc); //Checks before returning command line to user
-        memset(input->command_line, '\0', 2048); //Reset command_line
-        printf(": "); //Simple prompt line
-        fgets(input->command_line, 2048, stdin);
-
-        //If $$ found in command, replace with PID
-        if(strstr(input->command_line, "$$")){
-            replace_PID(input->command_line);
+        if(script == NULL){
+            set_sigactions(SIGINT_action, SIGTSTP_action, ignore_action); //Set/reset sigactions before restoring command access
         }
+        check_background_processes(&jobs); //Checks before returning command line to user
 
-        populate_command(input);
+        if(script != NULL && script->cache != NULL){ //Parsed on an earlier run
+            if(next_cached_command(script, input, last_status, jobs.last_background_pid) == 0){
+                break;
+            }
+        }
+        else{
+            line = read_command_line(input, script, &jobs);
+            if(line == NULL){
+                break;
+            }
+            if(script == NULL){
+                add_history(line);
+            }
+            TRACE(TRACE_POPULATE, 'B', 0);
+            populate_command(input, line, last_status, jobs.last_background_pid);
+            TRACE(TRACE_POPULATE, 'E', input->num_args);
+        }
 
         //PRINTING FOR TESTING PURPOSES ONLY
         //printf("\n1: %s 2: %s 3: %s 4: %s", input->args[0], input->args[1], input->args[2], input->args[3]);
@@ -555,8 +1158,7 @@ void prompt(struct command* input){
 
         //exit- built-in command
         if(strcmp(input->args[0], "exit") == 0){
-            reset_command(input); //Free memory
-            end_background_processes(background_PIDS, &num_background_proc);
+            reset_command(input);
             break;
         }
 
@@ -566,19 +1168,99 @@ void prompt(struct command* input){
             last_cmd = 0;
         }
         
-        //status- built-in command
+        //hash- built-in command, shows or edits the PATH cache
+        else if(strcmp(input->args[0], "hash") == 0){
+            hash_execute(input);
+            last_cmd = 0;
+        }
+
+        //parallel- built-in command, fans a command template out over input lines
+        else if(strcmp(input->args[0], "parallel") == 0){
+            last_status = parallel_execute(input, &jobs);
+            last_cmd = 1; //Ran external commands
+        }
+
+        //status- built-in command, -v adds resource usage
         else if(strcmp(input->args[0], "status") == 0){
-            status_execute(last_status, last_cmd);
+            status_execute(last_status, last_cmd, &jobs.last_foreground);
+            if(input->num_args > 1 && strcmp(input->args[1], "-v") == 0){
+                status_verbose(&jobs);
+            }
+            last_cmd = 0;
+        }
+
+        //jobs- built-in command, lists background jobs
+        else if(strcmp(input->args[0], "jobs") == 0){
+            jobs_execute(&jobs);
             last_cmd = 0;
         }
+
+        //trace- built-in command, starts, stops or dumps the event trace
+        else if(strcmp(input->args[0], "trace") == 0){
+            trace_execute(input);
+            last_cmd = 0;
+        }
+
+        //history- built-in command, lists or searches the shared history
+        else if(strcmp(input->args[0], "history") == 0){
+            history_execute(input);
+            last_cmd = 0;
+        }
+
+        //output- built-in command, shows a background job's captured output
+        else if(strcmp(input->args[0], "output") == 0){
+            output_execute(input, &jobs);
+            last_cmd = 0;
+        }
+
+        //metrics- built-in command, prints the metrics in Prometheus text format
+        else if(strcmp(input->args[0], "metrics") == 0){
+            metrics_execute(&jobs);
+            last_cmd = 0;
+        }
+
+        //time- built-in command, times the rest of the line
+        else if(strcmp(input->args[0], "time") == 0){
+            last_status = time_execute(input, &jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+            last_cmd = 1; //Ran an external command
+        }
+        
+        //timeout- built-in command, runs the rest of the line with a deadline
+        else if(strcmp(input->args[0], "timeout") == 0){
+            last_status = timeout_execute(input, &jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+            last_cmd = 1; //Ran an external command
+        }
         
-        //Uses execvp to search PATH variable and handles #comments
+        //command- built-in command, runs the external binary even if there is a fast path built-in
+        else if(strcmp(input->args[0], "command") == 0){
+            last_status = command_execute(input, &jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+            last_cmd = 1; //Ran an external command
+        }
+
+        //Runs fast path built-ins in process, uses the PATH cache for everything else, and handles #comments
         else if(input->args[0][0] != '#' && strcmp(input->args[0], "") != 0){
-            last_status = execute(input, background_PIDS, &num_background_proc, SIGINT_action, SIGTSTP_action, ignore_action);
+            TRACE(TRACE_EXECUTE, 'B', 0);
+            last_status = execute(input, &jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+            TRACE(TRACE_EXECUTE, 'E', last_status);
             last_cmd = 1; //Not a built in function
         }
+        count_command(input->args, last_cmd);
+        write_metrics_file(&jobs, 0); //If SMALLSH_METRICS is set and the interval has passed
 
-        fflush(stdout); //Clear stdout, may be redundant
-        reset_command(input); //Free memory
+        if(script == NULL){
+            fflush(stdout); //Clear stdout, may be redundant
+        }
+        reset_command(input);
     } 
+
+    fflush(stdout);
+    free_admission_queue(&jobs); //Held jobs never started, nothing to kill
+    end_background_processes(&jobs);
+    stop_zygote();
+    stop_trace(); //Writes SMALLSH_TRACE's file
+    free_history();
+    free_substitution_cache();
+    write_metrics_file(&jobs, 1);
+    free_job_table(&jobs);
+    return last_status;
 }
\ No newline at end of file
@@ -5,44 +5,824 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/prctl.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/sendfile.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 
 //Struct to handle all commands
 struct command{
-    char command_line[2048]; //Max 2048 characters in command line
+    char* command_line; //Grown by getline(), reused across commands
+    size_t line_size;
     int num_args;
-    char* args[512]; //Max 512 arguments in a given command
+    char** args; //NULL-terminated, grown geometrically and reused across commands
+    int args_capacity;
+    char* expansion; //Args of lines with variables, reused across commands
+    size_t expansion_size;
+    char* globbed; //Paths matched by glob args, reused across commands
+    size_t globbed_size;
+    char* substituted; //Output of the last $(...), reused across commands
+    size_t substituted_size;
 };
 
+//Struct for one memoized $(...) output
+struct memo_entry{
+    uint64_t hash; //hash_script() of the key
+    char* key; //Args and file stamps the output depends on, the output follows in the same block
+    size_t key_length;
+    char* output;
+    size_t output_length;
+};
+#define MEMO_ENTRIES 256
+#define MEMO_MAX_OUTPUT 65536 //Larger outputs are never memoized
+#define SUBSTITUTION_READ 65536 //Room kept free for each read() of a $(...) pipe
+#define SUBSTITUTION_PIPE_SIZE (1 << 20)
+
+//Struct for one path component of a glob, compiled to a bit-parallel NFA
+struct glob_pattern{
+    uint64_t masks[256]; //Bit i set if token i accepts the character
+    uint64_t stars; //Bit i set if token i is a '*'
+    int num_tokens;
+    int dot_ok; //1 if the pattern starts with '.', so it can match hidden names
+};
+
+//Struct for a cached directory listing
+struct dir_listing{
+    char* path; //NULL if the slot is free
+    dev_t dev; //Identity and mtime of the directory when it was read
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec loaded_at; //CLOCK_MONOTONIC, for the TTL
+    struct timespec loaded_wall; //CLOCK_REALTIME, to compare with mtime
+    char* names; //Per entry: d_type byte, then the NUL-terminated name
+    size_t size;
+    int num_names;
+};
+#define GLOB_CACHE_SIZE 16 //Directories whose listings are kept
+#define GLOB_CACHE_TTL_MS 2000 //Listings older than this are read again
+#define GLOB_RACY_MS 20 //Listings read this soon after the directory changed aren't trusted
+#define GLOB_DENTS_BUFFER (1 << 17) //getdents64() buffer size
+
+//Struct to hold the files a command's stdin/stdout are redirected to
+struct redirection{
+    char* input_file; //Target of '<', NULL if none
+    char* output_file; //Target of '>', NULL if none
+    int redirected; //0 if false, 1 if true
+};
+
+//Struct for the bounded buffer holding a background job's captured output
+struct output_ring{
+    char* data; //Grows up to output_ring_size, then wraps
+    size_t capacity;
+    size_t start; //Offset of the oldest byte kept
+    size_t length; //Bytes kept
+    size_t total; //Bytes ever captured, total - length were dropped
+};
+#define OUTPUT_RING_DEFAULT 65536 //Default ring size, SMALLSH_OUTPUT_BUFFER overrides it
+#define OUTPUT_CHUNK 65536 //Bytes read from a capture pipe per read()
+#define MAX_KEPT_OUTPUT 64 //Finished jobs kept for "output" before the oldest is freed
+extern size_t output_ring_size;
+
+//Struct for one trace event, 32 bytes
+struct trace_event{
+    unsigned long sequence; //Ring index + 1 once the event is fully written
+    long time; //CLOCK_MONOTONIC nanoseconds
+    pid_t pid;
+    short type; //TRACE_* event
+    short phase; //'B', 'E' or 'i', as in Chrome trace JSON
+    long arg;
+};
+
+//Struct for the trace ring, mapped shared so forked children write into it too
+struct trace_ring{
+    unsigned long head; //Next slot to claim, only ever grows
+    int enabled; //1 while recording, shared so "trace on" reaches the zygote's children
+    struct trace_event events[];
+};
+#define TRACE_EVENTS 65536 //Ring size, a power of two
+#define TRACE_READ_LINE 0 //Reading the next line, prompt wait included
+#define TRACE_POPULATE 1 //Expanding and splitting the line into args
+#define TRACE_EXECUTE 2 //Running a command line, from dispatch to status
+#define TRACE_SPAWN 3 //Launching one stage, in the shell
+#define TRACE_CHILD 4 //Forked child is running
+#define TRACE_DUP2 5 //Child setting up its stdin/stdout/stderr
+#define TRACE_EXEC 6 //Child calling exec
+#define TRACE_WAIT 7 //Shell waiting for a foreground job
+#define TRACE_REAP 8 //A child was reaped
+#define TRACE_PROMPT 9 //Prompt printed
+#define TRACE_TIMEOUT 10 //A job's deadline passed and it was signalled
+#define TRACING (trace_ring != NULL && trace_ring->enabled)
+#define TRACE(type, phase, arg) do{ if(TRACING){ trace_event(type, phase, arg); } }while(0)
+extern struct trace_ring* trace_ring;
+extern pid_t trace_pid;
+
+//Struct for the CPUs and NUMA node a background job was placed on
+struct placement{
+    cpu_set_t cpus;
+    int node; //NUMA node its memory is bound to, -1 if not bound
+    char label[48]; //"cpu 3/node 0" or "cpus 0-3", for jobs
+};
+#define PLACE_OFF 0
+#define PLACE_ROUND_ROBIN 1 //Each job gets the next allowed CPU
+#define PLACE_LEAST_LOADED 2 //Each job gets the CPU with the fewest of our jobs, then the least busy
+extern int placement_policy;
+extern struct placement* active_placement;
+
+//Struct for one command or pipeline launched by the shell
+struct job{
+    pid_t pid; //pid reported for the job, its last stage
+    int num_running; //Stages not reaped yet
+    int status; //Raw wait status of the last stage
+    int background; //0 if false, 1 if true
+    int done; //1 once every stage has been reaped
+    int slot; //Index in the job table's jobs array
+    struct job* next_done; //Next finished job waiting to be reported
+    struct timespec start; //CLOCK_MONOTONIC when the job was added
+    struct timespec end; //CLOCK_MONOTONIC when its last stage was reaped
+    struct rusage usage; //Summed over every stage, max RSS is the largest stage's
+    int output_fd; //Read end of the pipe capturing a background job's stdout/stderr, -1 if closed
+    struct output_ring output; //Captured stdout/stderr
+    int kept; //1 once reported and kept so its output can still be read
+    struct job* next_kept; //Next finished job kept for its output
+    struct placement* placement; //CPUs and node of a placed background job, NULL if not placed
+    double timeout; //Seconds it was given, 0 for no deadline
+    double grace; //Seconds between SIGTERM and SIGKILL
+    long deadline; //CLOCK_MONOTONIC nanoseconds of the next timeout step
+    int deadline_slot; //Index in the job table's deadline heap, -1 if not in it
+    int timed_out; //Last signal sent when its deadline passed, 0 if none
+    int num_pids;
+    pid_t pids[]; //pid of every stage
+};
+
+//Struct to keep a finished job's resource usage after the job is freed
+struct job_usage{
+    int valid; //0 until a job has been recorded
+    pid_t pid;
+    int status; //Raw wait status
+    double real; //Wall-clock seconds
+    struct rusage usage;
+    int timed_out; //Signal its deadline sent, 0 if it finished in time
+    double timeout; //Seconds it was given
+};
+
+//Struct for one entry in the job table's pid -> job index
+struct pid_slot{
+    pid_t pid;
+    struct job* job; //NULL if the slot is empty
+};
+
+//Struct for a background command held by the admission queue
+struct queued_job{
+    int id; //Shown until it gets a pid
+    int priority; //Lower is admitted first
+    struct timespec queued_at; //CLOCK_MONOTONIC when it was held
+    double timeout; //Deadline and grace from the timeout built-in, started once it is admitted
+    double grace;
+    int cwd_fd; //Directory it was queued in, where it is launched from, -1 if it couldn't be opened
+    struct queued_job* next;
+    int num_args;
+    char* args[]; //NULL-terminated, the strings follow in the same block
+};
+
+//Struct for the limits background jobs are admitted under
+struct admission_limits{
+    int max_jobs; //Running background jobs, 0 for no limit
+    double max_cpu; //PSI cpu "some avg10" percent, -1 for no limit
+    double max_memory; //PSI memory "some avg10" percent, -1 for no limit
+    double max_load; //1 minute load average, -1 for no limit
+    int order; //ADMIT_FIFO or ADMIT_PRIORITY
+    int cpu_fd; //Open /proc files, -1 if unused
+    int memory_fd;
+    int load_fd;
+    struct timespec checked_at; //Last time pressure and load were read
+    char* pressure_reason; //Result of that check, NULL if under every limit
+};
+#define ADMIT_FIFO 0
+#define ADMIT_PRIORITY 1 //"nice [-n N]" jobs wait behind the rest
+#define ADMIT_RECHECK_MS 100 //How often held jobs and pressure are re-checked
+extern struct admission_limits admission;
+
+//Struct to track every job, grows as needed
+struct job_table{
+    struct job** jobs; //Unordered, removal moves the last job into the hole
+    int num_jobs;
+    int capacity;
+    struct pid_slot* index; //Open addressing, power of two capacity
+    int index_used;
+    int index_capacity;
+    struct job* done_head; //Finished background jobs, oldest first
+    struct job* done_tail;
+    int sigchld_fd; //signalfd for SIGCHLD
+    struct job_usage last_foreground; //For status -v
+    struct job_usage last_background; //Last background job reported
+    pid_t last_background_pid; //For $!, 0 until a background job starts
+    int epoll_fd; //Watches every open capture pipe
+    int num_capturing; //Capture pipes still open
+    struct job* kept_head; //Finished jobs kept for their output, oldest first
+    struct job* kept_tail;
+    int num_kept;
+    int num_background_running; //Background jobs started and not finished
+    struct queued_job* queue_head; //Held background jobs, in admission order
+    int num_queued;
+    int last_queue_id;
+    struct job** deadlines; //Min-heap of jobs by deadline
+    int num_deadlines;
+    int deadlines_capacity;
+    int timer_fd; //timerfd armed for the first deadline
+    double next_timeout; //Set by the timeout built-in for the next job added, -1 for the default
+    double next_grace;
+};
+
+//Struct for the default deadline every job gets
+struct timeout_policy{
+    double deadline; //Seconds, 0 for none
+    double grace; //Seconds between SIGTERM and SIGKILL, 0 to send SIGKILL straight away
+};
+#define TIMEOUT_GRACE_DEFAULT 5
+#define TIMEOUT_STATUS 124 //$? of a timed out foreground job, as timeout(1)
+#define TIMEOUT_MESSAGE 96 //Longest format_timed_out() description
+extern struct timeout_policy timeouts;
+
+#define METRIC_MIN_SHIFT 10 //First bucket ends at 1.024us
+#define METRIC_MAX_SHIFT 34 //Values from 2^34ns (17s) on only count toward +Inf
+#define METRIC_SUB_BITS 2 //Each power of two is split in 1 << METRIC_SUB_BITS, values are within 25% of their bound
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BITS)
+#define METRIC_BUCKETS (1 + (METRIC_MAX_SHIFT - METRIC_MIN_SHIFT) * METRIC_SUB_BUCKETS)
+
+//Struct for a latency histogram. Buckets are log-linear, HDR style: one below
+//2^METRIC_MIN_SHIFT ns, then METRIC_SUB_BUCKETS per power of two up to 2^METRIC_MAX_SHIFT ns
+struct metric_histogram{
+    unsigned long buckets[METRIC_BUCKETS];
+    unsigned long count;
+    unsigned long sum; //Nanoseconds
+};
+
+//Struct for the metrics registry, every field is updated with METRIC_ADD
+struct metrics{
+    unsigned long commands; //Command lines run, comments and blank lines aside
+    unsigned long builtins; //Lines run by a built-in
+    unsigned long externals; //Jobs launched, a pipeline is one
+    unsigned long background_started;
+    unsigned long sigtstp; //Incremented in the signal handler
+    struct metric_histogram spawn; //launch_command(), per process
+    struct metric_histogram wait; //Foreground wait_for_job()
+    struct metric_histogram reap_lag; //Reaped to reported, per background job
+    char* file; //SMALLSH_METRICS, NULL if not set
+    double interval; //Seconds between file writes
+    struct timespec written_at; //CLOCK_MONOTONIC of the last file write
+};
+#define METRICS_INTERVAL_DEFAULT 10 //Seconds, SMALLSH_METRICS_INTERVAL overrides it
+#define METRICS_INTERVAL_MIN 1 //Shortest interval, the daemon's epoll_wait() timeout
+//Lock-free, and safe in a signal handler since unsigned long atomics never take a lock here
+#define METRIC_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+extern struct metrics metrics;
+
+//Struct for a script being run in non-interactive mode
+struct script{
+    char* data; //Whole script, lines are split in place
+    size_t size;
+    size_t offset; //Start of the next line
+    int mapped; //1 if data is mmap'd
+    int owned; //1 if data was malloc'd and must be freed
+    char* cache; //Parsed form of the script, NULL to parse each line as it runs
+    size_t cache_size;
+    int cache_mapped; //1 if cache is an mmap'd cache file, 0 if malloc'd
+    uint32_t next_cached; //Next line of the cache to run
+};
+#define SCRIPT_CHUNK (1 << 20) //Read size for scripts that can't be mmap'd
+
+//Struct at the start of a parsed-script cache file, followed by the script's
+//real path, the cached_line array, the word offsets and the strings
+struct script_cache_header{
+    char magic[8]; //SCRIPT_CACHE_MAGIC
+    uint64_t size; //Script size, mtime and content hash it was built from
+    uint64_t hash;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t num_lines;
+    uint32_t path_length;
+    uint32_t lines_offset; //File offsets of each section
+    uint32_t args_offset;
+    uint32_t strings_offset;
+    uint32_t unused;
+};
+
+//Struct for one line of a parsed-script cache
+struct cached_line{
+    uint32_t type; //CACHED_WORDS, CACHED_EXPAND or CACHED_GLOB
+    uint32_t num_args; //Words, for CACHED_WORDS
+    uint32_t start; //Index of the first word offset, or the line's offset in the strings for CACHED_EXPAND
+};
+#define SCRIPT_CACHE_MAGIC "smshpc03"
+#define CACHED_WORDS 0 //Split once when the cache was built
+#define CACHED_EXPAND 1 //Has variables, expanded each run
+#define CACHED_GLOB 2 //Split once, globbed each run
+extern int script_cache_enabled;
+
+//Struct for one trigram's posting list in the in-memory history index
+struct history_postings{
+    uint32_t key; //Three bytes plus HISTORY_KEY_USED, 0 if the slot is free
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t* entries; //Ascending entry numbers
+};
+
+//Struct for the in-memory trigram index, an open addressing table
+struct history_index{
+    struct history_postings* slots;
+    uint32_t capacity; //Power of two
+    uint32_t num_keys;
+};
+
+//Struct at the start of a compacted history index file, followed by
+//uint32_t keys[num_keys] (sorted), starts[num_keys + 1] and the postings
+struct history_index_header{
+    char magic[8];
+    uint64_t dev; //History file it indexes
+    uint64_t ino;
+    uint64_t covered_size; //Bytes of the history file indexed, whole lines
+    uint32_t num_entries; //Entries indexed
+    uint32_t num_keys;
+    uint64_t num_postings;
+};
+
+//Struct for the persistent history, shared by every session through one append-only file
+struct history_store{
+    char* path; //NULL if history is off
+    char* index_path; //path + ".idx"
+    int fd;
+    int record; //1 if lines read at the prompt are appended
+    char* data; //mmap of the file, NULL until it is first read
+    size_t mapped_size;
+    size_t scanned_size; //Bytes of complete lines split into entries
+    uint64_t* offsets; //Start of every entry, plus scanned_size at the end
+    uint32_t num_entries;
+    uint32_t offsets_capacity;
+    char* compact; //mmap of the compacted index file, NULL if none
+    size_t compact_size;
+    ino_t compact_ino; //Identity of the index file that is mapped
+    struct timespec compact_mtime;
+    uint32_t compact_entries; //Entries covered by the compacted index
+    struct history_index tail; //Entries from compact_entries on
+    uint32_t tail_indexed; //Entries in the tail index
+    pid_t compactor; //Background process writing the index file, 0 if none
+};
+#define HISTORY_INDEX_MAGIC "smshhi01"
+#define HISTORY_KEY_USED (1u << 24) //Set in every trigram key so 0 marks a free slot
+#define HISTORY_COMPACT_ENTRIES 16384 //Entries left out of the index file before it is rebuilt
+extern struct history_store history;
+
+struct serve_client;
+
+//Struct stored in epoll events, says what became ready
+struct serve_watch{
+    int kind; //WATCH_*
+    struct serve_client* client; //NULL for the listening socket and signals
+};
+#define WATCH_LISTEN 0 //Listening socket
+#define WATCH_SIGNALS 1 //signalfd for SIGCHLD, SIGINT and SIGTERM
+#define WATCH_SOCKET 2 //A client's connection
+#define WATCH_OUTPUT 3 //stdout/stderr pipe of a client's running command
+#define WATCH_JOBS 4 //epoll fd of a client's background capture pipes
+#define WATCH_TIMER 5 //timerfd of a client's job deadlines
+
+//Struct for one client of the daemon, a session of its own
+struct serve_client{
+    int fd; //Connection, nonblocking
+    int slot; //Index in the server's clients array
+    int cwd_fd; //Directory its commands run in
+    int last_status;
+    int last_cmd; //0 if the last command was a built-in, as in prompt()
+    struct job_table jobs;
+    struct command input;
+    char* in; //Bytes received, lines not run yet start at in_start
+    size_t in_start;
+    size_t in_used;
+    size_t in_size;
+    char* out; //Frames not sent yet start at out_start
+    size_t out_start;
+    size_t out_used;
+    size_t out_size;
+    struct job* running; //Foreground job, NULL if none
+    int busy; //1 from the start of a line until its status is sent
+    int signal; //Signal that killed the last foreground job, 0 if none
+    int timed_out; //1 if the last foreground job was stopped by its deadline
+    int launched; //1 if the running job's last stage started
+    int output_fd; //Read end of the running command's stdout/stderr, -1 once closed
+    int closing; //1 after exit or EOF, closed once everything is sent
+    int events; //epoll events the connection is watched for, 0 if it isn't in the set
+    int paused; //1 while output_fd isn't read because out is full
+    struct serve_watch socket_watch;
+    struct serve_watch output_watch;
+    struct serve_watch jobs_watch;
+    struct serve_watch timer_watch;
+};
+
+//Struct for the daemon started by --serve
+struct server{
+    int listen_fd;
+    int epoll_fd;
+    int signal_fd; //SIGCHLD for every client, SIGINT and SIGTERM to stop
+    int scratch_fd; //memfd built-in output is written to, then sent
+    int start_fd; //Directory the daemon started in, where sessions start
+    int saved_stdout; //Daemon's own stdout/stderr, restored after each command
+    int saved_stderr;
+    struct serve_client** clients; //Unordered, removal moves the last client into the hole
+    int num_clients;
+    int capacity;
+    struct serve_watch listen_watch;
+    struct serve_watch signal_watch;
+};
+#define SERVE_MAX_EVENTS 64 //epoll events handled per wakeup
+#define SERVE_OUT_LIMIT (1 << 20) //Bytes queued for a client before its command's output stops being read
+extern struct server* server;
+
+//Process launch strategies for spawn_mode
+#define SPAWN_POSIX 0 //posix_spawnp(), vfork-style so page tables aren't copied
+#define SPAWN_FORK 1 //Classic fork() + execvp()
+#define SPAWN_ZYGOTE 2 //Ask the zygote, a small helper forked at startup, to fork() + execve()
+extern int spawn_mode;
+
+//Struct for a launch request sent to the zygote, followed by length bytes of
+//NUL-separated strings: cwd, path, num_args args, then num_env environment entries
+struct zygote_request{
+    int background; //1 if the child keeps SIGINT ignored
+    int num_args;
+    int num_env;
+    int has_input; //1 if a stdin fd is passed with SCM_RIGHTS
+    int has_output; //1 if a stdout fd is passed, after the stdin fd
+    int has_error; //1 if a stderr fd is passed, after the others
+    int placed; //1 if the child is pinned to cpus
+    int node; //NUMA node to bind the child's memory to, -1 if not bound
+    cpu_set_t cpus;
+    size_t length;
+};
+
+//Struct for a message from the zygote
+struct zygote_reply{
+    int type; //ZYGOTE_STARTED or ZYGOTE_EXITED
+    pid_t pid; //-1 if the command couldn't be launched
+    int error; //errno if it couldn't be launched
+    int status; //Raw wait status, for ZYGOTE_EXITED
+    struct rusage usage; //For ZYGOTE_EXITED
+};
+#define ZYGOTE_STARTED 0 //Answer to a request
+#define ZYGOTE_EXITED 1 //A child it launched was reaped
+extern int zygote_fd;
+extern int zygote_num_pending;
+
+//Pipeline limits and relay stage kinds
+#define MAX_STAGES 256 //Max stages in one pipeline
+#define RELAY_CHUNK 65536 //Bytes moved per splice()/tee() call, one default pipe buffer
+#define RELAY_NONE 0 //Exec the stage normally
+#define RELAY_CAT 1 //"cat", splice() input straight to output
+#define RELAY_TEE 2 //"tee file", tee() to the next pipe and splice() to the file
+extern int relay_mode;
+
+//Struct for one command name cached by the PATH lookup cache
+struct path_entry{
+    char* name; //Command name as typed
+    char* path; //Absolute path it resolved to
+    int hits; //Number of times it was launched from the cache
+    struct path_entry* next; //Next entry in the same bucket
+};
+
+//Struct for one in-process built-in in the fast path table
+struct builtin{
+    char* name; //NULL for an empty slot
+    int (*run)(int argc, char** args); //Returns the exit value
+    int (*accepts)(char** args); //NULL, or 0 if these args need the external command
+};
+#define BUILTIN_TABLE_SIZE 16
+#define BUILTIN_MAX_NAME 6 //Longest name, "printf"
+//Perfect hash for the fast path built-in names, checked by a _Static_assert and check_builtin_table() in builtins.c
+#define BUILTIN_HASH(first, last, length) (((first) + 4 * (last) + 4 * (int)(length)) & (BUILTIN_TABLE_SIZE - 1))
+#define COPY_RANGE 0 //copy_fd() methods, tried in this order
+#define COPY_SENDFILE 1
+#define COPY_SPLICE 2
+#define COPY_READ_WRITE 3
+#define COPY_DONE 4
+#define COPY_CHUNK (1 << 30) //Bytes asked for per copy_file_range()/sendfile() call
+extern volatile sig_atomic_t copy_interrupted;
+
 //Signal handling functions
 void set_sigactions(struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
 void catchSIGINT(int signo);
 void catchSIGTSTP(int signo);
 
 //Command setter functions
-void populate_command(struct command* input);
+void init_command(struct command* input);
+void free_command(struct command* input);
+void reserve_args(struct command* input, int needed);
+void split_command(struct command* input, char* line);
+int is_comment(char* line, size_t length);
+void populate_command(struct command* input, char* line, int last_status, pid_t last_background);
+void strip_background(struct command* input);
 void reset_command(struct command* input);
-void remove_redirection(struct command* input);
+int remove_redirection(char** args);
 
 //Error message functions
 void file_directory_error(char* name);
 void command_error(char* command);
 
 //Built-in command functions
-void status_execute(int last_status, int last_cmd);
+void status_execute(int last_status, int last_cmd, struct job_usage* last_foreground);
+void status_verbose(struct job_table* jobs);
+int time_execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
 void cd_execute(struct command* input);
+void hash_execute(struct command* input);
+int command_execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
+
+//Fast path built-in functions
+struct builtin* find_builtin(char* name);
+int check_builtin_table(void);
+struct builtin* fast_builtin(struct command* input);
+int run_builtin(struct builtin* builtin, char** args);
+char* print_escape(char* ptr, int echo_style, int* stop);
+int echo_builtin(int argc, char** args);
+int true_builtin(int argc, char** args);
+int false_builtin(int argc, char** args);
+int pwd_builtin(int argc, char** args);
+int test_integer(char* arg, long long* value);
+int test_is_unary(char* op);
+int test_is_binary(char* op);
+int test_unary(char* op, char* arg);
+int test_binary(char* left, char* op, char* right);
+int test_negate(int result);
+int test_expression(int argc, char** args);
+int test_or(int argc, char** args, int* next);
+int test_and(int argc, char** args, int* next);
+int test_term(int argc, char** args, int* next);
+int test_builtin(int argc, char** args);
+long long printf_integer(char* arg, int* failed);
+int printf_builtin(int argc, char** args);
+
+//In-process cat and cp functions
+int cat_accepts(char** args);
+int cp_accepts(char** args);
+void catch_copy_SIGINT(int signo);
+void begin_copy(struct sigaction* saved_action);
+int end_copy(struct sigaction* saved_action, int status);
+int copy_unsupported(int error);
+int write_all(int fd, char* buffer, size_t length);
+int copy_fd(int in_fd, int out_fd, int* write_failed);
+int cat_fd(int fd, char* name, struct stat* out_info);
+int cat_builtin(int argc, char** args);
+int cp_file(char* source, char* target);
+int cp_builtin(int argc, char** args);
+
+//Variable expansion functions
+void init_expansion(void);
+void reserve_expansion(struct command* input, size_t used, size_t needed);
+char* lookup_variable(char** ptr, int last_status, pid_t last_background, char* number, size_t* length);
+void expand_command(struct command* input, char* line, int last_status, pid_t last_background);
+
+//Command substitution functions
+void set_pure_commands(void);
+char* find_substitution_end(char* text);
+int memo_key(char** stages[], int num_stages, char** key, size_t* key_size, size_t* key_length);
+struct memo_entry* find_memo(uint64_t hash, char* key, size_t key_length);
+void save_memo(uint64_t hash, char* key, size_t key_length, char* output, size_t output_length);
+int run_substitution(struct command* input, char** stages[], int num_stages, size_t* length);
+char* substitute_command(struct command* input, char** ptr, int last_status, pid_t last_background, size_t* length);
+void free_substitution_cache(void);
+
+//Process launch functions
+int check_arg_max(char** args);
+void find_redirection(char** args, struct redirection* redir);
+int open_redirection(struct redirection* redir, int* input_fd, int* output_fd);
+pid_t spawn_posix(char** args, char* path, int background, int input_fd, int output_fd, int error_fd);
+pid_t spawn_fork(char** args, char* path, int background, int input_fd, int output_fd, int error_fd);
+pid_t launch_command(char** args, int background, int input_fd, int output_fd, int error_fd);
+void set_spawn_mode(void);
+
+//Zygote functions
+int zygote_write(int fd, void* data, size_t length);
+int zygote_read(int fd, void* data, size_t length);
+int start_zygote(void);
+void stop_zygote(void);
+void zygote_lost(void);
+void zygote_append(size_t* used, char* string);
+pid_t spawn_zygote(char** args, char* path, int background, int input_fd, int output_fd, int error_fd);
+void reap_zygote(struct job_table* jobs);
+int zygote_serve(int fd, char** payload, size_t* payload_size, char*** vectors, size_t* vectors_size);
+int zygote_reap(int fd, int sigchld_fd);
+void zygote_main(int fd);
+
+//Pipeline functions
+int split_pipeline(struct command* input, char** stages[]);
+int relay_kind(char** args, int input_is_pipe, int output_is_pipe);
+void relay_splice(int input_fd, int output_fd);
+void relay_tee(int input_fd, int output_fd, int file_fd);
+pid_t launch_relay(char** args, int kind, int background, int input_fd, int output_fd, int unused_fd);
+void start_pipeline(char** stages[], int num_stages, int background, int capture_fd, pid_t* pids);
+void set_relay_mode(void);
+
+//PATH cache functions
+char* search_path(char* name);
+char* lookup_command_path(char* name);
+int forget_command_path(char* name);
+void clear_path_cache(void);
 
 //Non built-in command functions
-int execute(struct command* input, pid_t* background_PIDS, int* num_background_proc, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);   
-int foreground_command(struct command* input, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
-int background_command(struct command* input, pid_t* background_PIDS, int* num_background_proc, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
+int execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);   
+int foreground_command(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
+int background_command(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
+struct job* launch_background(struct command* input, struct job_table* jobs);
+
+//Job table functions
+void init_job_table(struct job_table* jobs);
+struct job* add_job(struct job_table* jobs, pid_t* pids, int num_pids, int background);
+struct job* find_job(struct job_table* jobs, pid_t pid);
+void remove_job(struct job_table* jobs, struct job* job);
+void finish_child(struct job_table* jobs, pid_t pid, int status, struct rusage* usage);
+void reap_children(struct job_table* jobs);
+void wait_for_children(struct job_table* jobs);
+void wait_for_job(struct job_table* jobs, struct job* job);
+void free_job_table(struct job_table* jobs);
+void add_rusage(struct rusage* total, struct rusage* usage);
+void record_job_usage(struct job* job, struct job_usage* record);
+void print_job_usage(struct job_usage* record);
+
+//Background output capture functions
+void set_output_capture(void);
+void ring_write(struct output_ring* ring, char* data, size_t length);
+void ring_print(struct output_ring* ring);
+void capture_job_output(struct job_table* jobs, struct job* job, int fd);
+void read_job_output(struct job_table* jobs, struct job* job);
+void drain_output(struct job_table* jobs);
+void release_job_output(struct job_table* jobs, struct job* job);
+void keep_job_output(struct job_table* jobs, struct job* job);
+void unkeep_job_output(struct job_table* jobs, struct job* job);
+void wait_for_input(struct job_table* jobs);
+int compare_job_start(const void* a, const void* b);
+void jobs_execute(struct job_table* jobs);
+int output_execute(struct command* input, struct job_table* jobs);
+
+//Trace functions
+void init_trace(void);
+void trace_child(void);
+void trace_event(int type, int phase, long arg);
+int dump_trace(char* path);
+int trace_execute(struct command* input);
+void stop_trace(void);
+
+//CPU placement functions
+void set_placement(void);
+void read_cpu_nodes(void);
+int parse_cpu_list(char* list, cpu_set_t* cpus);
+void format_cpu_list(cpu_set_t* cpus, char* buffer, size_t size);
+int least_loaded_cpu(void);
+int plan_placement(struct command* input, struct placement** result);
+int bind_memory(int node);
+void apply_placement(struct placement* placement);
+void restore_placement(struct placement* placement);
+void count_placement(struct placement* placement, int delta);
+
+//History functions
+void set_history(void);
+void add_history(char* line);
+int scan_history(void);
+int sync_history(void);
+void reset_history(void);
+struct history_postings* history_slot(struct history_index* index, uint32_t key, int add);
+void index_history_entry(struct history_index* index, uint32_t entry, char* text, size_t length);
+void free_history_index(struct history_index* index);
+int compare_history_keys(const void* a, const void* b);
+int write_history_index(struct history_index* index);
+void compact_history(void);
+void load_history_index(void);
+uint32_t* find_postings(int compacted, uint32_t key, uint32_t* count);
+void print_history_entry(uint32_t entry);
+int search_history_part(int compacted, char* text, size_t length);
+int history_execute(struct command* input);
+void free_history(void);
+
+//Daemon functions
+int serve_main(char* path);
+void serve_watch(struct server* state, int fd, struct serve_watch* watch, int op, int events);
+void serve_accept(struct server* state);
+void remove_client(struct server* state, struct serve_client* client);
+int serve_signals(struct server* state);
+void serve_finish_child(pid_t pid, int status, struct rusage* usage);
+void serve_read(struct serve_client* client);
+void serve_frame(struct serve_client* client, char kind, size_t number, char* data);
+void serve_flush(struct serve_client* client);
+void serve_update(struct server* state, struct serve_client* client);
+void serve_read_output(struct server* state, struct serve_client* client);
+void serve_capture_begin(struct server* state);
+void serve_capture_end(struct server* state, struct serve_client* client);
+void serve_advance(struct server* state, struct serve_client* client);
+void serve_command(struct server* state, struct serve_client* client);
+int serve_foreground(struct server* state, struct serve_client* client);
+int check_serve_redirection(int fd, char* name);
+void serve_finish_command(struct serve_client* client);
+void stop_server(struct server* state, char* path);
+int serve_connect(char* path);
+
+//Admission queue functions
+void set_admission(void);
+double read_pressure(int fd, char* key);
+char* admission_hold(struct job_table* jobs);
+int job_priority(char** args);
+int queue_background(struct command* input, struct job_table* jobs, char* reason);
+void admit_jobs(struct job_table* jobs);
+void free_admission_queue(struct job_table* jobs);
+
+//Timeout functions
+void set_timeouts(void);
+int parse_duration(char* text, double* seconds);
+int plan_timeout(struct command* input, struct job_table* jobs);
+int timeout_execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action);
+void start_deadline(struct job_table* jobs, struct job* job);
+long deadline_after(long from, double seconds);
+void swap_deadlines(struct job_table* jobs, int a, int b);
+void sift_deadline(struct job_table* jobs, int slot);
+void set_deadline(struct job_table* jobs, struct job* job, long deadline);
+void cancel_deadline(struct job_table* jobs, struct job* job);
+void arm_deadline_timer(struct job_table* jobs);
+void expire_deadlines(struct job_table* jobs);
+void signal_job(struct job_table* jobs, struct job* job, int signo);
+int format_timed_out(char* buffer, size_t size, double timeout, int status);
+
+//Metrics functions
+void set_metrics(void);
+int metric_bucket(unsigned long nanoseconds);
+unsigned long metric_bucket_bound(int bucket);
+void record_latency(struct metric_histogram* histogram, unsigned long nanoseconds);
+void record_since(struct metric_histogram* histogram, struct timespec* start);
+void count_command(char** args, int last_cmd);
+int background_jobs_running(struct job_table* jobs);
+void print_histogram(FILE* out, char* name, char* help, struct metric_histogram* histogram);
+void print_metrics(FILE* out, struct job_table* jobs);
+void write_metrics_file(struct job_table* jobs, int force);
+void metrics_execute(struct job_table* jobs);
 
 //Background process handler functions
-void check_background_processes(pid_t* background_PIDS, int* num_background_proc);
-void end_background_processes(pid_t* background_PIDS, int* num_background_proc);
+void check_background_processes(struct job_table* jobs);
+void report_background_processes(struct job_table* jobs);
+void end_background_processes(struct job_table* jobs);
+
+extern volatile sig_atomic_t parallel_interrupted;
+
+//parallel built-in functions
+void build_parallel_command(char** template, char* line, char** argv, char** scratch, size_t* scratch_size);
+void count_parallel_status(int status, int* exit_counts, int* signal_counts);
+int parallel_execute(struct command* input, struct job_table* jobs);
+void catch_parallel_SIGINT(int signo);
+
+//Script mode functions
+int open_script(struct script* script, char* path);
+void string_script(struct script* script, char* text);
+char* next_script_line(struct script* script, char** overflow, size_t* overflow_size);
+void close_script(struct script* script);
+
+//Glob functions
+int has_glob(char* text, size_t length);
+int compile_glob(char* pattern, size_t length, struct glob_pattern* compiled);
+int match_glob(struct glob_pattern* compiled, char* name);
+int read_listing(char* path, struct dir_listing* listing);
+struct dir_listing* get_listing(char* path);
+void add_glob_match(struct command* input, size_t* used, char* path, size_t length);
+void glob_walk(struct command* input, size_t* used, char* path, size_t path_length, char* pattern);
+int compare_glob_match(const void* a, const void* b);
+void expand_globs(struct command* input);
+
+//Parsed-script cache functions
+void set_script_cache(void);
+uint64_t hash_script(char* data, size_t size);
+int script_cache_path(char* path, char* real, char* cache_path);
+int check_script_cache(char* cache, size_t cache_size, char* real, struct stat* info, uint64_t hash);
+size_t cache_append(char** buffer, size_t* used, size_t* capacity, void* data, size_t length);
+char* build_script_cache(char* data, size_t size, char* real, struct stat* info, uint64_t hash, size_t* cache_size);
+void write_script_cache(char* cache_path, char* cache, size_t cache_size);
+void load_script_cache(struct script* script, char* path, struct stat* info);
+int next_cached_command(struct script* script, struct command* input, int last_status, pid_t last_background);
 
-//Main prompt function
-void prompt(struct command* input);
\ No newline at end of file
+//Main prompt functions
+ssize_t read_input_line(char** line, size_t* size);
+char* read_command_line(struct command* input, struct script* script, struct job_table* jobs);
+int prompt(struct command* input, struct script* script);
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include "smallsh.h"
+
+char* pure_list = NULL; //Copy of SMALLSH_PURE, the names point into it
+char** pure_commands = NULL; //Commands whose $(...) output may be memoized
+int num_pure_commands = 0;
+struct memo_entry memo_cache[MEMO_ENTRIES]; //Memoized outputs, replaced round-robin
+int next_memo = 0;
+
+/**
+ * This function should read the commands marked pure from the SMALLSH_PURE
+ * environment variable, a list of names separated by spaces, commas or
+ * colons. A $(...) whose every stage runs one of them is run once and its
+ * output reused while its args and the files they name are unchanged.
+ */
+void set_pure_commands(void){
+    char* list = getenv("SMALLSH_PURE");
+    char* saveptr = NULL;
+
+    if(list == NULL || list[0] == '\0'){
+        return;
+    }
+    pure_list = strdup(list);
+    pure_commands = malloc((strlen(list) / 2 + 1) * sizeof(char*)); //At most every other char starts a name
+    for(char* name = strtok_r(pure_list, " ,:", &saveptr); name != NULL; name = strtok_r(NULL, " ,:", &saveptr)){
+        pure_commands[num_pure_commands++] = name;
+    }
+}
+
+/**
+ * This function should find the ')' that ends a $(...), counting nested
+ * parentheses. Returns NULL if it is unterminated.
+ * 
+ * Params:
+ *   text - first char after the "$("
+ */
+char* find_substitution_end(char* text){
+    int depth = 1;
+
+    for(; *text != '\0'; text++){
+        if(*text == '('){
+            depth++;
+        }
+        else if(*text == ')' && --depth == 0){
+            return text;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * This function should build the memo key of a substitution: every stage's
+ * args, then the inode, size and mtime of the command's binary and of every
+ * arg that names a file. Returns -1 if the output can't be memoized because
+ * a stage isn't marked pure, can't be found or writes to a file.
+ * 
+ * Params:
+ *   stages - NULL-terminated args for each stage
+ *   num_stages - number of stages
+ *   key - buffer to build the key in, grown as needed (by reference)
+ *   key_size - size of key (by reference)
+ *   key_length - bytes of key used (by reference)
+ */
+int memo_key(char** stages[], int num_stages, char** key, size_t* key_size, size_t* key_length){
+    struct stat info;
+
+    *key_length = 0;
+    for(int i = 0; i < num_stages; i++){
+        int pure = 0;
+        for(int j = 0; j < num_pure_commands && !pure; j++){
+            pure = strcmp(stages[i][0], pure_commands[j]) == 0;
+        }
+        char* path = pure ? lookup_command_path(stages[i][0]) : NULL;
+        if(path == NULL || stat(path, &info) == -1){
+            return -1;
+        }
+        cache_append(key, key_length, key_size, &info.st_ino, sizeof(info.st_ino));
+        cache_append(key, key_length, key_size, &info.st_mtim, sizeof(info.st_mtim));
+
+        for(char** arg = stages[i]; *arg != NULL; arg++){
+            if(strcmp(*arg, ">") == 0){ //Writes a file, has to run every time
+                return -1;
+            }
+            cache_append(key, key_length, key_size, *arg, strlen(*arg) + 1);
+            if(arg != stages[i] && stat(*arg, &info) == 0){ //Input file, its output changes with it
+                cache_append(key, key_length, key_size, &info.st_dev, sizeof(info.st_dev));
+                cache_append(key, key_length, key_size, &info.st_ino, sizeof(info.st_ino));
+                cache_append(key, key_length, key_size, &info.st_size, sizeof(info.st_size));
+                cache_append(key, key_length, key_size, &info.st_mtim, sizeof(info.st_mtim));
+            }
+        }
+        cache_append(key, key_length, key_size, "|", 1);
+    }
+    return 0;
+}
+
+/**
+ * This function should find a memoized output by key, or NULL
+ * 
+ * Params:
+ *   hash - hash_script() of the key
+ *   key - memo key from memo_key()
+ *   key_length - bytes of key
+ */
+struct memo_entry* find_memo(uint64_t hash, char* key, size_t key_length){
+    for(int i = 0; i < MEMO_ENTRIES; i++){
+        struct memo_entry* entry = &memo_cache[i];
+        if(entry->key != NULL && entry->hash == hash && entry->key_length == key_length && memcmp(entry->key, key, key_length) == 0){
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * This function should memoize a substitution's output, replacing the
+ * oldest entry once the cache is full
+ * 
+ * Params:
+ *   hash - hash_script() of the key
+ *   key - memo key from memo_key()
+ *   key_length - bytes of key
+ *   output - what the command wrote
+ *   output_length - bytes of output
+ */
+void save_memo(uint64_t hash, char* key, size_t key_length, char* output, size_t output_length){
+    struct memo_entry* entry = &memo_cache[next_memo];
+
+    next_memo = (next_memo + 1) % MEMO_ENTRIES;
+    free(entry->key);
+    entry->hash = hash;
+    entry->key = malloc(key_length + output_length);
+    memcpy(entry->key, key, key_length);
+    memcpy(entry->key + key_length, output, output_length);
+    entry->key_length = key_length;
+    entry->output = entry->key + key_length;
+    entry->output_length = output_length;
+}
+
+/**
+ * This function should run the pipeline a $(...) holds and collect its
+ * stdout in the command's substituted buffer. The last stage writes to a
+ * pipe, widened so a big output needs few wakeups, and it is read straight
+ * into the buffer with large reads. stderr still goes to the terminal.
+ * Returns the raw wait status of the last stage, or -1 if it didn't launch.
+ * 
+ * Params:
+ *   input - command being expanded, owns the substituted buffer
+ *   stages - NULL-terminated args for each stage
+ *   num_stages - number of stages
+ *   length - set to the bytes of output (by reference)
+ */
+int run_substitution(struct command* input, char** stages[], int num_stages, size_t* length){
+    pid_t pids[MAX_STAGES];
+    int pipe_fds[2];
+    int status = -1;
+    ssize_t num_read;
+
+    *length = 0;
+    if(pipe2(pipe_fds, O_CLOEXEC) == -1){
+        perror("Failed to create pipe\n");
+        return -1;
+    }
+    fcntl(pipe_fds[0], F_SETPIPE_SZ, SUBSTITUTION_PIPE_SIZE); //Best effort, limited by pipe-max-size
+
+    //Point stdout at the pipe just while the stages launch, like serve_foreground(). The
+    //zygote's children would get the zygote's own stdout, so it is skipped
+    int mode = spawn_mode;
+    spawn_mode = mode == SPAWN_ZYGOTE ? SPAWN_POSIX : mode;
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(pipe_fds[1], STDOUT_FILENO);
+    start_pipeline(stages, num_stages, 0, -1, pids);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(pipe_fds[1]);
+    spawn_mode = mode;
+
+    do{
+        if(input->substituted_size - *length < SUBSTITUTION_READ){
+            input->substituted_size = input->substituted_size == 0 ? SUBSTITUTION_READ : input->substituted_size * 2;
+            input->substituted = realloc(input->substituted, input->substituted_size);
+        }
+        num_read = read(pipe_fds[0], input->substituted + *length, input->substituted_size - *length);
+        if(num_read > 0){
+            *length += num_read;
+        }
+    }while(num_read > 0 || (num_read == -1 && errno == EINTR));
+    close(pipe_fds[0]);
+
+    //Reap the stages now so a long script doesn't collect zombies
+    for(int i = 0; i < num_stages; i++){
+        int stage_status;
+        if(pids[i] != -1 && waitpid(pids[i], &stage_status, 0) == pids[i] && i == num_stages - 1){
+            status = stage_status;
+        }
+    }
+    return status;
+}
+
+/**
+ * This function should expand the $(...) a '$' starts and move ptr past
+ * it. The text inside is expanded and split like any line, so variables,
+ * globs, pipes, redirection and nested substitutions work, then run with
+ * its stdout captured. Output of pure commands that exited 0 is memoized.
+ * Trailing newlines are dropped, so "[$(nproc)]" stays one word.
+ * Returns the output, which the caller splits into words, or NULL if the
+ * '$' doesn't start a substitution, so it is kept literally.
+ * 
+ * Params:
+ *   input - command being expanded
+ *   ptr - pointer to the '$' (by reference)
+ *   last_status - value for $?
+ *   last_background - value for $!, 0 if no background job has run
+ *   length - pointer to hold the output's length (by reference)
+ */
+char* substitute_command(struct command* input, char** ptr, int last_status, pid_t last_background, size_t* length){
+    char* text = *ptr + 2;
+    char* end = find_substitution_end(text);
+    struct command inner;
+    char** stages[MAX_STAGES];
+    char* key = NULL;
+    size_t key_size = 0, key_length = 0;
+    uint64_t hash = 0;
+    char* output = input->substituted;
+
+    if(end == NULL){ //Unterminated $(, keep it literally
+        return NULL;
+    }
+    *ptr = end + 1;
+    *length = 0;
+
+    init_command(&inner);
+    inner.command_line = strndup(text, end - text);
+    populate_command(&inner, inner.command_line, last_status, last_background);
+    if(inner.args[0][0] == '\0'){ //$() or nothing left after expanding
+        free_command(&inner);
+        return "";
+    }
+
+    int num_stages = split_pipeline(&inner, stages);
+    if(num_stages == -1){
+        free_command(&inner);
+        return "";
+    }
+    int memoize = num_pure_commands > 0 && memo_key(stages, num_stages, &key, &key_size, &key_length) == 0;
+    struct memo_entry* entry = NULL;
+    if(memoize){
+        hash = hash_script(key, key_length);
+        entry = find_memo(hash, key, key_length);
+    }
+
+    if(entry != NULL){ //Ran before with the same args and files
+        output = entry->output;
+        *length = entry->output_length;
+    }
+    else{
+        int status = run_substitution(input, stages, num_stages, length);
+        output = input->substituted;
+        if(memoize && status == 0 && *length <= MEMO_MAX_OUTPUT){
+            save_memo(hash, key, key_length, output, *length);
+        }
+    }
+    while(*length > 0 && output[*length - 1] == '\n'){ //Trailing newlines are dropped, as in bash
+        (*length)--;
+    }
+    free(key);
+    free_command(&inner);
+    return output;
+}
+
+/**
+ * This function should free every memoized output and the pure command
+ * list, at exit
+ */
+void free_substitution_cache(void){
+    for(int i = 0; i < MEMO_ENTRIES; i++){
+        free(memo_cache[i].key);
+        memo_cache[i].key = NULL;
+    }
+    free(pure_commands);
+    free(pure_list);
+    pure_commands = NULL;
+    pure_list = NULL;
+    num_pure_commands = 0;
+}
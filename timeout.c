@@ -0,0 +1,350 @@
+#include "smallsh.h"
+
+struct timeout_policy timeouts = {0, TIMEOUT_GRACE_DEFAULT};
+
+/**
+ * This function should set the default deadline from the SMALLSH_TIMEOUT
+ * environment variable, a comma-separated list of deadline=DUR (every
+ * foreground and background job) and grace=DUR (time between SIGTERM and
+ * SIGKILL). Durations are like timeout(1)'s: a number with an optional s, m,
+ * h or d suffix.
+ */
+void set_timeouts(void){
+    char* spec = getenv("SMALLSH_TIMEOUT");
+    if(spec == NULL){
+        return;
+    }
+
+    char* copy = strdup(spec);
+    char* saveptr = NULL;
+    for(char* item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)){
+        char* value = strchr(item, '=');
+        double seconds;
+        if(value == NULL){
+            continue;
+        }
+        *value++ = '\0';
+        if(parse_duration(value, &seconds) == -1){
+            continue;
+        }
+        if(strcmp(item, "deadline") == 0){
+            timeouts.deadline = seconds;
+        }
+        else if(strcmp(item, "grace") == 0){
+            timeouts.grace = seconds;
+        }
+    }
+    free(copy);
+}
+
+/**
+ * This function should read a duration such as "10", "2.5s", "3m", "1h" or
+ * "1d". Returns -1 if it isn't one, including inf and nan, which strtod()
+ * reads but no deadline can hold.
+ * 
+ * Params:
+ *   text - duration to read
+ *   seconds - set to the duration in seconds (by reference)
+ */
+int parse_duration(char* text, double* seconds){
+    char* end;
+
+    double value = strtod(text, &end);
+    if(end == text || value < 0){
+        return -1;
+    }
+    switch(*end){
+        case '\0': case 's': break;
+        case 'm': value *= 60; break;
+        case 'h': value *= 3600; break;
+        case 'd': value *= 86400; break;
+        default: return -1;
+    }
+    if((*end != '\0' && end[1] != '\0') || !isfinite(value)){ //1e308d overflows to inf too
+        return -1;
+    }
+    *seconds = value;
+    return 0;
+}
+
+/**
+ * This function should take a leading "timeout [-k grace] dur" off a
+ * command and keep the deadline for the next job the table adds. A
+ * duration of 0 runs the command with no deadline, even if there is a
+ * default. Returns 1 on a usage error, after printing it.
+ * 
+ * Params:
+ *   input - command struct that holds args
+ *   jobs - job table
+ */
+int plan_timeout(struct command* input, struct job_table* jobs){
+    int skip = 1;
+    double grace = -1, seconds;
+
+    if(input->num_args > 2 && strcmp(input->args[1], "-k") == 0){
+        if(parse_duration(input->args[2], &grace) == -1){
+            printf("bash: timeout: %s: invalid duration\n", input->args[2]);
+            return 1;
+        }
+        skip = 3;
+    }
+    if(input->num_args <= skip + 1 || parse_duration(input->args[skip], &seconds) == -1){
+        printf("bash: timeout: usage: timeout [-k grace] duration command [args...]\n");
+        return 1;
+    }
+    skip++;
+
+    memmove(input->args, input->args + skip, (input->num_args - skip + 1) * sizeof(char*));
+    input->num_args -= skip;
+    jobs->next_timeout = seconds;
+    jobs->next_grace = grace;
+    return 0;
+}
+
+/**
+ * This function should handle the timeout built-in command: the rest of the
+ * line runs as usual, in the foreground or the background, and whatever job
+ * it starts gets the deadline. The shell's timer sends SIGTERM when it
+ * passes and SIGKILL a grace period later, so no watcher process is needed.
+ * Returns the command's status, TIMEOUT_STATUS if it was timed out.
+ * 
+ * Params:
+ *   input - command struct that holds args
+ *   jobs - job table
+ *   SIGINT_action - SIGINT action handler
+ *   SIGTSTP_action - SIGTSTP action handler
+ *   ignore_action - ignore action handler
+ */
+int timeout_execute(struct command* input, struct job_table* jobs, struct sigaction SIGINT_action, struct sigaction SIGTSTP_action, struct sigaction ignore_action){
+    if(plan_timeout(input, jobs) != 0){
+        return 1;
+    }
+    int status = execute(input, jobs, SIGINT_action, SIGTSTP_action, ignore_action);
+    jobs->next_timeout = -1;
+    jobs->next_grace = -1;
+    return status;
+}
+
+/**
+ * This function should give a new job its deadline: the one planned by the
+ * timeout built-in, or else the SMALLSH_TIMEOUT default. Called by
+ * add_job().
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job that was just added
+ */
+void start_deadline(struct job_table* jobs, struct job* job){
+    double seconds = jobs->next_timeout >= 0 ? jobs->next_timeout : timeouts.deadline;
+    double grace = jobs->next_grace >= 0 ? jobs->next_grace : timeouts.grace;
+
+    job->timeout = seconds;
+    job->grace = grace;
+    if(seconds > 0){
+        set_deadline(jobs, job, deadline_after(job->start.tv_sec * 1000000000L + job->start.tv_nsec, seconds));
+    }
+}
+
+/**
+ * This function should add a duration to a CLOCK_MONOTONIC time in
+ * nanoseconds. A duration too long for a long, like "1e30", gives LONG_MAX,
+ * a deadline that never comes, instead of overflowing into one that has
+ * already passed.
+ * 
+ * Params:
+ *   from - CLOCK_MONOTONIC nanoseconds
+ *   seconds - duration, finite and not negative
+ */
+long deadline_after(long from, double seconds){
+    if(seconds * 1e9 >= (double)(LONG_MAX - from)){
+        return LONG_MAX;
+    }
+    return from + (long)(seconds * 1e9);
+}
+
+/**
+ * This function should swap two jobs in the deadline heap
+ * 
+ * Params:
+ *   jobs - job table
+ *   a - heap index
+ *   b - heap index
+ */
+void swap_deadlines(struct job_table* jobs, int a, int b){
+    struct job* job = jobs->deadlines[a];
+    jobs->deadlines[a] = jobs->deadlines[b];
+    jobs->deadlines[b] = job;
+    jobs->deadlines[a]->deadline_slot = a;
+    jobs->deadlines[b]->deadline_slot = b;
+}
+
+/**
+ * This function should move a job up or down the deadline heap until its
+ * parent is due no later and its children no earlier
+ * 
+ * Params:
+ *   jobs - job table
+ *   slot - heap index of the job that moved
+ */
+void sift_deadline(struct job_table* jobs, int slot){
+    while(slot > 0 && jobs->deadlines[slot]->deadline < jobs->deadlines[(slot - 1) / 2]->deadline){
+        swap_deadlines(jobs, slot, (slot - 1) / 2);
+        slot = (slot - 1) / 2;
+    }
+    while(1){
+        int child = 2 * slot + 1;
+        if(child >= jobs->num_deadlines){
+            break;
+        }
+        if(child + 1 < jobs->num_deadlines && jobs->deadlines[child + 1]->deadline < jobs->deadlines[child]->deadline){
+            child++;
+        }
+        if(jobs->deadlines[slot]->deadline <= jobs->deadlines[child]->deadline){
+            break;
+        }
+        swap_deadlines(jobs, slot, child);
+        slot = child;
+    }
+}
+
+/**
+ * This function should set or move a job's deadline in the heap and re-arm
+ * the table's timerfd for whichever deadline is now first
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job with a deadline
+ *   deadline - CLOCK_MONOTONIC nanoseconds
+ */
+void set_deadline(struct job_table* jobs, struct job* job, long deadline){
+    job->deadline = deadline;
+    if(job->deadline_slot == -1){
+        if(jobs->num_deadlines == jobs->deadlines_capacity){
+            jobs->deadlines_capacity = jobs->deadlines_capacity == 0 ? 16 : jobs->deadlines_capacity * 2;
+            jobs->deadlines = realloc(jobs->deadlines, jobs->deadlines_capacity * sizeof(struct job*));
+        }
+        job->deadline_slot = jobs->num_deadlines;
+        jobs->deadlines[jobs->num_deadlines++] = job;
+    }
+    sift_deadline(jobs, job->deadline_slot);
+    arm_deadline_timer(jobs);
+}
+
+/**
+ * This function should take a job out of the deadline heap, once it has
+ * finished or been killed
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job to take out, nothing happens if it has no deadline
+ */
+void cancel_deadline(struct job_table* jobs, struct job* job){
+    int slot = job->deadline_slot;
+
+    if(slot == -1){
+        return;
+    }
+    job->deadline_slot = -1;
+    jobs->num_deadlines--;
+    if(slot < jobs->num_deadlines){
+        jobs->deadlines[slot] = jobs->deadlines[jobs->num_deadlines];
+        jobs->deadlines[slot]->deadline_slot = slot;
+        sift_deadline(jobs, slot);
+    }
+    if(slot == 0){
+        arm_deadline_timer(jobs);
+    }
+}
+
+/**
+ * This function should arm the timerfd for the first deadline in the heap,
+ * or disarm it if there is none
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void arm_deadline_timer(struct job_table* jobs){
+    struct itimerspec timer = {{0, 0}, {0, 0}};
+
+    if(jobs->num_deadlines > 0){
+        long deadline = jobs->deadlines[0]->deadline;
+        timer.it_value.tv_sec = deadline / 1000000000L;
+        timer.it_value.tv_nsec = deadline % 1000000000L;
+        if(timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0){
+            timer.it_value.tv_nsec = 1; //All zeroes would disarm it
+        }
+    }
+    timerfd_settime(jobs->timer_fd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+/**
+ * This function should act on every deadline that has passed. A job past
+ * its deadline gets SIGTERM and a new deadline a grace period later; a job
+ * still running then gets SIGKILL and leaves the heap. Called when the
+ * timerfd fires and whenever children are reaped.
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void expire_deadlines(struct job_table* jobs){
+    uint64_t expirations;
+    struct timespec now;
+
+    if(jobs->num_deadlines == 0){
+        return;
+    }
+    while(read(jobs->timer_fd, &expirations, sizeof(expirations)) > 0);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long now_ns = now.tv_sec * 1000000000L + now.tv_nsec;
+
+    while(jobs->num_deadlines > 0 && jobs->deadlines[0]->deadline <= now_ns){
+        struct job* job = jobs->deadlines[0];
+        if(job->timed_out == 0 && job->grace > 0){
+            signal_job(jobs, job, SIGTERM);
+            job->timed_out = SIGTERM;
+            set_deadline(jobs, job, deadline_after(now_ns, job->grace));
+        }
+        else{
+            signal_job(jobs, job, SIGKILL);
+            job->timed_out = SIGKILL;
+            cancel_deadline(jobs, job);
+        }
+        TRACE(TRACE_TIMEOUT, 'i', job->pid);
+    }
+    arm_deadline_timer(jobs);
+}
+
+/**
+ * This function should send a signal to every stage of a job that hasn't
+ * been reaped yet
+ * 
+ * Params:
+ *   jobs - job table
+ *   job - job to signal
+ *   signo - signal to send
+ */
+void signal_job(struct job_table* jobs, struct job* job, int signo){
+    for(int i = 0; i < job->num_pids; i++){
+        if(find_job(jobs, job->pids[i]) == job){ //Still running
+            kill(job->pids[i], signo);
+        }
+    }
+}
+
+/**
+ * This function should describe how a timed out job ended, for status,
+ * the foreground message, background reports and the daemon. Returns the
+ * length, as snprintf() does.
+ * 
+ * Params:
+ *   buffer - where to write the description, without a newline
+ *   size - size of buffer
+ *   timeout - the job's deadline in seconds
+ *   status - raw wait status
+ */
+int format_timed_out(char* buffer, size_t size, double timeout, int status){
+    if(WIFSIGNALED(status)){
+        return snprintf(buffer, size, "timed out after %gs, terminated by signal %d", timeout, WTERMSIG(status));
+    }
+    return snprintf(buffer, size, "timed out after %gs, exit value %d", timeout, WEXITSTATUS(status));
+}
@@ -0,0 +1,158 @@
+#include "smallsh.h"
+
+struct trace_ring* trace_ring = NULL; //Shared with every child forked after init_trace()
+pid_t trace_pid = 0; //pid stamped on events, reset in forked children
+char* trace_file = NULL; //Where SMALLSH_TRACE dumps the trace at exit
+
+//Event names, indexed by type
+char* trace_names[] = {"read_line", "populate_command", "execute", "spawn", "child", "dup2", "exec", "wait", "reap", "prompt", "timeout"};
+
+/**
+ * This function should map the trace ring. It is MAP_SHARED so children
+ * forked afterwards, the zygote included, write into the same ring, and it
+ * is never touched until tracing is on. Tracing starts right away if
+ * SMALLSH_TRACE names a file to dump the trace to at exit.
+ */
+void init_trace(void){
+    trace_ring = mmap(NULL, sizeof(struct trace_ring) + TRACE_EVENTS * sizeof(struct trace_event), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(trace_ring == MAP_FAILED){
+        trace_ring = NULL;
+        return;
+    }
+    trace_pid = getpid();
+
+    trace_file = getenv("SMALLSH_TRACE");
+    if(trace_file != NULL && trace_file[0] != '\0'){
+        trace_ring->enabled = 1;
+    }
+}
+
+/**
+ * This function should start tracing in a freshly forked child, which has to
+ * stamp its own pid on its events
+ */
+void trace_child(void){
+    trace_pid = getpid();
+    trace_event(TRACE_CHILD, 'i', 0);
+}
+
+/**
+ * This function should record one event. A slot is claimed with an atomic
+ * add on the shared head, so the shell and its children never lock; the
+ * slot's sequence number is published last so dump_trace() can skip slots
+ * that are half written or were lapped.
+ * 
+ * Params:
+ *   type - TRACE_* event
+ *   phase - 'B' (begin), 'E' (end) or 'i' (instant)
+ *   arg - pid, status or other number shown with the event
+ */
+void trace_event(int type, int phase, long arg){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long index = __atomic_fetch_add(&trace_ring->head, 1, __ATOMIC_RELAXED);
+    struct trace_event* event = &trace_ring->events[index & (TRACE_EVENTS - 1)];
+    __atomic_store_n(&event->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); //The 0 is seen before any of the new fields
+    event->time = now.tv_sec * 1000000000L + now.tv_nsec;
+    event->pid = trace_pid;
+    event->type = type;
+    event->phase = phase;
+    event->arg = arg;
+    __atomic_store_n(&event->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * This function should write every event still in the ring as Chrome trace
+ * JSON, which chrome://tracing and Perfetto load directly. Timestamps are
+ * microseconds of CLOCK_MONOTONIC and each pid is its own track. Returns -1
+ * if the file can't be opened.
+ * 
+ * Params:
+ *   path - file to write, or NULL for stdout
+ */
+int dump_trace(char* path){
+    FILE* out = path == NULL ? stdout : fopen(path, "w");
+    char* separator = "";
+
+    if(out == NULL){
+        return -1;
+    }
+    unsigned long head = __atomic_load_n(&trace_ring->head, __ATOMIC_ACQUIRE);
+    unsigned long first = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for(unsigned long index = first; index < head; index++){
+        struct trace_event* event = &trace_ring->events[index & (TRACE_EVENTS - 1)];
+        unsigned long sequence = __atomic_load_n(&event->sequence, __ATOMIC_ACQUIRE);
+        struct trace_event copy = *event;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); //The copy is done before the sequence is checked again
+        if(sequence != index + 1 || __atomic_load_n(&event->sequence, __ATOMIC_RELAXED) != index + 1){
+            continue; //Being written or already lapped
+        }
+        fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"smallsh\",\"ph\":\"%c\",\"ts\":%ld.%03ld,\"pid\":%d,\"tid\":%d,\"args\":{\"arg\":%ld}%s}",
+            separator, trace_names[copy.type], copy.phase, copy.time / 1000, copy.time % 1000, copy.pid, copy.pid, copy.arg,
+            copy.phase == 'i' ? ",\"s\":\"t\"" : "");
+        separator = ",";
+    }
+    fprintf(out, "\n]}\n");
+    if(head > TRACE_EVENTS){
+        fprintf(stderr, "trace: %lu oldest events were overwritten\n", head - TRACE_EVENTS);
+    }
+
+    if(path != NULL){
+        fclose(out);
+    }
+    else{
+        fflush(stdout);
+    }
+    return 0;
+}
+
+/**
+ * This function should handle the trace built-in command: "trace on" and
+ * "trace off" start and stop recording, "trace dump [file]" writes the
+ * events so far as Chrome trace JSON. Returns 1 on a usage error.
+ * 
+ * Params:
+ *   input - struct holding command args
+ */
+int trace_execute(struct command* input){
+    if(trace_ring == NULL){
+        printf("bash: trace: trace buffer unavailable\n");
+        return 1;
+    }
+    if(input->num_args == 2 && strcmp(input->args[1], "on") == 0){
+        trace_ring->enabled = 1;
+    }
+    else if(input->num_args == 2 && strcmp(input->args[1], "off") == 0){
+        trace_ring->enabled = 0;
+    }
+    else if(input->num_args >= 2 && input->num_args <= 3 && strcmp(input->args[1], "dump") == 0){
+        if(dump_trace(input->num_args == 3 ? input->args[2] : NULL) == -1){
+            file_directory_error(input->args[2]);
+            return 1;
+        }
+    }
+    else{
+        printf("bash: trace: usage: trace on|off|dump [file]\n");
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * This function should dump the trace to SMALLSH_TRACE's file at exit and
+ * unmap the ring
+ */
+void stop_trace(void){
+    if(trace_ring == NULL){
+        return;
+    }
+    if(trace_file != NULL && trace_file[0] != '\0' && dump_trace(trace_file) == -1){
+        file_directory_error(trace_file);
+    }
+    munmap(trace_ring, sizeof(struct trace_ring) + TRACE_EVENTS * sizeof(struct trace_event));
+    trace_ring = NULL;
+}
@@ -0,0 +1,481 @@
+#include "smallsh.h"
+
+int zygote_fd = -1; //Shell's end of the zygote socket, -1 if there is no zygote
+struct zygote_reply* zygote_pending = NULL; //Exit reports read while waiting for a start reply
+int zygote_num_pending = 0;
+int zygote_pending_capacity = 0;
+char* zygote_payload = NULL; //Request strings, reused across spawns
+size_t zygote_payload_size = 0;
+
+/**
+ * This function should write all of a buffer to a socket, retrying short
+ * writes. MSG_NOSIGNAL keeps a dead peer from killing us with SIGPIPE.
+ * Returns -1 if the peer is gone.
+ * 
+ * Params:
+ *   fd - socket to write to
+ *   data - bytes to write
+ *   length - number of bytes
+ */
+int zygote_write(int fd, void* data, size_t length){
+    char* ptr = data;
+    while(length > 0){
+        ssize_t num_written = send(fd, ptr, length, MSG_NOSIGNAL);
+        if(num_written == -1 && errno == EINTR){
+            continue;
+        }
+        if(num_written <= 0){
+            return -1;
+        }
+        ptr += num_written;
+        length -= num_written;
+    }
+    return 0;
+}
+
+/**
+ * This function should read exactly length bytes from a socket. Returns -1
+ * on EOF or an error.
+ * 
+ * Params:
+ *   fd - socket to read from
+ *   data - buffer to fill
+ *   length - number of bytes
+ */
+int zygote_read(int fd, void* data, size_t length){
+    char* ptr = data;
+    while(length > 0){
+        ssize_t num_read = read(fd, ptr, length);
+        if(num_read == -1 && errno == EINTR){
+            continue;
+        }
+        if(num_read <= 0){
+            return -1;
+        }
+        ptr += num_read;
+        length -= num_read;
+    }
+    return 0;
+}
+
+/**
+ * This function should start the zygote, a helper forked while the shell is
+ * still small that launches every external command for it. The shell
+ * becomes a child subreaper, so if the zygote ever dies its children are
+ * reparented to the shell and reaped like its own. Returns -1 if the zygote
+ * couldn't be started.
+ */
+int start_zygote(void){
+    int fds[2];
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1){
+        return -1;
+    }
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+    pid_t pid = fork();
+    if(pid == -1){
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if(pid == 0){
+        close(fds[0]);
+        zygote_main(fds[1]);
+    }
+
+    close(fds[1]);
+    zygote_fd = fds[0];
+    return 0;
+}
+
+/**
+ * This function should stop the zygote by closing its socket, which it
+ * reads as EOF. Commands it launched keep running.
+ */
+void stop_zygote(void){
+    if(zygote_fd != -1){
+        close(zygote_fd);
+        zygote_fd = -1;
+    }
+    free(zygote_pending);
+    free(zygote_payload);
+    zygote_pending = NULL;
+    zygote_num_pending = 0;
+    zygote_pending_capacity = 0;
+    zygote_payload = NULL;
+    zygote_payload_size = 0;
+}
+
+/**
+ * This function should give up on a zygote that stopped answering and go
+ * back to posix_spawn(). Its children belong to the shell now (it is their
+ * subreaper), so their exits come through SIGCHLD.
+ */
+void zygote_lost(void){
+    close(zygote_fd);
+    zygote_fd = -1;
+    spawn_mode = SPAWN_POSIX;
+}
+
+/**
+ * This function should append a string to the request payload, growing it
+ * geometrically
+ * 
+ * Params:
+ *   used - pointer to the bytes already in the payload (by reference)
+ *   string - NUL-terminated string to append
+ */
+void zygote_append(size_t* used, char* string){
+    size_t length = strlen(string) + 1;
+
+    if(*used + length > zygote_payload_size){
+        size_t size = zygote_payload_size == 0 ? 4096 : zygote_payload_size;
+        while(*used + length > size){
+            size *= 2;
+        }
+        zygote_payload = realloc(zygote_payload, size);
+        zygote_payload_size = size;
+    }
+    memcpy(zygote_payload + *used, string, length);
+    *used += length;
+}
+
+/**
+ * This function should launch a command through the zygote. The shell's
+ * cwd, the resolved path, args and environment are sent as NUL-separated
+ * strings and the redirection fds are passed with SCM_RIGHTS. Exit reports
+ * that arrive before the start reply are queued for reap_zygote(). Returns
+ * the child's pid, or -1 with errno set if it couldn't be launched. Falls
+ * back to spawn_posix() if the zygote is gone.
+ * 
+ * Params:
+ *   args - NULL-terminated command args
+ *   path - resolved path of args[0]
+ *   background - 1 if the child should keep ignoring SIGINT
+ *   input_fd - fd for the child's stdin, -1 to inherit
+ *   output_fd - fd for the child's stdout, -1 to inherit
+ *   error_fd - fd for the child's stderr, -1 to inherit
+ */
+pid_t spawn_zygote(char** args, char* path, int background, int input_fd, int output_fd, int error_fd){
+    struct zygote_request request = {0};
+    struct zygote_reply reply;
+    char cwd[PATH_MAX];
+    size_t used = 0;
+
+    if(getcwd(cwd, sizeof(cwd)) == NULL){
+        strcpy(cwd, ".");
+    }
+    zygote_append(&used, cwd);
+    zygote_append(&used, path);
+    for(; args[request.num_args] != NULL; request.num_args++){
+        zygote_append(&used, args[request.num_args]);
+    }
+    for(; environ[request.num_env] != NULL; request.num_env++){
+        zygote_append(&used, environ[request.num_env]);
+    }
+    request.length = used;
+    request.background = background;
+    request.has_input = input_fd != -1;
+    request.has_output = output_fd != -1;
+    request.has_error = error_fd != -1;
+    request.node = -1;
+    if(active_placement != NULL){ //Placed background job
+        request.placed = 1;
+        request.node = active_placement->node;
+        request.cpus = active_placement->cpus;
+    }
+
+    //Header carries the fds
+    int fds[3];
+    int num_fds = 0;
+    if(input_fd != -1){
+        fds[num_fds++] = input_fd;
+    }
+    if(output_fd != -1){
+        fds[num_fds++] = output_fd;
+    }
+    if(error_fd != -1){
+        fds[num_fds++] = error_fd;
+    }
+    union{
+        struct cmsghdr header;
+        char data[CMSG_SPACE(sizeof(fds))];
+    } control;
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if(num_fds > 0){
+        memset(&control, 0, sizeof(control));
+        message.msg_control = control.data;
+        message.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+    }
+
+    ssize_t num_sent;
+    do{
+        num_sent = sendmsg(zygote_fd, &message, MSG_NOSIGNAL);
+    } while(num_sent == -1 && errno == EINTR);
+    if(num_sent != sizeof(request) || zygote_write(zygote_fd, zygote_payload, used) == -1){
+        zygote_lost();
+        return spawn_posix(args, path, background, input_fd, output_fd, error_fd);
+    }
+
+    //Wait for the start reply, keeping any exit reports ahead of it
+    while(1){
+        if(zygote_read(zygote_fd, &reply, sizeof(reply)) == -1){
+            zygote_lost();
+            return spawn_posix(args, path, background, input_fd, output_fd, error_fd);
+        }
+        if(reply.type == ZYGOTE_STARTED){
+            break;
+        }
+        if(zygote_num_pending == zygote_pending_capacity){
+            zygote_pending_capacity = zygote_pending_capacity == 0 ? 16 : zygote_pending_capacity * 2;
+            zygote_pending = realloc(zygote_pending, zygote_pending_capacity * sizeof(struct zygote_reply));
+        }
+        zygote_pending[zygote_num_pending++] = reply;
+    }
+
+    if(reply.pid == -1){
+        errno = reply.error;
+        return -1;
+    }
+    return reply.pid;
+}
+
+/**
+ * This function should apply every exit report from the zygote to the job
+ * table: the ones queued by spawn_zygote() first, then whatever is waiting
+ * on the socket
+ * 
+ * Params:
+ *   jobs - job table
+ */
+void reap_zygote(struct job_table* jobs){
+    struct zygote_reply reply;
+    struct pollfd zygote_poll = {zygote_fd, POLLIN, 0};
+
+    for(int i = 0; i < zygote_num_pending; i++){
+        finish_child(jobs, zygote_pending[i].pid, zygote_pending[i].status, &zygote_pending[i].usage);
+    }
+    zygote_num_pending = 0;
+
+    while(zygote_fd != -1 && poll(&zygote_poll, 1, 0) > 0){
+        if(zygote_read(zygote_fd, &reply, sizeof(reply)) == -1){ //Replies are written whole, so this only fails on EOF
+            zygote_lost();
+            break;
+        }
+        if(reply.type == ZYGOTE_EXITED){
+            finish_child(jobs, reply.pid, reply.status, &reply.usage);
+        }
+    }
+}
+
+/**
+ * This function should handle one launch request in the zygote. The child
+ * gets the shell's cwd, the passed fds and its own signal setup, then execs.
+ * Exec errors come back over a close-on-exec pipe, so the reply says
+ * whether the command really started, like posix_spawn(). Returns -1 once
+ * the shell has closed the socket.
+ * 
+ * Params:
+ *   fd - zygote's end of the socket
+ *   payload - pointer to the zygote's payload buffer (by reference)
+ *   payload_size - pointer to the payload buffer's size (by reference)
+ *   vectors - pointer to the zygote's args/env pointer array (by reference)
+ *   vectors_size - pointer to the number of pointers it holds (by reference)
+ */
+int zygote_serve(int fd, char** payload, size_t* payload_size, char*** vectors, size_t* vectors_size){
+    struct zygote_request request;
+    struct zygote_reply reply = {0};
+    int passed[3] = {-1, -1, -1};
+    union{
+        struct cmsghdr header;
+        char data[CMSG_SPACE(sizeof(passed))];
+    } control;
+    struct iovec iov = {&request, sizeof(request)};
+    struct msghdr message = {0};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+
+    ssize_t num_read;
+    do{
+        num_read = recvmsg(fd, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while(num_read == -1 && errno == EINTR);
+    if(num_read != sizeof(request)){
+        return -1;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+        memcpy(passed, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0));
+    }
+    int input_fd = request.has_input ? passed[0] : -1;
+    int output_fd = request.has_output ? passed[request.has_input] : -1;
+    int error_fd = request.has_error ? passed[request.has_input + request.has_output] : -1;
+
+    if(request.length > *payload_size){
+        *payload_size = request.length;
+        *payload = realloc(*payload, *payload_size);
+    }
+    size_t num_vectors = request.num_args + request.num_env + 2;
+    if(num_vectors > *vectors_size){
+        *vectors_size = num_vectors * 2;
+        *vectors = realloc(*vectors, *vectors_size * sizeof(char*));
+    }
+    if(zygote_read(fd, *payload, request.length) == -1){
+        return -1;
+    }
+
+    //cwd, path, args, env
+    char* ptr = *payload;
+    char* cwd = ptr;
+    ptr += strlen(ptr) + 1;
+    char* path = ptr;
+    ptr += strlen(ptr) + 1;
+    char** args = *vectors;
+    char** env = *vectors + request.num_args + 1;
+    for(int i = 0; i < request.num_args; i++){
+        args[i] = ptr;
+        ptr += strlen(ptr) + 1;
+    }
+    args[request.num_args] = NULL;
+    for(int i = 0; i < request.num_env; i++){
+        env[i] = ptr;
+        ptr += strlen(ptr) + 1;
+    }
+    env[request.num_env] = NULL;
+
+    int status_pipe[2];
+    int err = 0;
+    pid_t pid = -1;
+    if(pipe2(status_pipe, O_CLOEXEC) == 0){
+        pid = fork();
+        if(pid == 0){
+            sigset_t empty_set;
+            if(TRACING){
+                trace_child();
+            }
+            sigemptyset(&empty_set);
+            signal(SIGINT, request.background ? SIG_IGN : SIG_DFL); //SIGTSTP stays ignored
+            sigprocmask(SIG_SETMASK, &empty_set, NULL);
+            if(request.placed){
+                sched_setaffinity(0, sizeof(cpu_set_t), &request.cpus);
+                if(request.node != -1){
+                    bind_memory(request.node);
+                }
+            }
+            TRACE(TRACE_DUP2, 'B', 0);
+            if((input_fd != -1 && dup2(input_fd, 0) == -1) || (output_fd != -1 && dup2(output_fd, 1) == -1) ||
+                (error_fd != -1 && dup2(error_fd, 2) == -1)){
+                err = errno;
+            }
+            TRACE(TRACE_DUP2, 'E', 0);
+            TRACE(TRACE_EXEC, 'i', 0);
+            if(err != 0 || chdir(cwd) == -1 || execve(path, args, env) == -1){
+                err = err != 0 ? err : errno;
+                if(write(status_pipe[1], &err, sizeof(err)) == -1){
+                    _exit(1);
+                }
+            }
+            _exit(1);
+        }
+        if(pid == -1){
+            err = errno;
+        }
+        close(status_pipe[1]);
+        if(pid != -1 && read(status_pipe[0], &err, sizeof(err)) == sizeof(err)){ //Exec failed
+            waitpid(pid, NULL, 0);
+            pid = -1;
+        }
+        close(status_pipe[0]);
+    }
+    else{
+        err = errno;
+    }
+    if(input_fd != -1){
+        close(input_fd);
+    }
+    if(output_fd != -1){
+        close(output_fd);
+    }
+    if(error_fd != -1){
+        close(error_fd);
+    }
+
+    reply.type = ZYGOTE_STARTED;
+    reply.pid = pid;
+    reply.error = err;
+    return zygote_write(fd, &reply, sizeof(reply));
+}
+
+/**
+ * This function should reap the zygote's finished children and send the
+ * shell an exit report with the status and resource usage of each. Returns
+ * -1 if the shell is gone.
+ * 
+ * Params:
+ *   fd - zygote's end of the socket
+ *   sigchld_fd - zygote's signalfd for SIGCHLD
+ */
+int zygote_reap(int fd, int sigchld_fd){
+    struct signalfd_siginfo info;
+    struct zygote_reply reply = {0};
+    int status;
+    pid_t pid;
+
+    while(read(sigchld_fd, &info, sizeof(info)) > 0);
+    while((pid = wait4(-1, &status, WNOHANG, &reply.usage)) > 0){
+        reply.type = ZYGOTE_EXITED;
+        reply.pid = pid;
+        reply.status = status;
+        if(zygote_write(fd, &reply, sizeof(reply)) == -1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * This function should run the zygote until the shell closes its socket.
+ * SIGINT and SIGTSTP are ignored so ^C and ^Z at the terminal only reach
+ * the commands it launched.
+ * 
+ * Params:
+ *   fd - zygote's end of the socket
+ */
+void zygote_main(int fd){
+    sigset_t sigchld_set;
+    char* payload = NULL;
+    size_t payload_size = 0;
+    char** vectors = NULL;
+    size_t vectors_size = 0;
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    sigemptyset(&sigchld_set);
+    sigaddset(&sigchld_set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &sigchld_set, NULL);
+    int sigchld_fd = signalfd(-1, &sigchld_set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    struct pollfd polls[2] = {{fd, POLLIN, 0}, {sigchld_fd, POLLIN, 0}};
+    while(1){
+        if(poll(polls, 2, -1) == -1){
+            continue; //EINTR
+        }
+        if((polls[1].revents & POLLIN) && zygote_reap(fd, sigchld_fd) == -1){
+            break;
+        }
+        if((polls[0].revents & (POLLIN | POLLHUP | POLLERR)) && zygote_serve(fd, &payload, &payload_size, &vectors, &vectors_size) == -1){
+            break;
+        }
+    }
+    _exit(0);
+}